@@ -16,19 +16,34 @@
 #include "debug.h"
 #include "server.h"
 #include "ntp.h"
-#include "wifi.h";
+#include "wifi.h"
 #include "settings.h"
 #include "channel.h"
+#include "effects.h"
+#include "scenes.h"
+#include "profiles.h"
+#include "sync.h"
+#include "benchmark.h"
+#include "watchdog.h"
+#include "idle.h"
+#include "mqtt.h"
+#include "ota.h"
 
 void setup() {
   // starts the DEBUG Serial Port defined in debug.h
   DEBUG_BEGIN;
   DEBUG_INFO("[setup] begin");
-  // loads the settings from the file "SPIFFS
+  // reads the dump of the last run from the RTC memory and starts the watchdog of the main loop
+  startWatchdog();
+  // restores the settings of an interrupted benchmark
+  startBenchmark();
+  // loads the settings from the file system
   if(!loadSettings()) {
     saveDefaultSettings();
     loadSettings();
   }
+  // restores the outputs and the time held across a restart, e.g. after an update
+  restoreOutputs();
   // configures the PWM generator
   configurePWM();
   // starts the WiFi
@@ -37,15 +52,57 @@ void setup() {
   startServer();
   // starts the NTP Service
   startNTP();
+  // starts the sync with other devices
+  startSync();
+  // starts the effect renderer
+  startEffects();
+  // connects to the mqtt broker
+  startMqtt();
   DEBUG_INFO("[setup] end");
 }
 
 
 void loop() {
+  // resolves the profile of the day at midnight
+  startStage(STAGE_PROFILES);
+  handleProfiles();
+  endStage();
+  // handles the scheduled scenes
+  startStage(STAGE_SCENES);
+  handleScenes();
+  endStage();
   // handles the PWM Update
+  startStage(STAGE_PWM);
   handlePWM(false);
+  endStage();
   // handles the Server interaction
+  startStage(STAGE_SERVER);
   handleServer();
+  // restarts after an update
+  handleOta();
+  endStage();
   // handles the NTP Service
+  startStage(STAGE_NTP);
   handleNTP();
+  endStage();
+  // handles the sync with other devices
+  startStage(STAGE_SYNC);
+  handleSync();
+  endStage();
+  // writes the frames of the effect renderer
+  startStage(STAGE_EFFECTS);
+  handleEffects();
+  endStage();
+  // writes the log records to the serial port
+  startStage(STAGE_LOG);
+  handleLog();
+  endStage();
+  // publishes the state to the mqtt broker
+  startStage(STAGE_MQTT);
+  handleMqtt();
+  endStage();
+  // sleeps until the next stage is due
+  startStage(STAGE_IDLE);
+  handleIdle();
+  endStage();
 }
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "benchmark.h"
+#include "server.h"
+#include "settings.h"
+#include "channel.h"
+#include "pwm.h"
+#include "effects.h"
+#include "profiles.h"
+#include "storage.h"
+#include "watchdog.h"
+#include "debug.h"
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+
+// cpu cycles of the iterations of one benchmark
+struct BenchmarkResult {
+  uint32_t count = 0;
+  uint32_t min = UINT32_MAX;
+  uint32_t max = 0;
+  uint64_t total = 0;
+
+  void add(const uint32_t cycles) {
+    count++;
+    total += cycles;
+    if(cycles < min) min = cycles;
+    if(cycles > max) max = cycles;
+  }
+};
+
+volatile float benchmarkSink; // keeps the compiler from removing the benchmarked calls
+
+
+/*
+ * Adds the result "r" of benchmark "name" to "results"
+ * "id" is the id of the websocket message and "bytes" its length, both are only added if they are not 0
+ */
+void addBenchmarkResult(JsonArray& results, const char *name, const uint8_t id, const BenchmarkResult& r, const size_t bytes) {
+  JsonObject& jsonResult = results.createNestedObject();
+  jsonResult[CHAR_BENCHMARK_NAME] = name;
+  if(id) jsonResult["id"] = id;
+  jsonResult[CHAR_BENCHMARK_AVG] = r.count ? uint32_t(r.total / r.count) : 0;
+  jsonResult[CHAR_BENCHMARK_MIN] = r.count ? r.min : 0;
+  jsonResult[CHAR_BENCHMARK_MAX] = r.max;
+  if(bytes) jsonResult[CHAR_BENCHMARK_BYTES] = bytes;
+  // each benchmark is within the budget of the server stage, all of them together are not
+  feedWatchdog();
+  yield();
+}
+
+
+void startBenchmark() {
+  if(fileExists(BENCHMARK_BACKUP_FILE_NAME)) {
+    DEBUG_WARNING("[startBenchmark] benchmark has been interrupted, the settings are restored");
+    removeFile(SETTINGS_FILE_NAME);
+    renameFile(BENCHMARK_BACKUP_FILE_NAME, SETTINGS_FILE_NAME);
+  }
+}
+
+
+/*
+ * Measures the cpu cycles of the control, persistence and protocol paths
+ * The channels are replaced by "channels" channels with "entries" entries each (parameters of the http request), so the
+ * results of different commits can be compared with the same load. The outputs are written to the recording driver and
+ * the settings are kept in "BENCHMARK_BACKUP_FILE_NAME" in the meantime, afterwards the settings are loaded again.
+ *
+ * benchmarks:
+ *   schedule: "getScheduleValue" of one channel, the time runs once through the day
+ *   handlePWM: a forced PWM update of all channels
+ *   saveSettings, loadSettings: a round trip through the storage, at most "MAX_BENCHMARK_FLASH_ITERATIONS" times
+ *   readCached, readBackend: reading the settings file from the read cache and from the storage backend
+ *   serialize: the answer to the request with "id", including the json serialization
+ *   parse: the parsing of the answer with "id"
+ *   apply: the command "id", without saving and PWM update
+ *
+ * The results are the average, minimal and maximal cpu cycles of one iteration, "cpuMHz" converts them to us.
+ */
+void runBenchmark(AsyncWebServerRequest *request) {
+  // the arguments are checked as int32_t before they are narrowed, so e.g. 257 channels do not wrap to 1
+  int32_t channelsArg = request->hasArg("channels") ? request->arg("channels").toInt() : numOfChannels;
+  int32_t entriesArg = request->hasArg("entries") ? request->arg("entries").toInt() : DEFAULT_BENCHMARK_ENTRIES;
+  int32_t iterationsArg = request->hasArg("iterations") ? request->arg("iterations").toInt() : DEFAULT_BENCHMARK_ITERATIONS;
+  if(channelsArg < 1 || channelsArg > MAX_NUM_OF_CHANNELS || entriesArg < 2 || entriesArg > MAX_NUM_OF_ENTRIES ||
+     iterationsArg < 1 || iterationsArg > MAX_BENCHMARK_ITERATIONS) {
+    sendDeferred(400, F("text/plain"), F("invalid channels, entries or iterations"));
+    return;
+  }
+  uint8_t n = channelsArg;
+  uint8_t m = entriesArg;
+  uint16_t iterations = iterationsArg;
+  DEBUG_INFO("[handleBenchmark] channels: %d, entries: %d, iterations: %d", n, m, iterations);
+
+  // the settings are kept, the outputs are recorded only and the effect is stopped
+  removeFile(BENCHMARK_BACKUP_FILE_NAME);
+  renameFile(SETTINGS_FILE_NAME, BENCHMARK_BACKUP_FILE_NAME);
+  uint8_t savedEffect = effect;
+  effect = EFFECT_NONE;
+  startEffects();
+  selectPWMOutput(PWM_GENERATOR_RECORDING, PWMInverted);
+
+  // channels with "m" entries spread over the day, using all interpolations
+  numOfChannels = n;
+  for(uint8_t c=0; c<n; c++) {
+    channels[c].manual = false;
+    channels[c].moonlight = false;
+    channels[c].interpolation = c % 3;
+    channels[c].numOfEntries = m;
+    for(uint8_t i=0; i<m; i++) {
+      channels[c].t[i] = uint32_t(i) * 24*60*60 / m + c * 60;
+      channels[c].v[i] = (i * 37 + c * 11) % 101;
+    }
+    channels[c].prepareSchedule();
+  }
+  resolveProfiles();
+  resetPowerLimit();
+
+  DynamicJsonBuffer jsonBuffer;
+  JsonObject& jsonOut = jsonBuffer.createObject();
+  jsonOut[CHAR_NUM_OF_CHANNELS] = n;
+  jsonOut[CHAR_BENCHMARK_ENTRIES] = m;
+  jsonOut[CHAR_BENCHMARK_ITERATIONS] = iterations;
+  jsonOut[CHAR_BENCHMARK_CPU_MHZ] = ESP.getCpuFreqMHz();
+  JsonArray& jsonResults = jsonOut.createNestedArray(CHAR_BENCHMARK_RESULTS);
+
+  // schedule evaluation
+  BenchmarkResult schedule;
+  for(uint16_t it=0; it<iterations; it++) {
+    uint32_t t = uint32_t(it) * 24*60*60 / iterations;
+    for(uint8_t c=0; c<n; c++) {
+      uint32_t start = ESP.getCycleCount();
+      benchmarkSink = channels[c].getScheduleValue(t);
+      schedule.add(ESP.getCycleCount() - start);
+    }
+  }
+  addBenchmarkResult(jsonResults, "schedule", 0, schedule, 0);
+
+  // PWM update
+  BenchmarkResult pwm;
+  for(uint16_t it=0; it<iterations; it++) {
+    uint32_t start = ESP.getCycleCount();
+    handlePWM(true);
+    pwm.add(ESP.getCycleCount() - start);
+  }
+  addBenchmarkResult(jsonResults, "handlePWM", 0, pwm, 0);
+
+  // settings round trip
+  BenchmarkResult save, load;
+  for(uint16_t it=0; it<iterations && it<MAX_BENCHMARK_FLASH_ITERATIONS; it++) {
+    uint32_t start = ESP.getCycleCount();
+    saveSettings();
+    save.add(ESP.getCycleCount() - start);
+    start = ESP.getCycleCount();
+    loadSettings();
+    load.add(ESP.getCycleCount() - start);
+  }
+  addBenchmarkResult(jsonResults, "saveSettings", 0, save, 0);
+  addBenchmarkResult(jsonResults, "loadSettings", 0, load, 0);
+
+  // reading the settings file from the cache and from the backend
+  BenchmarkResult readCached, readBackend;
+  String content;
+  for(uint16_t it=0; it<iterations && it<MAX_BENCHMARK_FLASH_ITERATIONS; it++) {
+    uint32_t start = ESP.getCycleCount();
+    readFile(SETTINGS_FILE_NAME, content);
+    readCached.add(ESP.getCycleCount() - start);
+    start = ESP.getCycleCount();
+    StorageBackend::read(SETTINGS_FILE_NAME, content);
+    readBackend.add(ESP.getCycleCount() - start);
+  }
+  addBenchmarkResult(jsonResults, "readCached", 0, readCached, content.length());
+  addBenchmarkResult(jsonResults, "readBackend", 0, readBackend, content.length());
+
+  // websocket messages
+  const uint8_t requests[] = {ID_REQUEST_MANUAL_FROM_SERVER, ID_REQUEST_SCHEDULE_FROM_SERVER, ID_REQUEST_SETTINGS_FROM_SERVER,
+                              ID_REQUEST_SCENES_FROM_SERVER, ID_REQUEST_PROFILES_FROM_SERVER, ID_REQUEST_LOG_FROM_SERVER};
+  String reply;
+  String manualReply;
+  for(uint8_t r=0; r<sizeof(requests); r++) {
+    BenchmarkResult serialize, parse;
+    capturedReply = &reply;
+    for(uint16_t it=0; it<iterations; it++) {
+      DynamicJsonBuffer buffer;
+      JsonObject& jsonRequest = buffer.createObject();
+      jsonRequest["id"] = requests[r];
+      uint32_t start = ESP.getCycleCount();
+      applyCommand(0, jsonRequest, buffer);
+      serialize.add(ESP.getCycleCount() - start);
+    }
+    capturedReply = NULL;
+    for(uint16_t it=0; it<iterations; it++) {
+      DynamicJsonBuffer buffer;
+      uint32_t start = ESP.getCycleCount();
+      benchmarkSink = buffer.parseObject(reply).success();
+      parse.add(ESP.getCycleCount() - start);
+    }
+    addBenchmarkResult(jsonResults, "serialize", requests[r] + 1, serialize, reply.length());
+    addBenchmarkResult(jsonResults, "parse", requests[r] + 1, parse, 0);
+    if(requests[r] == ID_REQUEST_MANUAL_FROM_SERVER) manualReply = reply;
+  }
+
+  // manual update, the message of the manual page
+  BenchmarkResult apply;
+  capturedReply = &reply;
+  for(uint16_t it=0; it<iterations; it++) {
+    DynamicJsonBuffer buffer;
+    uint32_t start = ESP.getCycleCount();
+    JsonObject& command = buffer.parseObject(manualReply);
+    command["id"] = ID_UPDATE_MANUAL;
+    applyCommand(0, command, buffer);
+    apply.add(ESP.getCycleCount() - start);
+  }
+  capturedReply = NULL;
+  addBenchmarkResult(jsonResults, "apply", ID_UPDATE_MANUAL, apply, manualReply.length());
+
+  // restores the settings, the outputs and the effect
+  removeFile(SETTINGS_FILE_NAME);
+  renameFile(BENCHMARK_BACKUP_FILE_NAME, SETTINGS_FILE_NAME);
+  loadSettings();
+  selectPWMOutput(PWMGenerator, PWMInverted);
+  effect = savedEffect;
+  startEffects();
+  handlePWM(true);
+
+  String jsonOutStr;
+  jsonOut.printTo(jsonOutStr);
+  DEBUG_PORT.println(jsonOutStr);
+  sendDeferred(200, F("application/json"), jsonOutStr);
+}
+
+
+void handleBenchmark(AsyncWebServerRequest *request) {
+  // the benchmark blocks for seconds, so it runs in the main loop instead of the callback of the server
+  deferRequest(request, runBenchmark);
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef BENCHMARK__H
+#define BENCHMARK__H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// constants
+static const uint16_t DEFAULT_BENCHMARK_ITERATIONS = 100; // default number of iterations of each benchmark
+static const uint16_t MAX_BENCHMARK_ITERATIONS = 1000; // max number of iterations of each benchmark
+static const uint16_t MAX_BENCHMARK_FLASH_ITERATIONS = 10; // max number of iterations that write to the flash
+static const uint8_t DEFAULT_BENCHMARK_ENTRIES = 8; // default number of entries per channel
+
+// restores the settings if a benchmark has been interrupted, must be called before the settings are loaded
+void startBenchmark();
+// runs the benchmarks and sends the results as json to the http client and to the serial port
+void handleBenchmark(AsyncWebServerRequest *request);
+
+#endif
@@ -16,9 +16,10 @@
 #include "channel.h"
 #include "debug.h"
 #include "ntp.h"
+#include "effects.h"
+#include "pwm.h"
+#include "settings.h"
 #include <Arduino.h>
-#include <Wire.h>
-#include <Adafruit_PWMServoDriver.h>
 
 /*
  * Global variables
@@ -26,9 +27,20 @@
 uint8_t numOfChannels; // current number of used channels
 uint32_t PWMFrequency; // frequency used to generate the PWM Signal
 uint16_t PWMGenerator; // defines if the PWM signal is generated by the ESP8266 itself or the PCA9685
+bool PWMInverted; // if true: the PWM signals are inverted (low while the channel is on)
+bool PWMOpenDrain; // if true: the outputs are open drain instead of push pull
 unsigned long millisAtLastPWMUpdate; // millis upime of the device since the last PWM Update
+uint32_t tickAtLastPWMUpdate; // epoch time in "MILLIS_BETWEEN_PWM_UPDATES" at the last PWM update
+bool fading = false; // true if a channel was fading at the last PWM update
 Channel channels[MAX_NUM_OF_CHANNELS]; // array storing all channels
-Adafruit_PWMServoDriver PCA9685Shield = Adafruit_PWMServoDriver(); // Object representing the PCA9685 PWM Module
+float maxPower; // maximal power consumption of all channels together in W, 0 means no limit
+uint8_t powerLimitMode; // defines if the channels are dimmed proportionally or by priority if "maxPower" is exceeded
+float powerLimitFactor = 1; // ratio of the generated to the requested power, 1 if the power limit is not exceeded
+float currentPower; // current power consumption of all channels in W after the power limit is applied
+uint32_t pwmUpdates = 0; // number of PWM updates that were due, without the forced updates
+uint32_t pwmMaxLateness = 0; // max time in ms a PWM update was late
+uint32_t pwmMissedTicks = 0; // number of PWM updates that were skipped because the main loop was stalled
+float requestedPowerOfPriority[NUM_OF_PRIORITIES]; // running total of the requested power in W for each priority
 
 
 /*
@@ -47,33 +59,35 @@ void Channel::print() {
   DEBUG_INFO("Color: %s", color);
   DEBUG_INFO("Pin: %d", pin);
   DEBUG_INFO("Power: %f", power);
+  DEBUG_INFO("Priority: %d", priority);
+  DEBUG_INFO("Lightning: %d", lightning);
   DEBUG_INFO("Manual: %d", manual);
   DEBUG_INFO("Moonlight: %d", moonlight);
   DEBUG_INFO("Max Moonlight value: %f", maxMoonlightValue);
   DEBUG_INFO("value: %f", value);
+  DEBUG_INFO("output: %f", output);
+  DEBUG_INFO("Interpolation: %d", interpolation);
   DEBUG_INFO("Number of entries: %d", numOfEntries);
   DEBUG_INFO("Entry | Time | Value [%]");
-  for(uint8_t i=0; i<numOfEntries; i++)  DEBUG_INFO("%d | %d | %d\n",i,t[i],v[i]);
+  for(uint8_t i=0; i<numOfEntries; i++)  DEBUG_INFO("%d | %d | %f",i,t[i],v[i]);
 }
 
 
 /*
- * Updates the PWM signal every "MILLIS_BETWEEN_PWM_UPDATES"
+ * Updates the "value" every "MILLIS_BETWEEN_PWM_UPDATES"
  * therefore the "value" is updated according to the lightschedule if the
  * channel is in automatic mode ("manual" == false)
  * Ff the channel is in manual mode ("manual" == true) "value" is not updated according to 
  * the lightschedule
  * If the channel is in moonlight mode ("moonlight" == true), "value" is calculated according to 
  * the moonlight simulation
- * 
- * In the end the ¨value" is defining the new duty cycle of the PWM signal generated by "PWMGenerator"
  */
-void Channel::updatePWM() {
+void Channel::updateValue() {
   
   if(moonlight) {
     // moonlight simulation TODO
     value = 0;
-    DEBUG_INFO("[Channel::updatePWM {%d}] moonlight, value: %f", channelNumber, value);
+    DEBUG_DEBUG("[Channel::updateValue {%d}] moonlight, value: %f", channelNumber, value);
 
   }
   else {
@@ -81,36 +95,232 @@ void Channel::updatePWM() {
     // calculate PWM value in automatic mode
     if(!manual) {
       m = "automatic";
-      uint32_t t_ = getLocalSecondsOfTheDay();
-      for(uint8_t i=0; i<numOfEntries; i++) {
-        uint32_t t1 = t[i];
-        uint32_t t2 = t[(i+1)%numOfEntries];
-        float v1 = v[i];
-        float v2 = v[(i+1)%numOfEntries];
-        if(i+1 == numOfEntries) {
-          t2 += 24*60*60;
-          if(t_<t1) t_ += 24*60*60;
-        }
-        if(t1<t_ && t_<= t2) {
-          value = v1 + (v2-v1)/float(t2-t1)*float(t_-t1);
-        }
-      }
+      value = getScheduleValue(getLocalSecondsOfTheDay());
     }
     // no update in automatic mode
     if(manual) {
       m = "manual";
     }
-    DEBUG_INFO("[Channel::updatePWM {%d}] mode: %s, value: %f", channelNumber, m.c_str(), value);
+    DEBUG_DEBUG("[Channel::updateValue {%d}] mode: %s, value: %f", channelNumber, m.c_str(), value);
+  }
+}
+
+
+/*
+ * Returns the value in % of the schedule at the local seconds of the day t_
+ * the segment of t_ is searched from the segment of the last call, so usually only one segment is checked,
+ * and its polynomial is evaluated in fixed point without any division
+ * if there are no entries, "value" is returned
+ */
+float Channel::getScheduleValue(uint32_t t_) {
+  if(numOfSegments == 0) return value;
+  // the last segment reaches over midnight to the first entry
+  if(t_ < segments[0].start) t_ += 24*60*60;
+  uint8_t i = segment;
+  if(i >= numOfSegments || t_ < segments[i].start) i = 0;
+  while(i+1 < numOfSegments && t_ >= segments[i+1].start) i++;
+  segment = i;
+
+  const ScheduleSegment &s = segments[i];
+  int64_t u = (uint64_t(t_ - s.start) * s.invDuration) >> 16;
+  int32_t y = s.c[3];
+  y = s.c[2] + ((y * u) >> 16);
+  y = s.c[1] + ((y * u) >> 16);
+  y = s.c[0] + ((y * u) >> 16);
+  return y * (1.f / 65536);
+}
+
+
+/*
+ * Sorts the entries by time and computes the segments of the schedule
+ * The segments are computed again by "resolveProfiles" if a profile or an acclimation is active
+ */
+void Channel::prepareSchedule() {
+  if(numOfEntries > MAX_NUM_OF_ENTRIES) numOfEntries = MAX_NUM_OF_ENTRIES;
+  for(uint8_t i=1; i<numOfEntries; i++) {
+    uint32_t t_ = t[i];
+    float v_ = v[i];
+    uint8_t j = i;
+    for(; j>0 && t[j-1]>t_; j--) {
+      t[j] = t[j-1];
+      v[j] = v[j-1];
+    }
+    t[j] = t_;
+    v[j] = v_;
+  }
+  computeSegments(t, v, numOfEntries, 1);
+}
+
+
+/*
+ * Computes the polynomial of each segment between the entries according to "interpolation"
+ * The polynomials are computed in the normalized time u (0..1) of the segment with
+ *   linear:     v1 + dv*u
+ *   smoothstep: v1 + dv*(3u^2 - 2u^3)
+ *   cubic:      cubic hermite polynomial with the slopes of Fritsch-Butland at the entries, so the curve
+ *               goes smoothly through all entries and never overshoots between two of them
+ * The schedule repeats every day, so the segment after the last entry ends at the first entry of the next day.
+ */
+void Channel::computeSegments(const uint32_t *t_, const float *v_, const uint8_t n, const float scale) {
+  numOfSegments = n;
+  segment = 0;
+
+  // duration, slope of the secant and slope of the curve at the entries
+  float h[MAX_NUM_OF_ENTRIES], d[MAX_NUM_OF_ENTRIES], m[MAX_NUM_OF_ENTRIES];
+  for(uint8_t i=0; i<n; i++) {
+    uint8_t next = (i+1) % n;
+    h[i] = float(t_[next]) - float(t_[i]) + (i+1 == n ? 24*60*60 : 0);
+    d[i] = h[i] > 0 ? (v_[next] - v_[i]) * scale / h[i] : 0;
+  }
+  for(uint8_t i=0; i<n; i++) {
+    uint8_t prev = (i+n-1) % n;
+    m[i] = 0;
+    if(d[prev] * d[i] > 0) {
+      float w1 = 2*h[i] + h[prev];
+      float w2 = h[i] + 2*h[prev];
+      m[i] = (w1 + w2) / (w1 / d[prev] + w2 / d[i]);
+    }
+  }
+
+  for(uint8_t i=0; i<n; i++) {
+    uint8_t next = (i+1) % n;
+    float dv = (v_[next] - v_[i]) * scale;
+    float c[4] = {v_[i] * scale, dv, 0, 0};
+    switch(interpolation) {
+      case INTERPOLATION_SMOOTHSTEP:
+        c[1] = 0;
+        c[2] = 3*dv;
+        c[3] = -2*dv;
+        break;
+      case INTERPOLATION_CUBIC: {
+        float m1 = m[i] * h[i];
+        float m2 = m[next] * h[i];
+        c[1] = m1;
+        c[2] = 3*dv - 2*m1 - m2;
+        c[3] = m1 + m2 - 2*dv;
+        break;
+      }
+    }
+    segments[i].start = t_[i];
+    segments[i].invDuration = h[i] >= 1 ? uint32_t(0xFFFFFFFFUL / uint32_t(h[i])) : 0;
+    for(uint8_t k=0; k<4; k++) segments[i].c[k] = lroundf(c[k] * 65536);
+  }
+}
+
+
+/*
+ * Starts to fade "value" to "target" within "fadeMillis"
+ * "value" is changed by "fadeStep" every "MILLIS_BETWEEN_FADE_STEPS", so the fade
+ * is calculated incrementally
+ * If "toAutomatic" is true, the channel is set back to automatic mode at the end of the fade
+ */
+void Channel::startFade(const float target, const uint32_t fadeMillis, const bool toAutomatic) {
+  fadeTarget = target;
+  fadeToAutomatic = toAutomatic;
+  fadeStepsLeft = fadeMillis / MILLIS_BETWEEN_FADE_STEPS;
+  if(fadeStepsLeft == 0) {
+    updateFade(1);
+    return;
+  }
+  fadeStep = (target - value) / float(fadeStepsLeft);
+}
+
+
+/*
+ * Stops the fade, "value" keeps its current value
+ */
+void Channel::stopFade() {
+  fadeStepsLeft = 0;
+  fadeToAutomatic = false;
+}
+
+
+/*
+ * Makes "steps" fade steps
+ * At the end of the fade "value" is set exactly to "fadeTarget"
+ */
+void Channel::updateFade(const uint32_t steps) {
+  if(steps == 0) return;
+  if(steps >= fadeStepsLeft) {
+    fadeStepsLeft = 0;
+    value = fadeTarget;
+    if(fadeToAutomatic) manual = false;
+    fadeToAutomatic = false;
+  }
+  else {
+    fadeStepsLeft -= steps;
+    value += fadeStep * steps;
+  }
+}
+
+
+/*
+ * Sets the duty cycle of the PWM signal generated by "PWMGenerator"
+ * according to "output"
+ */
+void Channel::updatePWM() {
+  writePWM(channelNumber, output/100. * 65535);
+}
+
+
+/*
+ * Sets the duty cycle of the PWM signal of channel c generated by "PWMGenerator"
+ * the duty cycle goes from 0 to 65535 and is scaled to the resolution of the "PWMGenerator" by its driver
+ */
+void writePWM(const uint8_t c, const uint16_t duty) {
+  pwmOutput.write(c, duty);
+  pwmOutput.commit();
+}
+
+
+/*
+ * Adds the change of the requested power of the channel to the running totals
+ * so the requested power of all channels does not need to be summed up on every update
+ */
+void addRequestedPower(Channel &channel) {
+  float p = channel.value / 100. * channel.power;
+  requestedPowerOfPriority[channel.priority] += p - channel.requestedPower;
+  channel.requestedPower = p;
+}
+
+
+/*
+ * Limits the "output" of the channels, so the power consumption of all channels together
+ * does not exceed "maxPower"
+ * In POWER_LIMIT_PROPORTIONAL mode all channels are dimmed by the same factor
+ * In POWER_LIMIT_PRIORITY mode the power is given to the channels with the highest priority
+ * first and the channels with the lowest priority are dimmed first
+ */
+void applyPowerLimit() {
+  float requestedPower = 0;
+  for(uint8_t p=0; p<NUM_OF_PRIORITIES; p++) requestedPower += requestedPowerOfPriority[p];
+
+  // factor for each priority
+  float factor[NUM_OF_PRIORITIES];
+  for(uint8_t p=0; p<NUM_OF_PRIORITIES; p++) factor[p] = 1;
+  currentPower = requestedPower;
+  if(maxPower > 0 && requestedPower > maxPower) {
+    switch(powerLimitMode) {
+      case POWER_LIMIT_PROPORTIONAL:
+        for(uint8_t p=0; p<NUM_OF_PRIORITIES; p++) factor[p] = maxPower / requestedPower;
+        break;
+      case POWER_LIMIT_PRIORITY: {
+        float remainingPower = maxPower;
+        for(uint8_t p=0; p<NUM_OF_PRIORITIES; p++) {
+          if(requestedPowerOfPriority[p] > remainingPower) factor[p] = remainingPower / requestedPowerOfPriority[p];
+          remainingPower -= factor[p] * requestedPowerOfPriority[p];
+        }
+        break;
+      }
+    }
+    currentPower = maxPower;
+  }
+  powerLimitFactor = requestedPower > 0 ? currentPower / requestedPower : 1;
+
+  for(uint8_t c=0; c<numOfChannels; c++) channels[c].output = channels[c].value * factor[channels[c].priority];
+  if(powerLimitFactor < 1) {
+    DEBUG_DEBUG("[applyPowerLimit] requested power: %f W, limiting factor: %f", requestedPower, powerLimitFactor);
   }
-  // set pwm
-  switch(PWMGenerator) {
-    case PWM_GENERATOR_ESP8266:
-      analogWrite(pin, value/100. * 1023);
-      break;
-    case PWM_GENERATOR_PCA9685:
-      PCA9685Shield.setPWM(channelNumber, 0, float(value/100. * 4095));
-      break;
-  }    
 }
 
 
@@ -124,26 +334,13 @@ void printAllChannels() {
 
 /*
  * Configures the PWMGenerator
- * if the PWM is generated by the ESP8266 the pins are set as outputs
- * if the PWM is generated by the PCA9685 the I2C module is configured
+ * selects the driver of "PWMGenerator" (see pwm.h) and configures its outputs,
+ * the pins of the ESP8266 or the I2C PCA9685 module
  */
 void configurePWM() {
   millisAtLastPWMUpdate = 0;
-  
-  switch(PWMGenerator) {
-    case PWM_GENERATOR_ESP8266:
-      DEBUG_INFO("[configurePWM] pwm generated by ESP8266");
-      for(uint8_t c=0; c<numOfChannels; c++) {
-        pinMode(channels[c].pin, OUTPUT);
-        digitalWrite(channels[c].pin, 0);
-      }
-      break;
-    case PWM_GENERATOR_PCA9685:
-      DEBUG_INFO("[configurePWM] pwm generated by PCA9685");
-      PCA9685Shield.begin();
-      for(uint8_t c=0; c<numOfChannels; c++) PCA9685Shield.setPin(c, 0, false);     
-      break;
-  }
+  selectPWMOutput(PWMGenerator, PWMInverted);
+  pwmOutput.begin(PWMOpenDrain);
   setPWMFrequency(PWMFrequency);
 }
 
@@ -154,28 +351,102 @@ void configurePWM() {
 void setPWMFrequency(const uint32_t f) {
   DEBUG_INFO("[setPWMFrequency] new frequency: %d Hz",f);
   PWMFrequency = f;
-  switch(PWMGenerator) {
-    case PWM_GENERATOR_ESP8266:
-      analogWriteFreq(f);
-      break;
-    case PWM_GENERATOR_PCA9685:
-      PCA9685Shield.setPWMFreq(f);
-      break;
-  }  
+  pwmOutput.setFrequency(f);
 }
 
 
 /*
  * handles the PWM generation in the main loop
- * every "MILLIS_BETWEEN_PWM_UPDATES" the PWM values are updated
+ * every "MILLIS_BETWEEN_PWM_UPDATES" the PWM values are updated, the updates are aligned to the
+ * epoch time, so all devices with the same time update their PWM values at the same time
+ * while a channel is fading, the PWM values are updated every "MILLIS_BETWEEN_FADE_STEPS"
+ * and a fade step is made for every "MILLIS_BETWEEN_FADE_STEPS" that has passed
+ * if an effect is running, the PWM signals are generated by the effect renderer
  * if (force == true) the update is forced
  */
 void handlePWM(const bool force) {
-  if(millis() - millisAtLastPWMUpdate > MILLIS_BETWEEN_PWM_UPDATES || force) {
-    for(uint8_t c=0; c<numOfChannels; c++) channels[c].updatePWM();
-    millisAtLastPWMUpdate = millis();
+  unsigned long millisSinceLastPWMUpdate = millis() - millisAtLastPWMUpdate;
+  uint32_t tick = epochMillis() / MILLIS_BETWEEN_PWM_UPDATES;
+  bool due = fading ? millisSinceLastPWMUpdate > MILLIS_BETWEEN_FADE_STEPS : tick != tickAtLastPWMUpdate;
+  if(due || force) {
+    // how late the update is, e.g. because the main loop has been stalled
+    if(due) {
+      uint32_t lateness = fading ? millisSinceLastPWMUpdate - MILLIS_BETWEEN_FADE_STEPS : epochMillis() % MILLIS_BETWEEN_PWM_UPDATES;
+      if(lateness > pwmMaxLateness) pwmMaxLateness = lateness;
+      if(!fading && tickAtLastPWMUpdate > 0 && tick - tickAtLastPWMUpdate > 1 && tick - tickAtLastPWMUpdate < 100) pwmMissedTicks += tick - tickAtLastPWMUpdate - 1;
+      pwmUpdates++;
+    }
+    tickAtLastPWMUpdate = tick;
+    uint32_t fadeSteps = fading ? millisSinceLastPWMUpdate / MILLIS_BETWEEN_FADE_STEPS : 0;
+    fading = false;
+    // the values before the update, the revision of the channels is only increased if one of them changes
+    static uint8_t manualMask = 0;
+    uint8_t newManualMask = 0;
+    float lastValues[MAX_NUM_OF_CHANNELS];
+    float lastOutputs[MAX_NUM_OF_CHANNELS];
+    for(uint8_t c=0; c<numOfChannels; c++) {
+      lastValues[c] = channels[c].value;
+      lastOutputs[c] = channels[c].output;
+      if(channels[c].manual) newManualMask |= 1 << c;
+    }
+    for(uint8_t c=0; c<numOfChannels; c++) {
+      channels[c].updateFade(fadeSteps);
+      if(channels[c].fadeStepsLeft > 0) fading = true;
+      channels[c].updateValue();
+      addRequestedPower(channels[c]);
+    }
+    applyPowerLimit();
+    bool changed = newManualMask != manualMask;
+    for(uint8_t c=0; c<numOfChannels; c++) {
+      if(channels[c].value != lastValues[c] || channels[c].output != lastOutputs[c]) changed = true;
+    }
+    if(changed) revisionChannels++;
+    manualMask = newManualMask;
+    if(effect == EFFECT_NONE) {
+      pwmOutput.writeAll();
+    }
+    else updateEffectOutputs();
+    // the time that has not been used for a fade step yet is kept for the next update
+    if(fadeSteps > 0 && fading) millisAtLastPWMUpdate += fadeSteps * MILLIS_BETWEEN_FADE_STEPS;
+    else millisAtLastPWMUpdate = millis();
   }
 }
 
 
 
+/*
+ * Returns the time in ms until the next fade step or the next PWM tick, so the main loop can sleep until then
+ */
+uint32_t millisUntilPWMUpdate() {
+  if(fading) {
+    unsigned long millisSinceLastPWMUpdate = millis() - millisAtLastPWMUpdate;
+    return millisSinceLastPWMUpdate > MILLIS_BETWEEN_FADE_STEPS ? 0 : MILLIS_BETWEEN_FADE_STEPS + 1 - millisSinceLastPWMUpdate;
+  }
+  return MILLIS_BETWEEN_PWM_UPDATES - epochMillis() % MILLIS_BETWEEN_PWM_UPDATES;
+}
+
+/*
+ * Reads back one channel from the PWM generator every "MILLIS_BETWEEN_PWM_CHECKS"
+ * A channel that lost its duty cycle, e.g. by a glitch on the I2C bus, is corrected within a few seconds instead
+ * of the next PWM update, which does not write unchanged channels.
+ */
+void checkPWM() {
+  static unsigned long millisAtLastPWMCheck = 0;
+  if(millis() - millisAtLastPWMCheck < MILLIS_BETWEEN_PWM_CHECKS) return;
+  millisAtLastPWMCheck = millis();
+  pwmOutput.check();
+}
+
+
+/*
+ * resets the running totals of the requested power
+ * must be called if the number of channels, the power or the priority of a channel has changed
+ */
+void resetPowerLimit() {
+  for(uint8_t p=0; p<NUM_OF_PRIORITIES; p++) requestedPowerOfPriority[p] = 0;
+  for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
+    if(channels[c].priority >= NUM_OF_PRIORITIES) channels[c].priority = NUM_OF_PRIORITIES-1;
+    channels[c].requestedPower = 0;
+  }
+  for(uint8_t c=0; c<numOfChannels; c++) addRequestedPower(channels[c]);
+}
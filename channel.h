@@ -25,7 +25,23 @@ static const uint8_t MAX_NUM_OF_ENTRIES = 16; // max number of entries (time-val
 static const uint8_t MAX_NUM_OF_CHANNELS = 8; // max number of channels
 static const uint8_t PWM_GENERATOR_ESP8266 = 0; // Macros either the PWM is generated by a ESP8266 
 static const uint8_t PWM_GENERATOR_PCA9685 = 1; // or the I2C PCA9685 module
+static const uint8_t PWM_GENERATOR_RECORDING = 2; // or not at all, the duty cycles are only recorded (no hardware needed)
 static const unsigned long MILLIS_BETWEEN_PWM_UPDATES = 5000; // time between PWM updates in ms
+static const unsigned long MILLIS_BETWEEN_FADE_STEPS = 50; // time between PWM updates in ms while a channel is fading
+static const unsigned long MILLIS_BETWEEN_PWM_CHECKS = 250; // time between two read backs of a channel from the PWM generator in ms
+static const uint8_t POWER_LIMIT_PROPORTIONAL = 0; // Macros either all channels are dimmed by the same factor if the power limit is exceeded
+static const uint8_t POWER_LIMIT_PRIORITY = 1; // or the channels with the lowest priority are dimmed first
+static const uint8_t NUM_OF_PRIORITIES = 4; // number of priority levels of the channels, 0 is the highest priority
+static const uint8_t INTERPOLATION_LINEAR = 0; // Macros either the values between the entries of the schedule are interpolated linear
+static const uint8_t INTERPOLATION_SMOOTHSTEP = 1; // or with a s-curve from entry to entry that is flat at the entries
+static const uint8_t INTERPOLATION_CUBIC = 2; // or with a monotone cubic hermite spline through all entries
+
+// segment of the schedule from one entry to the next one, prepared for the evaluation in fixed point
+struct ScheduleSegment {
+  uint32_t start; // local seconds of the day of the first entry of the segment
+  uint32_t invDuration; // 2^32 / duration of the segment in s
+  int32_t c[4]; // coefficients of the polynomial in the normalized time (0..1) of the segment, Q16 in %
+};
 
 // Class defining the channel objects
 class Channel {
@@ -52,10 +68,25 @@ class Channel {
     
     // values of the (time, value)-tuples stored as percent
     float v[MAX_NUM_OF_ENTRIES];
+
+    // interpolation of the values between the entries
+    uint8_t interpolation;
+
+    // segments of the active schedule computed by "computeSegments"
+    ScheduleSegment segments[MAX_NUM_OF_ENTRIES];
+
+    // number of segments of the active schedule
+    uint8_t numOfSegments;
+
+    // segment of the last call of "getScheduleValue", the search for the next segment starts there
+    uint8_t segment;
     
-    // actual PWM value of the channel in %
+    // actual PWM value of the channel in % according to the mode of the channel
     float value;
 
+    // PWM value in % that is generated after the power limit is applied to "value"
+    float output;
+
     // if true: channel simulates the moonlight and does not get updated according to the schedule
     // if false: channel is not in moonlight mode, so either in automatic or manual mode
     bool moonlight;
@@ -70,6 +101,28 @@ class Channel {
     // powerconsumption of the channel @100% PWM Signal
     float power;
 
+    // if true: channel shows the flashes of the lightnings in the storm effect
+    bool lightning;
+
+    // priority of the channel if the power limit is exceeded in POWER_LIMIT_PRIORITY mode
+    // 0 is the highest priority, channels with a higher number are dimmed first
+    uint8_t priority;
+
+    // power in W that is requested by "value" and already added to the requested power of all channels
+    float requestedPower;
+
+    // number of fade steps left until "value" reaches "fadeTarget", 0 if the channel is not fading
+    uint32_t fadeStepsLeft;
+
+    // change of "value" in % per fade step
+    float fadeStep;
+
+    // value in % at the end of the fade
+    float fadeTarget;
+
+    // if true: the channel is set back to automatic mode at the end of the fade
+    bool fadeToAutomatic;
+
     // constructor
     Channel();
     // destructor
@@ -80,17 +133,40 @@ class Channel {
 
     // prints all information of the channel to the DEBUG_PORT
     void print();
-    // updates the pwm signal according to weather manual is true or false (according to the time schedule)
+    // updates "value" according to weather manual is true or false (according to the time schedule)
+    void updateValue();
+    // updates the pwm signal according to "output"
     void updatePWM();
+    // returns the value in % of the schedule at the local seconds of the day t_
+    float getScheduleValue(uint32_t t_);
+    // sorts the entries and computes the segments of the schedule, must be called if the schedule has changed
+    void prepareSchedule();
+    // computes the segments of the active schedule from "n" sorted entries, the values are scaled by "scale"
+    void computeSegments(const uint32_t *t_, const float *v_, const uint8_t n, const float scale);
+    // starts to fade "value" to "target" within "fadeMillis"
+    void startFade(const float target, const uint32_t fadeMillis, const bool toAutomatic);
+    // stops the fade, "value" keeps its current value
+    void stopFade();
+    // makes "steps" fade steps
+    void updateFade(const uint32_t steps);
     
 };
 
 
 // global variables
 extern uint8_t numOfChannels; // current number of used channels
+extern uint32_t pwmUpdates; // number of PWM updates that were due, without the forced updates
+extern uint32_t pwmMaxLateness; // max time in ms a PWM update was late
+extern uint32_t pwmMissedTicks; // number of PWM updates that were skipped because the main loop was stalled
 extern uint32_t PWMFrequency; // current frequency for generating the PWM signal
 extern Channel channels[MAX_NUM_OF_CHANNELS]; // arrays with all possible channels
 extern uint16_t PWMGenerator; // defines if the PWM signal is generated by the ESP8266 itself or the PCA9685
+extern bool PWMInverted; // if true: the PWM signals are inverted (low while the channel is on)
+extern bool PWMOpenDrain; // if true: the outputs are open drain instead of push pull
+extern float maxPower; // maximal power consumption of all channels together in W, 0 means no limit
+extern uint8_t powerLimitMode; // defines if the channels are dimmed proportionally or by priority if "maxPower" is exceeded
+extern float powerLimitFactor; // ratio of the generated to the requested power, 1 if the power limit is not exceeded
+extern float currentPower; // current power consumption of all channels in W after the power limit is applied
 
 // prints all channels to DEBUG_PORT
 void printAllChannels();
@@ -100,8 +176,24 @@ void configurePWM();
 
 // handle functiom for the PWM generation in main loop
 void handlePWM(const bool force);
+// returns the time in ms until "handlePWM" has to update the PWM again
+uint32_t millisUntilPWMUpdate();
+// reads back one channel from the PWM generator and corrects it, called in the idle time of the main loop
+void checkPWM();
 
 // sets a new PWM frequency
 void setPWMFrequency(const uint32_t f);
 
+// recalculates the requested power of all channels from scratch
+void resetPowerLimit();
+
+// adds the change of the requested power of the channel to the running totals
+void addRequestedPower(Channel &channel);
+
+// limits the "output" of the channels to the "maxPower"
+void applyPowerLimit();
+
+// sets the duty cycle (0..65535) of the PWM signal of channel c
+void writePWM(const uint8_t c, const uint16_t duty);
+
 #endif
@@ -6,17 +6,67 @@ const ID_UPDATE_MANUAL = 2;
 const ID_REQUEST_SCHEDULE_FROM_SERVER = 10;
 const ID_SEND_SCHEDULE_TO_CLIENT = 11;
 const ID_SAVE_SCHEDULE = 12;
+const ID_REQUEST_CURVE_FROM_SERVER = 13;
+const ID_SEND_CURVE_TO_CLIENT = 14;
+const CURVE_HEADER_SIZE = 12; // bytes before the samples in the binary message of the curve
 
 const ID_REQUEST_SETTINGS_FROM_SERVER = 20;
 const ID_SEND_SETTINGS_TO_CLIENT = 21;
 const ID_SAVE_SETTINGS = 22;
 
+const ID_REQUEST_SCENES_FROM_SERVER = 30;
+const ID_SEND_SCENES_TO_CLIENT = 31;
+const ID_SAVE_SCENE = 32;
+const ID_DELETE_SCENE = 33;
+const ID_RECALL_SCENE = 34;
+const ID_RELEASE_SCENE = 35;
+
+const ID_REQUEST_PROFILES_FROM_SERVER = 70;
+const ID_SEND_PROFILES_TO_CLIENT = 71;
+const ID_SAVE_PROFILE = 72;
+const ID_DELETE_PROFILE = 73;
+const ID_SAVE_CALENDAR = 74;
+
+const ID_REQUEST_LOG_FROM_SERVER = 60;
+const ID_SEND_LOG_TO_CLIENT = 61;
+const ID_REQUEST_WATCHDOG_FROM_SERVER = 62;
+const ID_SEND_WATCHDOG_TO_CLIENT = 63;
+
+const ID_BATCH = 40;
+const ID_BATCH_RESULT = 41;
+
+const BATCH_STATUS_OK = 0;
+const BATCH_STATUS_INVALID = 1;
+const BATCH_STATUS_SKIPPED = 2;
+
 const ID_RESTART = 50;
 const ID_FACTORY_SETTINGS = 51;
 
 // PWM Generators
 const PWM_GENERATOR_ESP8266 = 0;
 const PWM_GENERATOR_PCA9685 = 1;
+const PWM_GENERATOR_RECORDING = 2;
+
+// Power limit modes
+const POWER_LIMIT_PROPORTIONAL = 0;
+const POWER_LIMIT_PRIORITY = 1;
+const NUM_OF_PRIORITIES = 4;
+const INTERPOLATION_LINEAR = 0;
+const INTERPOLATION_SMOOTHSTEP = 1;
+const INTERPOLATION_CUBIC = 2;
+const DEFAULT_PROFILE = -1;
+const MAX_NUM_OF_PROFILES = 4;
+const MAX_NUM_OF_DATE_OVERRIDES = 8;
+
+// Effects
+const EFFECT_NONE = 0;
+const EFFECT_CLOUDS = 1;
+const EFFECT_STORM = 2;
+
+// Sync modes
+const SYNC_OFF = 0;
+const SYNC_LEADER = 1;
+const SYNC_FOLLOWER = 2;
 
 // name definitions for the JSON Format
 const CHAR_NUM_OF_CHANNELS = "numOfChannels";
@@ -25,12 +75,70 @@ const CHAR_MAX_NUM_OF_ENTRIES = "maxNumOfEntries";
 
 const CHAR_PWM_FREQUENCY = "PWMFrequency";
 const CHAR_PWM_GENERATOR = "PWMGenerator";
+const CHAR_PWM_INVERTED = "PWMInverted";
+const CHAR_PWM_OPEN_DRAIN = "PWMOpenDrain";
 
 const CHAR_NTP_SERVER = "NTPServer";
 const CHAR_TIMEZONE = "timezone";
 const CHAR_TIME = "time";
 
 const CHAR_CURRENT_POWER = "currentPower";
+const CHAR_MAX_POWER = "maxPower";
+const CHAR_POWER_LIMIT_MODE = "powerLimitMode";
+const CHAR_POWER_LIMIT_FACTOR = "powerLimitFactor";
+
+const CHAR_EFFECT = "effect";
+const CHAR_EFFECT_INTENSITY = "effectIntensity";
+const CHAR_EFFECT_SEED = "effectSeed";
+
+const CHAR_SYNC_MODE = "syncMode";
+const CHAR_SYNC_LOCKED = "syncLocked";
+const CHAR_SYNC_BEACONS = "syncBeacons";
+
+const CHAR_OTA_PASSWORD = "otaPassword";
+const CHAR_OTA_CURRENT_PASSWORD = "otaCurrentPassword";
+const CHAR_OTA_PASSWORD_SET = "otaPasswordSet";
+const CHAR_MQTT_HOST = "mqttHost";
+const CHAR_MQTT_USER = "mqttUser";
+const CHAR_MQTT_PASSWORD = "mqttPassword";
+const CHAR_MQTT_PASSWORD_SET = "mqttPasswordSet";
+const CHAR_MQTT_PORT = "mqttPort";
+const CHAR_MQTT_TOPIC = "mqttTopic";
+const CHAR_MQTT_CONNECTED = "mqttConnected";
+
+const CHAR_PROFILES = "profiles";
+const CHAR_PROFILE = "profile";
+const CHAR_PROFILE_NAME = "name";
+const CHAR_ACTIVE_PROFILE = "activeProfile";
+const CHAR_WEEK_PROFILES = "week";
+const CHAR_DATE_OVERRIDES = "dates";
+const CHAR_DATE = "date";
+const CHAR_TODAY = "today";
+const CHAR_ACCLIMATION_START = "acclimationStart";
+const CHAR_ACCLIMATION_WEEKS = "acclimationWeeks";
+const CHAR_ACCLIMATION_PERCENT = "acclimationPercent";
+const CHAR_ACCLIMATION_FACTOR = "acclimationFactor";
+
+const CHAR_LOG_SEQ = "seq";
+const CHAR_LOG_LINES = "lines";
+const CHAR_LOG_DROPPED = "dropped";
+const CHAR_METRICS_UPTIME = "uptime";
+const CHAR_METRICS_FREE_HEAP = "freeHeap";
+const CHAR_WATCHDOG_RESET_REASON = "resetReason";
+const CHAR_WATCHDOG_RESTARTS = "restarts";
+const CHAR_WATCHDOG_STAGE = "stage";
+const CHAR_WATCHDOG_LAST_COMPLETED = "lastCompleted";
+const CHAR_WATCHDOG_STALLED = "stalled";
+const CHAR_WATCHDOG_MIN_FREE_HEAP = "minFreeHeap";
+const CHAR_WATCHDOG_DURATIONS = "durations";
+const CHAR_WATCHDOG_MAX_DURATIONS = "maxDurations";
+const CHAR_BATCH_OPS = "ops";
+const CHAR_BATCH_RESULTS = "results";
+const CHAR_BATCH_STATUS = "status";
+const CHAR_BATCH_ERROR = "error";
+const CHAR_BATCH_APPLIED = "applied";
+const CHAR_REVISION = "rev";
+const CHAR_UNCHANGED = "unchanged";
 
 const CHAR_CHANNELS = "channels";
 const CHAR_CHANNEL_NAME = "name";
@@ -40,14 +148,38 @@ const CHAR_CHANNEL_MOONLIGHT = "moonlight";
 const CHAR_CHANNEL_MAX_MOONLIGHT_VALUE = "MaxMoonlightValue";
 const CHAR_CHANNEL_PIN = "pin";
 const CHAR_CHANNEL_POWER = "power";
+const CHAR_CHANNEL_PRIORITY = "priority";
+const CHAR_CHANNEL_LIGHTNING = "lightning";
+const CHAR_CHANNEL_INTERPOLATION = "interpolation";
 const CHAR_CHANNEL_VALUE = "value";
+const CHAR_CHANNEL_OUTPUT = "output";
 const CHAR_CHANNEL_TIMES = "times";
 const CHAR_CHANNEL_VALUES = "values";
 
+const CHAR_SCENES = "scenes";
+const CHAR_SCENE = "scene";
+const CHAR_ACTIVE_SCENE = "activeScene";
+const CHAR_SCENE_NAME = "name";
+const CHAR_SCENE_VALUES = "values";
+const CHAR_SCENE_SCHEDULED = "scheduled";
+const CHAR_SCENE_START = "start";
+const CHAR_SCENE_DURATION = "duration";
+const CHAR_SCENE_FADE = "fade";
+
 // global variables
-var websocket = new WebSocket('ws://' + location.hostname + ':81');
+var websocket = new WebSocket('ws://' + location.host + '/ws');
+websocket.binaryType = 'arraybuffer';
 var json; // incoming json from server
+var jsonScenes; // incoming json with the scenes from server
+var jsonProfiles; // incoming json with the profiles from server
+var selectedProfile = DEFAULT_PROFILE; // profile shown in the chart of the schedule page
 var chart; // chart for the schedule page
+var logSeq = 0; // sequence number of the next log record
+var logLines = []; // received log records
+var logTimer; // timer to poll the log while the log page is open
+var watchdogText = ""; // formatted dump of the watchdog, shown above the log
+var cachedData = {}; // last received data of the pages with its revision, by id of the answer
+var curve; // last received curve of the outputs of the current day, see "receiveCurve"
 
 /*
  * Websocket interaction
@@ -63,8 +195,55 @@ websocket.onerror = function (errorEvent) {
 // receiving message
 websocket.onmessage = function (messageEvent) {
   var wsMsg = messageEvent.data;
+  // the only binary message is the curve of the outputs
+  if(wsMsg instanceof ArrayBuffer) {
+    console.log("websocket RECEIVE BINARY MESSAGE: " + wsMsg.byteLength + " bytes");
+    receiveCurve(wsMsg);
+    return;
+  }
   console.log("websocket RECEIVE MESSAGE: " + wsMsg);
-  json = JSON.parse(wsMsg);
+  var msg = JSON.parse(wsMsg);
+  // an "unchanged" curve is drawn from the last received curve
+  if(msg.id == ID_SEND_CURVE_TO_CLIENT) {
+    displayCurve();
+    return;
+  }
+  // the scenes are shown together with the manual page, so they are kept separately
+  if(msg.id == ID_SEND_SCENES_TO_CLIENT) {
+    jsonScenes = msg;
+    displayScenes();
+    return;
+  }
+  // the profiles are shown together with the schedule page, so they are kept separately
+  if(msg.id == ID_SEND_PROFILES_TO_CLIENT) {
+    jsonProfiles = msg;
+    if(selectedProfile >= jsonProfiles[CHAR_PROFILES].length) selectedProfile = DEFAULT_PROFILE;
+    if(json !== undefined && json.id == ID_SEND_SCHEDULE_TO_CLIENT && document.getElementById('chart_container') != null) displaySchedule();
+    return;
+  }
+  // the log is polled, so it must not overwrite the json of the other pages
+  if(msg.id == ID_SEND_LOG_TO_CLIENT) {
+    receiveLog(msg);
+    return;
+  }
+  if(msg.id == ID_SEND_WATCHDOG_TO_CLIENT) {
+    receiveWatchdog(msg);
+    return;
+  }
+  // the result of a batch only reports the status of its commands
+  if(msg.id == ID_BATCH_RESULT) {
+    receiveBatchResult(msg);
+    return;
+  }
+  // an "unchanged" answer only contains the state that changes without a new revision, the rest is taken from the cache
+  if(msg[CHAR_REVISION] !== undefined) {
+    if(msg[CHAR_UNCHANGED] && cachedData[msg.id] !== undefined) {
+      msg = Object.assign(JSON.parse(cachedData[msg.id].data), msg);
+      delete msg[CHAR_UNCHANGED];
+    }
+    else cachedData[msg.id] = {"rev":msg[CHAR_REVISION], "data":wsMsg};
+  }
+  json = msg;
   switch(json.id) {
     case ID_SEND_MANUAL_TO_CLIENT:
       displayManual();
@@ -82,6 +261,26 @@ function sendWebsocketMsg(msg) {
   console.log("websocket SEND MESSAGE: "+msg);
   websocket.send(msg);
 }
+// requests the data of a page with the revision of the cached data, so the device answers "unchanged" if nothing changed
+function requestData(id) {
+  var tmp = {"id":id};
+  var cached = cachedData[id+1]; // the answer has the id of the request + 1
+  if(cached !== undefined) tmp[CHAR_REVISION] = cached.rev;
+  sendWebsocketMsg(JSON.stringify(tmp));
+}
+// sends the commands "ops" as one batch, they are applied all or none and saved once
+function sendBatch(ops) {
+  sendWebsocketMsg(JSON.stringify({"id":ID_BATCH, [CHAR_BATCH_OPS]:ops}));
+}
+// shows the invalid commands of a batch that was not applied
+function receiveBatchResult(msg) {
+  if(msg[CHAR_BATCH_APPLIED]) return;
+  var errors = [];
+  msg[CHAR_BATCH_RESULTS].forEach(function(result, i) {
+    if(result[CHAR_BATCH_STATUS] == BATCH_STATUS_INVALID) errors.push("command "+(i+1)+": "+result[CHAR_BATCH_ERROR]);
+  });
+  alert("Nothing was saved:\n"+errors.join("\n"));
+}
 
 
 /* 
@@ -109,7 +308,96 @@ function displayManual() {
     }
   }
   content  += "</table>";
+  // power limit
+  if(json[CHAR_POWER_LIMIT_FACTOR] < 1) {
+    content += "<br>Power limit reached, the channels get "+Math.round(json[CHAR_POWER_LIMIT_FACTOR]*100)+"% of the requested power";
+  }
+  // scenes are filled in by displayScenes
+  content += "<br><br><div id='scenes_div'></div>";
   document.getElementById('content_div').innerHTML = content;  
+  displayScenes();
+}
+// converts seconds of the day to "hh:mm"
+function secondsToTime(t) {
+  return ("0"+Math.floor(t/3600)).slice(-2)+":"+("0"+Math.floor(t%3600/60)).slice(-2);
+}
+// converts "hh:mm" to seconds of the day
+function timeToSeconds(t) {
+  var hm = t.split(":");
+  return parseInt(hm[0])*3600 + parseInt(hm[1])*60;
+}
+// shows the scenes below the channels of the manual page
+function displayScenes() {
+  var div = document.getElementById('scenes_div');
+  if(div == null || jsonScenes == undefined) return;
+  content = "<table class=\"indexTable\"><tr><th>Scene</th><th>Daily at</th><th>Duration [min]</th><th>Fade [s]</th><th></th><th></th><th></th></tr>";
+  for(s=0; s<jsonScenes[CHAR_SCENES].length; s++) {
+    scene = jsonScenes[CHAR_SCENES][s];
+    content += "<tr><td><input id='scene_name_"+s+"' type='text' value='"+scene[CHAR_SCENE_NAME]+"' maxlength='20' size='16'>";
+      if(s == jsonScenes[CHAR_ACTIVE_SCENE]) content += " (active)";
+      content += "</td>";
+    // scheduled
+    content += "<td><input id='scene_scheduled_"+s+"' type='checkbox'";
+      if(scene[CHAR_SCENE_SCHEDULED]) content += " checked";
+      content += "> <input id='scene_start_"+s+"' type='time' value='"+secondsToTime(scene[CHAR_SCENE_START])+"'></td>";
+    // duration
+    content += "<td><input id='scene_duration_"+s+"' type='number' min='0' value='"+scene[CHAR_SCENE_DURATION]/60+"'></td>";
+    // fade
+    content += "<td><input id='scene_fade_"+s+"' type='number' min='0' value='"+scene[CHAR_SCENE_FADE]+"'></td>";
+    // buttons
+    content += "<td><button onclick='recallScene("+s+");'>Recall</button></td>";
+    content += "<td><button onclick='saveScene("+s+", false);'>Save</button></td>";
+    content += "<td><button onclick='deleteScene("+s+");'>Delete</button></td></tr>";
+  }
+  content += "</table>";
+  content += "<button onclick='saveScene("+jsonScenes[CHAR_SCENES].length+", true);'>Save Current Values as new Scene</button>";
+  content += "<button onclick='releaseScene();'>Back to Schedule</button>";
+  div.innerHTML = content;
+}
+// saves scene s, the current values of the channels are stored if "snapshot" is true
+function saveScene(s, snapshot) {
+  var tmp = {"id":ID_SAVE_SCENE};
+  tmp[CHAR_SCENE] = s;
+  if(snapshot) {
+    tmp[CHAR_SCENE_NAME] = "scene "+(s+1);
+    tmp[CHAR_SCENE_SCHEDULED] = false;
+    tmp[CHAR_SCENE_START] = 0;
+    tmp[CHAR_SCENE_DURATION] = 0;
+    tmp[CHAR_SCENE_FADE] = 10;
+  }
+  else {
+    tmp[CHAR_SCENE_NAME] = document.getElementById('scene_name_'+s).value;
+    tmp[CHAR_SCENE_SCHEDULED] = document.getElementById('scene_scheduled_'+s).checked;
+    tmp[CHAR_SCENE_START] = timeToSeconds(document.getElementById('scene_start_'+s).value);
+    tmp[CHAR_SCENE_DURATION] = Math.round(document.getElementById('scene_duration_'+s).value*60);
+    tmp[CHAR_SCENE_FADE] = parseInt(document.getElementById('scene_fade_'+s).value);
+    tmp[CHAR_SCENE_VALUES] = jsonScenes[CHAR_SCENES][s][CHAR_SCENE_VALUES];
+  }
+  sendWebsocketMsg(JSON.stringify(tmp));
+  sendWebsocketMsg(JSON.stringify({"id":ID_REQUEST_SCENES_FROM_SERVER}));
+}
+// deletes scene s
+function deleteScene(s) {
+  var tmp = {"id":ID_DELETE_SCENE};
+  tmp[CHAR_SCENE] = s;
+  sendWebsocketMsg(JSON.stringify(tmp));
+  sendWebsocketMsg(JSON.stringify({"id":ID_REQUEST_SCENES_FROM_SERVER}));
+}
+// fades the channels to scene s
+function recallScene(s) {
+  var tmp = {"id":ID_RECALL_SCENE};
+  tmp[CHAR_SCENE] = s;
+  tmp[CHAR_SCENE_FADE] = parseInt(document.getElementById('scene_fade_'+s).value);
+  tmp[CHAR_SCENE_DURATION] = 0;
+  sendWebsocketMsg(JSON.stringify(tmp));
+  openContent("manual");
+}
+// fades the channels back to the schedule
+function releaseScene() {
+  var tmp = {"id":ID_RELEASE_SCENE};
+  tmp[CHAR_SCENE_FADE] = 10;
+  sendWebsocketMsg(JSON.stringify(tmp));
+  openContent("manual");
 }
 // updates the changed values from the manual page to the server
 function updateManual(type, c) {
@@ -127,22 +415,51 @@ function updateManual(type, c) {
   json.id = ID_UPDATE_MANUAL;
   sendWebsocketMsg(JSON.stringify(json));
   if(type=='checkbox') {
-    var tmp = {"id":ID_REQUEST_MANUAL_FROM_SERVER};
-    sendWebsocketMsg(JSON.stringify(tmp));  
+    requestData(ID_REQUEST_MANUAL_FROM_SERVER);
   }
 }
 
 /*
  * functions for the schedule page
  */
+// uploads a schedule file in csv or json and reloads the schedule page
+// channels with more points than the device can store are reduced to fit, with the max error if one is set to all channels
+function importSchedule() {
+  var file = document.getElementById('import_file').files[0];
+  if(file === undefined) return;
+  var tolerance = document.getElementById('import_tolerance').value;
+  var data = new FormData();
+  data.append("schedule", file);
+  fetch("/schedule" + (tolerance !== "" ? "?tolerance="+tolerance : ""), {method: "POST", body: data}).then(function(response) {
+    return response.text().then(function(text) {
+      alert(response.ok ? text : "Import failed, "+text);
+      openContent("schedule");
+    });
+  });
+}
 // loads the schedule page
 const heightChart = "500";
 function displaySchedule() {
-  content = "<div id='chart_container' style='height: "+heightChart+"px;'></div>";
+  content = "Profile: <select id='selected_profile' onchange='selectProfile(this.value);'>";
+  content += "<option value='"+DEFAULT_PROFILE+"'>Schedule</option>";
+  if(jsonProfiles !== undefined) {
+    for(p=0; p<jsonProfiles[CHAR_PROFILES].length; p++) {
+      content += "<option value='"+p+"' ";
+      if(p == selectedProfile) content += "selected";
+      content += ">"+jsonProfiles[CHAR_PROFILES][p][CHAR_PROFILE_NAME]+"</option>";
+    }
+  }
+  content += "</select>";
+  content += "<div id='chart_container' style='height: "+heightChart+"px;'></div>";
   content += "<button class='scheduleButton' onclick='deleteEntry();'>Delete Point</button>";
   content += "<button class='scheduleButton' onclick='addEntry();'>Add Point</button>";
   content += "<button class='scheduleButton' onclick='openContent(\"schedule\");'>Reload</button>";
   content += "<button class='scheduleButton' onclick='saveSchedule();'>Save</button>";
+  content += "<div>Export: <a href='/schedule.csv' download>CSV</a> <a href='/schedule.json' download>JSON</a>";
+  content += " | Import: <input type='file' id='import_file' accept='.csv,.json'>";
+  content += " max error [%]: <input type='number' id='import_tolerance' min='0' max='100' step='0.1' placeholder='0.5'>";
+  content += "<button onclick='importSchedule();'>Import</button></div>";
+  content += "<div id='profiles_div'></div>";
   document.getElementById('content_div').innerHTML = content;
   // creates the chart
   chart = new Highcharts.Chart({
@@ -165,6 +482,9 @@ function displaySchedule() {
       series: {
         point: {
           events: {
+            drop: function(e) {
+              updateCurve(this.series);
+            },
             drag: function(e) {
               if (e.y > 100) {
                   this.y = 100;
@@ -213,19 +533,23 @@ function displaySchedule() {
     channel = json[CHAR_CHANNELS][c];
     if(!channel[CHAR_CHANNEL_MOONLIGHT]) {
       // prepare data constisting of entries (time-value pair)
+      // the entries of the selected profile are shown instead of the schedule
+      var entries = channel;
+      if(selectedProfile != DEFAULT_PROFILE) entries = jsonProfiles[CHAR_PROFILES][selectedProfile][CHAR_CHANNELS][c];
       data = new Array();
-      for(i=0;i<channel[CHAR_CHANNEL_TIMES].length;i++) {
+      for(i=0;i<entries[CHAR_CHANNEL_TIMES].length;i++) {
         entry = new Array();
-        entry.push(Date.UTC(2000,0,0,0,0,channel[CHAR_CHANNEL_TIMES][i]));
-        entry.push(channel[CHAR_CHANNEL_VALUES][i]);
+        entry.push(Date.UTC(2000,0,0,0,0,entries[CHAR_CHANNEL_TIMES][i]));
+        entry.push(entries[CHAR_CHANNEL_VALUES][i]);
         data.push(entry);
       }
-      // add series
-      chart.addSeries({
+      // add series with the entries, the line between them is drawn by the curve
+      var series = chart.addSeries({
           allowPointSelect: true,
           type: 'line',
           name: channel[CHAR_CHANNEL_NAME],
           color: channel[CHAR_CHANNEL_COLOR],
+          lineWidth: 0,
           cursor: 'move',
           marker: {
             enabled: true
@@ -233,9 +557,130 @@ function displaySchedule() {
           draggableX: true,
           draggableY: true,
           data: data,
+          channel: c,
       });
+      // add series with the interpolated curve
+      series.curve = chart.addSeries({
+          type: 'line',
+          name: channel[CHAR_CHANNEL_NAME],
+          color: channel[CHAR_CHANNEL_COLOR],
+          marker: {
+            enabled: false
+          },
+          enableMouseTracking: false,
+          showInLegend: false,
+          data: [],
+      });
+      updateCurve(series);
     }
   }
+  displayProfiles();
+  displayCurve();
+  requestCurve();
+}
+// requests the curve of the outputs of the current day, the device answers "unchanged" if the cached curve is current
+function requestCurve() {
+  var tmp = {"id":ID_REQUEST_CURVE_FROM_SERVER};
+  if(curve !== undefined) tmp[CHAR_REVISION] = curve.rev;
+  sendWebsocketMsg(JSON.stringify(tmp));
+}
+// stores the binary message of the curve, a header followed by the duty cycles (0..65535) of each channel, little endian
+function receiveCurve(buffer) {
+  var view = new DataView(buffer);
+  var numOfChannels = view.getUint8(1);
+  var samples = view.getUint16(2, true);
+  curve = {"rev":view.getUint32(8, true), "step":view.getUint16(4, true), "channels":[]};
+  for(var c=0; c<numOfChannels; c++) {
+    curve.channels.push(new Uint16Array(buffer.slice(CURVE_HEADER_SIZE + c*samples*2, CURVE_HEADER_SIZE + (c+1)*samples*2)));
+  }
+  displayCurve();
+}
+// draws the outputs of the device as dashed lines, with the power limit and the profile and acclimation of the current day
+function displayCurve() {
+  if(curve === undefined || chart === undefined || document.getElementById('chart_container') == null) return;
+  for(var s=chart.series.length-1; s>=0; s--) {
+    if(chart.series[s].options.output) chart.series[s].remove(false);
+  }
+  for(var c=0; c<curve.channels.length && c<json[CHAR_CHANNELS].length; c++) {
+    var data = [];
+    for(var i=0; i<curve.channels[c].length; i++) data.push([Date.UTC(2000,0,0,0,0,i*curve.step), curve.channels[c][i] / 655.35]);
+    chart.addSeries({
+        type: 'line',
+        name: json[CHAR_CHANNELS][c][CHAR_CHANNEL_NAME] + " (output today)",
+        color: json[CHAR_CHANNELS][c][CHAR_CHANNEL_COLOR],
+        dashStyle: 'ShortDash',
+        lineWidth: 1,
+        marker: {
+          enabled: false
+        },
+        enableMouseTracking: false,
+        data: data,
+        output: true,
+    }, false);
+  }
+  chart.redraw();
+}
+// returns the segments of the schedule the same way as Channel::prepareSchedule on the device
+// each segment is [start, duration, c0, c1, c2, c3] with the polynomial c0 + c1*u + c2*u^2 + c3*u^3 in the normalized time u
+function scheduleSegments(times, values, interpolation) {
+  var i;
+  var n = times.length;
+  var order = times.map(function(t, i) { return i; }).sort(function(a, b) { return times[a] - times[b]; });
+  var t = order.map(function(i) { return times[i]; });
+  var v = order.map(function(i) { return values[i]; });
+  var h = [], d = [], m = [], segments = [];
+  for(i=0;i<n;i++) {
+    var next = (i+1)%n;
+    h[i] = t[next] - t[i] + (i+1 == n ? 24*60*60 : 0);
+    d[i] = h[i] > 0 ? (v[next] - v[i]) / h[i] : 0;
+  }
+  for(i=0;i<n;i++) {
+    var prev = (i+n-1)%n;
+    m[i] = 0;
+    if(d[prev] * d[i] > 0) {
+      var w1 = 2*h[i] + h[prev];
+      var w2 = h[i] + 2*h[prev];
+      m[i] = (w1 + w2) / (w1 / d[prev] + w2 / d[i]);
+    }
+  }
+  for(i=0;i<n;i++) {
+    var next = (i+1)%n;
+    var dv = v[next] - v[i];
+    var coeff = [v[i], dv, 0, 0];
+    if(interpolation == INTERPOLATION_SMOOTHSTEP) coeff = [v[i], 0, 3*dv, -2*dv];
+    if(interpolation == INTERPOLATION_CUBIC) {
+      var m1 = m[i] * h[i];
+      var m2 = m[next] * h[i];
+      coeff = [v[i], m1, 3*dv - 2*m1 - m2, m1 + m2 - 2*dv];
+    }
+    segments.push([t[i], h[i]].concat(coeff));
+  }
+  return segments;
+}
+// returns the value of the schedule at the local seconds of the day t
+function scheduleValue(segments, t) {
+  var i;
+  if(t < segments[0][0]) t += 24*60*60;
+  var s = segments[0];
+  for(i=0;i<segments.length;i++) if(t >= segments[i][0]) s = segments[i];
+  var u = s[1] > 0 ? (t - s[0]) / s[1] : 0;
+  return s[2] + u*(s[3] + u*(s[4] + u*s[5]));
+}
+// draws the interpolated curve of a series with the entries every 5 minutes
+function updateCurve(series) {
+  var i;
+  var times = [], values = [];
+  for(i=0;i<series.data.length;i++) {
+    var t = new Date(series.data[i].x);
+    times.push(t.getUTCHours()*60*60 + t.getUTCMinutes()*60 + t.getUTCSeconds());
+    values.push(series.data[i].y);
+  }
+  var data = [];
+  if(times.length > 0) {
+    var segments = scheduleSegments(times, values, json[CHAR_CHANNELS][series.options.channel][CHAR_CHANNEL_INTERPOLATION]);
+    for(var t=0; t<24*60*60; t+=5*60) data.push([Date.UTC(2000,0,0,0,0,t), scheduleValue(segments, t)]);
+  }
+  series.curve.setData(data);
 }
 // removes the selected entry
 function deleteEntry() {
@@ -244,9 +689,9 @@ function deleteEntry() {
     window.alert("Select the point first you want to delete");
     return;
   }
-  series_ = p[0].series._i;
-  number_ = p[0].index;
-  chart.series[series_].removePoint(number_)
+  series_ = p[0].series;
+  series_.removePoint(p[0].index);
+  updateCurve(series_);
 }
 // adds an entry to the selected series
 function addEntry() {
@@ -259,30 +704,158 @@ function addEntry() {
     window.alert("Maximal number of points for the channel reached");
     return;    
   }
-  series_ = p[0].series._i; 
-  chart.series[series_].addPoint([Date.UTC(2000, 0, 0, 23, 0,0), 10]);
+  series_ = p[0].series;
+  series_.addPoint([Date.UTC(2000, 0, 0, 23, 0,0), 10]);
+  updateCurve(series_);
 }
 // sends the schedule to the server to save it
 function saveSchedule() {
   json_ = new Object();
   json_.id = ID_SAVE_SCHEDULE;
   json_[CHAR_CHANNELS] = new Array();
-    for(c=0;c<chart.series.length;c++) {
-    json_[CHAR_CHANNELS][c] = new Object();
+  for(c=0;c<json[CHAR_CHANNELS].length;c++) json_[CHAR_CHANNELS][c] = new Object();
+  for(s=0;s<chart.series.length;s++) {
+    // the series of the curves and the moonlight channels are not stored
+    if(chart.series[s].options.channel === undefined) continue;
+    c = chart.series[s].options.channel;
     json_[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES] = new Array();
     json_[CHAR_CHANNELS][c][CHAR_CHANNEL_VALUES] = new Array();
-    for(i=0;i<chart.series[c].data.length;i++) {
-      v = chart.series[c].data[i].y;
-      t_ = chart.series[c].data[i].x;
+    for(i=0;i<chart.series[s].data.length;i++) {
+      v = chart.series[s].data[i].y;
+      t_ = chart.series[s].data[i].x;
       t = new Date(t_);
       json_[CHAR_CHANNELS][c][CHAR_CHANNEL_VALUES].push(v);
       json_[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES].push( t.getUTCHours()*60*60 + t.getUTCMinutes()*60 + t.getUTCSeconds() );
     }
   }
+  // the entries are saved to the selected profile
+  if(selectedProfile != DEFAULT_PROFILE) {
+    json_.id = ID_SAVE_PROFILE;
+    json_[CHAR_PROFILE] = selectedProfile;
+    json_[CHAR_PROFILE_NAME] = jsonProfiles[CHAR_PROFILES][selectedProfile][CHAR_PROFILE_NAME];
+  }
   // send json
   sendWebsocketMsg(JSON.stringify(json_));
   openContent("schedule");
 }
+// shows the entries of profile p in the chart
+function selectProfile(p) {
+  selectedProfile = parseInt(p);
+  displaySchedule();
+}
+// converts the local days since 1.1.1970 to a date string for the date inputs
+function dayToDate(day) {
+  return new Date(day*24*60*60*1000).toISOString().slice(0,10);
+}
+// converts a date string of the date inputs to the local days since 1.1.1970
+function dateToDay(date) {
+  return Math.round(Date.parse(date) / (24*60*60*1000));
+}
+// returns a select with all profiles and the schedule
+function profileSelect(id, profile) {
+  var content = "<select id='"+id+"'>";
+  content += "<option value='"+DEFAULT_PROFILE+"'>Schedule</option>";
+  for(var p=0; p<jsonProfiles[CHAR_PROFILES].length; p++) {
+    content += "<option value='"+p+"' ";
+    if(p == profile) content += "selected";
+    content += ">"+jsonProfiles[CHAR_PROFILES][p][CHAR_PROFILE_NAME]+"</option>";
+  }
+  content += "</select>";
+  return content;
+}
+// shows the profiles, the profile of each weekday, the dates with their own profile and the acclimation
+const WEEKDAYS = ["Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"];
+function displayProfiles() {
+  var div = document.getElementById('profiles_div');
+  if(div == null || jsonProfiles === undefined) return;
+  var p, d, i;
+  content = "<br><br>Profiles replace the schedule on certain weekdays or dates. ";
+  content += "Today: ";
+  if(jsonProfiles[CHAR_ACTIVE_PROFILE] == DEFAULT_PROFILE) content += "Schedule";
+  else content += jsonProfiles[CHAR_PROFILES][jsonProfiles[CHAR_ACTIVE_PROFILE]][CHAR_PROFILE_NAME];
+  if(jsonProfiles[CHAR_ACCLIMATION_FACTOR] < 1) content += " at "+(jsonProfiles[CHAR_ACCLIMATION_FACTOR]*100).toFixed(0)+"% (acclimation)";
+  // profiles
+  content += "<table class=\"indexTable\"><tr><th>Profile</th><th></th><th></th></tr>";
+  for(p=0; p<jsonProfiles[CHAR_PROFILES].length; p++) {
+    content += "<tr><td><input id='profile_name_"+p+"' type='text' maxlength='20' size='16' value='"+jsonProfiles[CHAR_PROFILES][p][CHAR_PROFILE_NAME]+"'></td>";
+    content += "<td><button onclick='renameProfile("+p+");'>Rename</button></td>";
+    content += "<td><button onclick='deleteProfile("+p+");'>Delete</button></td></tr>";
+  }
+  content += "</table>";
+  if(jsonProfiles[CHAR_PROFILES].length < MAX_NUM_OF_PROFILES) {
+    content += "<input id='profile_name_new' type='text' maxlength='20' size='16' placeholder='name'>";
+    content += "<button onclick='newProfile();'>Copy Schedule to new Profile</button>";
+  }
+  // weekdays
+  content += "<table class=\"indexTable\"><tr>";
+  for(d=0; d<7; d++) content += "<th>"+WEEKDAYS[d]+"</th>";
+  content += "</tr><tr>";
+  for(d=0; d<7; d++) content += "<td>"+profileSelect("week_profile_"+d, jsonProfiles[CHAR_WEEK_PROFILES][d])+"</td>";
+  content += "</tr></table>";
+  // dates
+  content += "<table class=\"indexTable\"><tr><th>Date</th><th>Profile</th></tr>";
+  for(i=0; i<jsonProfiles[CHAR_DATE_OVERRIDES].length; i++) {
+    content += "<tr><td><input id='date_"+i+"' type='date' value='"+dayToDate(jsonProfiles[CHAR_DATE_OVERRIDES][i][CHAR_DATE])+"'></td>";
+    content += "<td>"+profileSelect("date_profile_"+i, jsonProfiles[CHAR_DATE_OVERRIDES][i][CHAR_PROFILE])+"</td></tr>";
+  }
+  if(jsonProfiles[CHAR_DATE_OVERRIDES].length < MAX_NUM_OF_DATE_OVERRIDES) {
+    content += "<tr><td><input id='date_"+i+"' type='date'></td><td>"+profileSelect("date_profile_"+i, DEFAULT_PROFILE)+"</td></tr>";
+  }
+  content += "</table>";
+  // acclimation
+  content += "Acclimation from <input id='"+CHAR_ACCLIMATION_START+"' type='date' value='";
+  if(jsonProfiles[CHAR_ACCLIMATION_START] > 0) content += dayToDate(jsonProfiles[CHAR_ACCLIMATION_START]);
+  content += "'> at <input id='"+CHAR_ACCLIMATION_PERCENT+"' type='number' min='0' max='100' value='"+jsonProfiles[CHAR_ACCLIMATION_PERCENT]+"'>% ";
+  content += "to 100% within <input id='"+CHAR_ACCLIMATION_WEEKS+"' type='number' min='0' max='255' value='"+jsonProfiles[CHAR_ACCLIMATION_WEEKS]+"'> weeks<br>";
+  content += "<button onclick='saveCalendar();'>Save Weekdays, Dates and Acclimation</button>";
+  div.innerHTML = content;
+}
+// adds a new profile with the entries of the schedule
+function newProfile() {
+  var tmp = {"id":ID_SAVE_PROFILE};
+  tmp[CHAR_PROFILE] = jsonProfiles[CHAR_PROFILES].length;
+  tmp[CHAR_PROFILE_NAME] = document.getElementById('profile_name_new').value;
+  sendWebsocketMsg(JSON.stringify(tmp));
+  sendWebsocketMsg(JSON.stringify({"id":ID_REQUEST_PROFILES_FROM_SERVER}));
+}
+// renames profile p, the entries are kept
+function renameProfile(p) {
+  var tmp = {"id":ID_SAVE_PROFILE};
+  tmp[CHAR_PROFILE] = p;
+  tmp[CHAR_PROFILE_NAME] = document.getElementById('profile_name_'+p).value;
+  tmp[CHAR_CHANNELS] = jsonProfiles[CHAR_PROFILES][p][CHAR_CHANNELS];
+  sendWebsocketMsg(JSON.stringify(tmp));
+  sendWebsocketMsg(JSON.stringify({"id":ID_REQUEST_PROFILES_FROM_SERVER}));
+}
+// deletes profile p
+function deleteProfile(p) {
+  var tmp = {"id":ID_DELETE_PROFILE};
+  tmp[CHAR_PROFILE] = p;
+  sendWebsocketMsg(JSON.stringify(tmp));
+  sendWebsocketMsg(JSON.stringify({"id":ID_REQUEST_PROFILES_FROM_SERVER}));
+}
+// saves the profile of each weekday, the dates with their own profile and the acclimation
+function saveCalendar() {
+  var tmp = {"id":ID_SAVE_CALENDAR};
+  var d, i;
+  tmp[CHAR_WEEK_PROFILES] = new Array();
+  for(d=0; d<7; d++) tmp[CHAR_WEEK_PROFILES].push(parseInt(document.getElementById("week_profile_"+d).value));
+  tmp[CHAR_DATE_OVERRIDES] = new Array();
+  for(i=0; document.getElementById("date_"+i) != null; i++) {
+    var date = document.getElementById("date_"+i).value;
+    if(date == "") continue;
+    var override = {};
+    override[CHAR_DATE] = dateToDay(date);
+    override[CHAR_PROFILE] = parseInt(document.getElementById("date_profile_"+i).value);
+    tmp[CHAR_DATE_OVERRIDES].push(override);
+  }
+  var start = document.getElementById(CHAR_ACCLIMATION_START).value;
+  tmp[CHAR_ACCLIMATION_START] = start == "" ? 0 : dateToDay(start);
+  tmp[CHAR_ACCLIMATION_WEEKS] = parseInt(document.getElementById(CHAR_ACCLIMATION_WEEKS).value);
+  tmp[CHAR_ACCLIMATION_PERCENT] = parseInt(document.getElementById(CHAR_ACCLIMATION_PERCENT).value);
+  sendWebsocketMsg(JSON.stringify(tmp));
+  sendWebsocketMsg(JSON.stringify({"id":ID_REQUEST_PROFILES_FROM_SERVER}));
+}
 
 
 /*
@@ -316,10 +889,80 @@ function displaySettings() {
     content += ">PCA9685</option>";
     content += "</select>";
     content += "</td></tr>";
+  // PWM output
+  content += "<tr><th>PWM Output</th><td>";
+    content += "<input type='checkbox' id='"+CHAR_PWM_INVERTED+"' ";
+    if(json[CHAR_PWM_INVERTED]) content += "checked";
+    content += "> inverted ";
+    content += "<input type='checkbox' id='"+CHAR_PWM_OPEN_DRAIN+"' ";
+    if(json[CHAR_PWM_OPEN_DRAIN]) content += "checked";
+    content += "> open drain";
+    content += "</td></tr>";
   // PWM frequency
   content += "<tr><th>PWM Frequency [Hz]</th><td><input type='number' id='"+CHAR_PWM_FREQUENCY+"' value='"+json[CHAR_PWM_FREQUENCY]+"'</td></tr>";
   // current power
   content += "<tr><th>Current Power Consumption[W]</th><td>"+json[CHAR_CURRENT_POWER].toFixed(2)+"</td></tr>";
+  // max power
+  content += "<tr><th>Max Power Consumption [W] (0 = no limit)</th><td><input type='number' id='"+CHAR_MAX_POWER+"' value='"+json[CHAR_MAX_POWER]+"' min='0'></td></tr>";
+  // power limit mode
+  content += "<tr><th>Power Limit</th><td>";
+    content += "<select id='"+CHAR_POWER_LIMIT_MODE+"'>";
+    content += "<option value='"+POWER_LIMIT_PROPORTIONAL+"' ";
+    if(json[CHAR_POWER_LIMIT_MODE] == POWER_LIMIT_PROPORTIONAL) content += "selected";
+    content += ">Proportional</option>";
+    content += "<option value='"+POWER_LIMIT_PRIORITY+"' ";
+    if(json[CHAR_POWER_LIMIT_MODE] == POWER_LIMIT_PRIORITY) content += "selected";
+    content += ">Priority</option>";
+    content += "</select>";
+    content += " "+Math.round(json[CHAR_POWER_LIMIT_FACTOR]*100)+"% of the requested power";
+    content += "</td></tr>";
+  // effect
+  content += "<tr><th>Effect</th><td>";
+    content += "<select id='"+CHAR_EFFECT+"'>";
+    content += "<option value='"+EFFECT_NONE+"' ";
+    if(json[CHAR_EFFECT] == EFFECT_NONE) content += "selected";
+    content += ">None</option>";
+    content += "<option value='"+EFFECT_CLOUDS+"' ";
+    if(json[CHAR_EFFECT] == EFFECT_CLOUDS) content += "selected";
+    content += ">Clouds</option>";
+    content += "<option value='"+EFFECT_STORM+"' ";
+    if(json[CHAR_EFFECT] == EFFECT_STORM) content += "selected";
+    content += ">Storm</option>";
+    content += "</select>";
+    content += "</td></tr>";
+  // effect intensity
+  content += "<tr><th>Effect Intensity [%]</th><td><input type='number' id='"+CHAR_EFFECT_INTENSITY+"' value='"+json[CHAR_EFFECT_INTENSITY]+"' min='0' max='100'></td></tr>";
+  // effect seed
+  content += "<tr><th>Effect Seed</th><td><input type='number' id='"+CHAR_EFFECT_SEED+"' value='"+json[CHAR_EFFECT_SEED]+"' min='1'></td></tr>";
+  // sync mode
+  content += "<tr><th>Sync</th><td>";
+    content += "<select id='"+CHAR_SYNC_MODE+"'>";
+    content += "<option value='"+SYNC_OFF+"' ";
+    if(json[CHAR_SYNC_MODE] == SYNC_OFF) content += "selected";
+    content += ">Off</option>";
+    content += "<option value='"+SYNC_LEADER+"' ";
+    if(json[CHAR_SYNC_MODE] == SYNC_LEADER) content += "selected";
+    content += ">Leader</option>";
+    content += "<option value='"+SYNC_FOLLOWER+"' ";
+    if(json[CHAR_SYNC_MODE] == SYNC_FOLLOWER) content += "selected";
+    content += ">Follower</option>";
+    content += "</select>";
+    if(json[CHAR_SYNC_MODE] == SYNC_LEADER) content += " "+json[CHAR_SYNC_BEACONS]+" beacons sent";
+    if(json[CHAR_SYNC_MODE] == SYNC_FOLLOWER) content += json[CHAR_SYNC_LOCKED] ? " locked to the leader" : " no leader found";
+    content += "</td></tr>";
+  // mqtt broker, port and topic prefix
+  content += "<tr><th>MQTT Broker</th><td><input type='text' id='"+CHAR_MQTT_HOST+"' value='"+json[CHAR_MQTT_HOST]+"' maxlength='40' placeholder='off'>";
+    content += " <input type='number' id='"+CHAR_MQTT_PORT+"' value='"+json[CHAR_MQTT_PORT]+"' min='1' max='65535'>";
+    if(json[CHAR_MQTT_HOST] != "") content += json[CHAR_MQTT_CONNECTED] ? " connected" : " not connected";
+    content += "</td></tr>";
+  content += "<tr><th>MQTT Topic</th><td><input type='text' id='"+CHAR_MQTT_TOPIC+"' value='"+json[CHAR_MQTT_TOPIC]+"' maxlength='32'></td></tr>";
+  // mqtt login, an empty password keeps the current one
+  content += "<tr><th>MQTT Login</th><td><input type='text' id='"+CHAR_MQTT_USER+"' value='"+json[CHAR_MQTT_USER]+"' maxlength='32' placeholder='no login'>";
+    content += " <input type='password' id='"+CHAR_MQTT_PASSWORD+"' maxlength='32' placeholder='"+(json[CHAR_MQTT_PASSWORD_SET] ? "unchanged" : "password")+"'></td></tr>";
+  // password of the updates, a set password is only changed with the current one
+  content += "<tr><th>Update Password</th><td><input type='password' id='"+CHAR_OTA_PASSWORD+"' maxlength='32' placeholder='"+(json[CHAR_OTA_PASSWORD_SET] ? "unchanged" : "updates off")+"'>";
+    if(json[CHAR_OTA_PASSWORD_SET]) content += " current: <input type='password' id='"+CHAR_OTA_CURRENT_PASSWORD+"' maxlength='32'>";
+    content += "</td></tr>";
   // time
   tmp = new Date((json[CHAR_TIME]+60*60*json[CHAR_TIMEZONE])*1000);
   content += "<tr><th>Time</th><td>"+("0"+tmp.getUTCHours()).slice(-2)+":"+("0"+tmp.getUTCMinutes()).slice(-2)+":"+("0"+tmp.getUTCSeconds()).slice(-2)+"</td></tr>";  
@@ -342,6 +985,12 @@ function displaySettings() {
   content += "<th>Max Moonlight [%]</th>";
   // Channel power
   content += "<th>Power [Watts]</th>";
+  // Channel priority
+  content += "<th>Priority</th>";
+  // Channel lightning
+  content += "<th>Lightning</th>";
+  // Channel interpolation
+  content += "<th>Interpolation</th>";
   // Channel pin (only showed if PWM Signal is generated by the ESP8266 itself
   if(json[CHAR_PWM_GENERATOR] == PWM_GENERATOR_ESP8266) {
     content += "<th>PWM Pin on ESP8266</th>";
@@ -368,6 +1017,24 @@ function displaySettings() {
     content += "</td>";
     // channel power
     content += "<td><input id='"+CHAR_CHANNEL_POWER+"_"+c+"' type='number' value='"+channel[CHAR_CHANNEL_POWER]+"' min='0'></td>";
+    // channel priority
+    content += "<td><input id='"+CHAR_CHANNEL_PRIORITY+"_"+c+"' type='number' value='"+channel[CHAR_CHANNEL_PRIORITY]+"' min='0' max='"+(NUM_OF_PRIORITIES-1)+"'></td>";
+    // channel lightning
+    content += "<td><input id='"+CHAR_CHANNEL_LIGHTNING+"_"+c+"' type='checkbox'";
+      if(channel[CHAR_CHANNEL_LIGHTNING]) content += " checked ";
+      content += "></td>";
+    // channel interpolation
+    content += "<td><select id='"+CHAR_CHANNEL_INTERPOLATION+"_"+c+"'>";
+    content += "<option value='"+INTERPOLATION_LINEAR+"' ";
+    if(channel[CHAR_CHANNEL_INTERPOLATION] == INTERPOLATION_LINEAR) content += "selected";
+    content += ">linear</option>";
+    content += "<option value='"+INTERPOLATION_SMOOTHSTEP+"' ";
+    if(channel[CHAR_CHANNEL_INTERPOLATION] == INTERPOLATION_SMOOTHSTEP) content += "selected";
+    content += ">smoothstep</option>";
+    content += "<option value='"+INTERPOLATION_CUBIC+"' ";
+    if(channel[CHAR_CHANNEL_INTERPOLATION] == INTERPOLATION_CUBIC) content += "selected";
+    content += ">cubic</option>";
+    content += "</select></td>";
     // Channel pin
     if(json[CHAR_PWM_GENERATOR] == PWM_GENERATOR_ESP8266) {
       content += "<td><input id='"+CHAR_CHANNEL_PIN+"_"+c+"' type='number' value='"+channel[CHAR_CHANNEL_PIN]+"'></td>";
@@ -400,6 +1067,12 @@ function updateSettings() {
     json[CHAR_CHANNELS][c][CHAR_CHANNEL_COLOR] = document.getElementById(CHAR_CHANNEL_COLOR+"_"+c).value;
     // power
     json[CHAR_CHANNELS][c][CHAR_CHANNEL_POWER] = document.getElementById(CHAR_CHANNEL_POWER+"_"+c).value;
+    // priority
+    json[CHAR_CHANNELS][c][CHAR_CHANNEL_PRIORITY] = document.getElementById(CHAR_CHANNEL_PRIORITY+"_"+c).value;
+    // lightning
+    json[CHAR_CHANNELS][c][CHAR_CHANNEL_LIGHTNING] = document.getElementById(CHAR_CHANNEL_LIGHTNING+"_"+c).checked;
+    // interpolation
+    json[CHAR_CHANNELS][c][CHAR_CHANNEL_INTERPOLATION] = document.getElementById(CHAR_CHANNEL_INTERPOLATION+"_"+c).value;
     // pin
     if(json[CHAR_PWM_GENERATOR] == PWM_GENERATOR_ESP8266) {
       json[CHAR_CHANNELS][c][CHAR_CHANNEL_PIN] = document.getElementById(CHAR_CHANNEL_PIN+"_"+c).value;
@@ -417,8 +1090,32 @@ function updateSettings() {
   json[CHAR_TIMEZONE] = document.getElementById(CHAR_TIMEZONE).value;
   // pwm generator
   json[CHAR_PWM_GENERATOR] = document.getElementById(CHAR_PWM_GENERATOR).value;
+  json[CHAR_PWM_INVERTED] = document.getElementById(CHAR_PWM_INVERTED).checked;
+  json[CHAR_PWM_OPEN_DRAIN] = document.getElementById(CHAR_PWM_OPEN_DRAIN).checked;
   // pwm frequency
   json[CHAR_PWM_FREQUENCY] = document.getElementById(CHAR_PWM_FREQUENCY).value;
+  // max power
+  json[CHAR_MAX_POWER] = document.getElementById(CHAR_MAX_POWER).value;
+  // power limit mode
+  json[CHAR_POWER_LIMIT_MODE] = document.getElementById(CHAR_POWER_LIMIT_MODE).value;
+  // effect
+  json[CHAR_EFFECT] = document.getElementById(CHAR_EFFECT).value;
+  // effect intensity
+  json[CHAR_EFFECT_INTENSITY] = document.getElementById(CHAR_EFFECT_INTENSITY).value;
+  // effect seed
+  json[CHAR_EFFECT_SEED] = document.getElementById(CHAR_EFFECT_SEED).value;
+  // sync mode
+  json[CHAR_SYNC_MODE] = document.getElementById(CHAR_SYNC_MODE).value;
+  // mqtt broker, port and topic prefix
+  json[CHAR_MQTT_HOST] = document.getElementById(CHAR_MQTT_HOST).value;
+  json[CHAR_MQTT_PORT] = document.getElementById(CHAR_MQTT_PORT).value;
+  json[CHAR_MQTT_TOPIC] = document.getElementById(CHAR_MQTT_TOPIC).value;
+  // mqtt login, an empty password keeps the current one
+  json[CHAR_MQTT_USER] = document.getElementById(CHAR_MQTT_USER).value;
+  json[CHAR_MQTT_PASSWORD] = document.getElementById(CHAR_MQTT_PASSWORD).value;
+  // password of the updates, empty keeps the current password
+  json[CHAR_OTA_PASSWORD] = document.getElementById(CHAR_OTA_PASSWORD).value;
+  if(json[CHAR_OTA_PASSWORD_SET]) json[CHAR_OTA_CURRENT_PASSWORD] = document.getElementById(CHAR_OTA_CURRENT_PASSWORD).value;
   
   displaySettings(json);
 }
@@ -429,6 +1126,39 @@ function saveSettings() {
 }
 
 
+/*
+ * Log section
+ */
+function receiveLog(msg) {
+  logLines = logLines.concat(msg[CHAR_LOG_LINES]).slice(-200);
+  logSeq = msg[CHAR_LOG_SEQ];
+  if(logTimer === undefined) return;
+  content = watchdogText;
+  content += "<pre class=\"log\">" + logLines.join("\n") + "</pre>";
+  content += msg[CHAR_LOG_DROPPED] + " records dropped on the serial port";
+  document.getElementById('content_div').innerHTML = content;
+}
+
+function receiveWatchdog(msg) {
+  watchdogText = "Last reset: " + msg[CHAR_WATCHDOG_RESET_REASON] + ", restarts by the watchdog: " + msg[CHAR_WATCHDOG_RESTARTS] + "<br>";
+  if(msg[CHAR_WATCHDOG_STAGE] === undefined) return;
+  watchdogText += "Running stage: " + msg[CHAR_WATCHDOG_STAGE] + ", last completed: " + msg[CHAR_WATCHDOG_LAST_COMPLETED];
+  watchdogText += ", stalled: " + msg[CHAR_WATCHDOG_STALLED] + ", uptime: " + Math.round(msg[CHAR_METRICS_UPTIME] / 1000) + " s";
+  watchdogText += ", free heap: " + msg[CHAR_METRICS_FREE_HEAP] + " (min " + msg[CHAR_WATCHDOG_MIN_FREE_HEAP] + ") bytes<br>";
+  var durations = [];
+  for(var stage in msg[CHAR_WATCHDOG_DURATIONS]) {
+    durations.push(stage + " " + msg[CHAR_WATCHDOG_DURATIONS][stage] + "/" + msg[CHAR_WATCHDOG_MAX_DURATIONS][stage]);
+  }
+  watchdogText += "Last/max duration of the stages in us: " + durations.join(", ") + "<br>";
+}
+
+function requestLog() {
+  var tmp = {"id":ID_REQUEST_LOG_FROM_SERVER};
+  tmp[CHAR_LOG_SEQ] = logSeq;
+  sendWebsocketMsg(JSON.stringify(tmp));
+}
+
+
 /*
  * About section
  */
@@ -456,18 +1186,27 @@ function openContent(id) {
     tabs[i].style.backgroundColor = '#E2E2E2';
   }
   document.getElementById('tab_'+id).style.backgroundColor = '#ccc';
+  clearInterval(logTimer);
+  logTimer = undefined;
   switch(id) {
     case 'manual':
-      var tmp = {"id":ID_REQUEST_MANUAL_FROM_SERVER};
+      requestData(ID_REQUEST_MANUAL_FROM_SERVER);
+      var tmp = {"id":ID_REQUEST_SCENES_FROM_SERVER};
       sendWebsocketMsg(JSON.stringify(tmp));
       break;
     case 'schedule':
-      var tmp = {"id":ID_REQUEST_SCHEDULE_FROM_SERVER};
+      requestData(ID_REQUEST_SCHEDULE_FROM_SERVER);
+      var tmp = {"id":ID_REQUEST_PROFILES_FROM_SERVER};
       sendWebsocketMsg(JSON.stringify(tmp));
       break;
     case 'settings':
-      var tmp = {"id":ID_REQUEST_SETTINGS_FROM_SERVER};
+      requestData(ID_REQUEST_SETTINGS_FROM_SERVER);
+      break;
+    case 'log':
+      var tmp = {"id":ID_REQUEST_WATCHDOG_FROM_SERVER};
       sendWebsocketMsg(JSON.stringify(tmp));
+      logTimer = setInterval(requestLog, 1000);
+      requestLog();
       break;
     case 'about':
       displayAbout();
@@ -488,8 +1227,7 @@ function restart() {
 function factorySettings() {
   var tmp = {"id":ID_FACTORY_SETTINGS};
   sendWebsocketMsg(JSON.stringify(tmp));
-  var tmp = {"id":ID_REQUEST_SETTINGS_FROM_SERVER};
-  sendWebsocketMsg(JSON.stringify(tmp));
+  requestData(ID_REQUEST_SETTINGS_FROM_SERVER);
 }
 
 openContent("about");
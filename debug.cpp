@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "debug.h"
+#include <Arduino.h>
+
+/*
+ * Global variables
+ */
+LogSlot logSlots[LOG_NUM_OF_SLOTS]; // ring buffer with the records
+uint32_t logSequence; // sequence number of the next record
+uint32_t logDropped; // number of records that were overwritten before they were written to the DEBUG_PORT
+uint32_t serialSequence; // sequence number of the next record written to the DEBUG_PORT
+char serialLine[LOG_LINE_SIZE + 1]; // formatted record that is currently written to the DEBUG_PORT
+uint8_t serialLineLength; // length of "serialLine"
+uint8_t serialLinePosition; // number of bytes of "serialLine" already written to the DEBUG_PORT
+
+
+/*
+ * Reserves the next slot in the ring buffer for a record with format string "fmt"
+ * the oldest record is overwritten if the ring buffer is full
+ */
+LogSlot &nextLogSlot(const uint8_t level, const char *fmt) {
+  LogSlot &slot = logSlots[logSequence % LOG_NUM_OF_SLOTS];
+  slot.millis = millis();
+  slot.fmt = fmt;
+  slot.level = level;
+  slot.size = 0;
+  logSequence++;
+  return slot;
+}
+
+
+/*
+ * Stores the arguments of a record in its payload
+ * numbers are stored as 4 bytes, strings are stored zero terminated and truncated
+ * if the payload is full, the argument is dropped
+ */
+static void packLogBytes(LogSlot &slot, const void *arg, const uint8_t size) {
+  if(slot.size + size > LOG_PAYLOAD_SIZE) {
+    slot.size = LOG_PAYLOAD_SIZE;
+    return;
+  }
+  memcpy(slot.payload + slot.size, arg, size);
+  slot.size += size;
+}
+
+void packLogArg(LogSlot &slot, const long arg) {
+  int32_t v = arg;
+  packLogBytes(slot, &v, sizeof(v));
+}
+
+void packLogArg(LogSlot &slot, const unsigned long arg) {
+  uint32_t v = arg;
+  packLogBytes(slot, &v, sizeof(v));
+}
+
+void packLogArg(LogSlot &slot, const double arg) {
+  float v = arg;
+  packLogBytes(slot, &v, sizeof(v));
+}
+
+void packLogArg(LogSlot &slot, const char *arg) {
+  if(arg == NULL) arg = "(null)";
+  if(slot.size >= LOG_PAYLOAD_SIZE) return;
+  uint8_t size = strnlen(arg, LOG_PAYLOAD_SIZE - slot.size - 1);
+  memcpy(slot.payload + slot.size, arg, size);
+  slot.payload[slot.size + size] = 0;
+  slot.size += size + 1;
+}
+
+
+/*
+ * reads the next 4 bytes of the payload, returns 0 if the payload is exhausted
+ */
+static uint32_t readLogNumber(const LogSlot &slot, uint8_t &pos) {
+  uint32_t v = 0;
+  if(pos + sizeof(v) <= slot.size) memcpy(&v, slot.payload + pos, sizeof(v));
+  pos += sizeof(v);
+  return v;
+}
+
+
+/*
+ * Formats the record with sequence number "seq" to "line" as "<millis> <level> <message>"
+ * The format string is parsed here and not when the record is logged, every conversion
+ * takes its argument from the payload of the record
+ * returns false if the record does not exist (anymore)
+ */
+bool formatLogRecord(const uint32_t seq, char *line, const size_t len) {
+  if(seq >= logSequence || logSequence - seq > LOG_NUM_OF_SLOTS || len == 0) return false;
+  const LogSlot &slot = logSlots[seq % LOG_NUM_OF_SLOTS];
+  static const char LEVELS[] = "NDIWEC";
+  size_t n = snprintf(line, len, "%lu %c ", (unsigned long)slot.millis, LEVELS[slot.level / 10 % 6]);
+  uint8_t pos = 0;
+  const char *fmt = slot.fmt;
+  char c;
+  while(n + 1 < len && (c = pgm_read_byte(fmt++)) != 0) {
+    if(c != '%') {
+      line[n++] = c;
+      continue;
+    }
+    // copy the conversion without length modifiers, the arguments are always stored with 4 bytes
+    char spec[12] = "%";
+    uint8_t specLen = 1;
+    while((c = pgm_read_byte(fmt)) != 0 && strchr("-+ #0123456789.hlLzjt", c)) {
+      if(!strchr("hlLzjt", c) && specLen + 2u < sizeof(spec)) spec[specLen++] = c;
+      fmt++;
+    }
+    if(c == 0) break;
+    fmt++;
+    spec[specLen++] = c;
+    spec[specLen] = 0;
+    size_t left = len - n;
+    int written = 0;
+    switch(c) {
+      case '%':
+        written = snprintf(line + n, left, "%%");
+        break;
+      case 'd': case 'i': case 'c':
+        written = snprintf(line + n, left, spec, int(readLogNumber(slot, pos)));
+        break;
+      case 'u': case 'x': case 'X': case 'o': case 'p':
+        spec[specLen-1] = c == 'p' ? 'x' : c;
+        written = snprintf(line + n, left, spec, (unsigned int)(readLogNumber(slot, pos)));
+        break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': {
+        uint32_t bits = readLogNumber(slot, pos);
+        float v;
+        memcpy(&v, &bits, sizeof(v));
+        written = snprintf(line + n, left, spec, double(v));
+        break;
+      }
+      case 's': {
+        const char *s = pos < slot.size ? (const char*)slot.payload + pos : "";
+        written = snprintf(line + n, left, spec, s);
+        pos += strlen(s) + 1;
+        break;
+      }
+    }
+    if(written > 0) n += (size_t(written) < left) ? written : left - 1;
+  }
+  line[n < len ? n : len - 1] = 0;
+  return true;
+}
+
+
+/*
+ * Writes the records to the DEBUG_PORT in the main loop
+ * Only as many bytes are written as the DEBUG_PORT can take without blocking,
+ * the rest of the record is written in the next loop
+ */
+void handleLog() {
+#ifdef DEBUG_PORT
+  while(true) {
+    if(serialLinePosition < serialLineLength) {
+      int n = DEBUG_PORT.availableForWrite();
+      if(n <= 0) return;
+      if(n > serialLineLength - serialLinePosition) n = serialLineLength - serialLinePosition;
+      DEBUG_PORT.write((const uint8_t*)serialLine + serialLinePosition, n);
+      serialLinePosition += n;
+      if(serialLinePosition < serialLineLength) return;
+    }
+    if(serialSequence == logSequence) return;
+    if(logSequence - serialSequence > LOG_NUM_OF_SLOTS) {
+      logDropped += logSequence - serialSequence - LOG_NUM_OF_SLOTS;
+      serialSequence = logSequence - LOG_NUM_OF_SLOTS;
+    }
+    formatLogRecord(serialSequence++, serialLine, LOG_LINE_SIZE);
+    serialLineLength = strlen(serialLine);
+    serialLine[serialLineLength++] = '\n';
+    serialLinePosition = 0;
+  }
+#endif
+}
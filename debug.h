@@ -13,47 +13,122 @@
  * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
  */
 
+#ifndef DEBUG__H
+#define DEBUG__H
+
+#include <Arduino.h>
+
 #define DEBUG_PORT Serial
 
-#define DEBUG_LEVEL 10
+// messages with a level lower than DEBUG_LEVEL are removed at compile time
+#define DEBUG_LEVEL 20
 
 
 #ifdef DEBUG_PORT
   #define DEBUG_BEGIN DEBUG_PORT.begin(9600)
+#else
+  #define DEBUG_BEGIN
 #endif
 
-#if 50 >= DEBUG_LEVEL_ && defined DEBUG_PORT 
-  #define DEBUG_CRITICAL(...) DEBUG_PORT.printf_P( __VA_ARGS__ ); DEBUG_PORT.printf_P("\n"); 
+#if 50 >= DEBUG_LEVEL && defined DEBUG_PORT 
+  #define DEBUG_CRITICAL(fmt, ...) logRecord(50, PSTR(fmt), ##__VA_ARGS__)
 #else
   #define DEBUG_CRITICAL(...)
 #endif
 
-#if 40 >= DEBUG_LEVEL_ && defined DEBUG_PORT
-  #define DEBUG_ERROR(...) DEBUG_PORT.printf_P( __VA_ARGS__ ); DEBUG_PORT.printf_P("\n"); 
+#if 40 >= DEBUG_LEVEL && defined DEBUG_PORT
+  #define DEBUG_ERROR(fmt, ...) logRecord(40, PSTR(fmt), ##__VA_ARGS__)
 #else
   #define DEBUG_ERROR(...)
 #endif
 
-#if 30 >= DEBUG_LEVEL_ && defined DEBUG_PORT
-  #define DEBUG_WARNING(...) DEBUG_PORT.printf_P( __VA_ARGS__ ); DEBUG_PORT.printf_P("\n");
+#if 30 >= DEBUG_LEVEL && defined DEBUG_PORT
+  #define DEBUG_WARNING(fmt, ...) logRecord(30, PSTR(fmt), ##__VA_ARGS__)
 #else
   #define DEBUG_WARNING(...)
 #endif
 
-#if 20 >= DEBUG_LEVEL_ && defined DEBUG_PORT
-  #define DEBUG_INFO(...) DEBUG_PORT.printf_P( __VA_ARGS__ ); DEBUG_PORT.printf_P("\n"); 
+#if 20 >= DEBUG_LEVEL && defined DEBUG_PORT
+  #define DEBUG_INFO(fmt, ...) logRecord(20, PSTR(fmt), ##__VA_ARGS__)
 #else
   #define DEBUG_INFO(...)
 #endif
 
-#if 10 >= DEBUG_LEVEL_ && defined DEBUG_PORT
-  #define DEBUG_DEBUG(...) DEBUG_PORT.printf_P( __VA_ARGS__ ); DEBUG_PORT.printf_P("\n"); 
+#if 10 >= DEBUG_LEVEL && defined DEBUG_PORT
+  #define DEBUG_DEBUG(fmt, ...) logRecord(10, PSTR(fmt), ##__VA_ARGS__)
 #else
   #define DEBUG_DEBUG(...)
 #endif
 
-#if 0 >= DEBUG_LEVEL_ && defined DEBUG_PORT
-  #define DEBUG_NOSET(...) DEBUG_PORT.printf_P( __VA_ARGS__ ); DEBUG_PORT.printf_P("\n"); 
+#if 0 >= DEBUG_LEVEL && defined DEBUG_PORT
+  #define DEBUG_NOSET(fmt, ...) logRecord(0, PSTR(fmt), ##__VA_ARGS__)
 #else
   #define DEBUG_NOSET(...)
 #endif
+
+
+/*
+ * Log ring buffer
+ * The messages are not formatted when they are logged. Each message is stored as a compact binary
+ * record with the pointer to its format string in flash and its arguments in a slot of a ring buffer.
+ * The records are formatted and written to the DEBUG_PORT in the main loop, only as many bytes as
+ * the DEBUG_PORT can take without blocking. The last records can also be read via the websocket.
+ * If the ring buffer is full, the oldest records are overwritten.
+ */
+
+// constants
+static const uint8_t LOG_PAYLOAD_SIZE = 22; // size of the arguments of a record in bytes
+static const uint8_t LOG_NUM_OF_SLOTS = 64; // number of records in the ring buffer
+static const uint8_t LOG_LINE_SIZE = 128; // max length of a formatted record
+
+// a single record in the ring buffer
+struct LogSlot {
+  uint32_t millis; // millis uptime of the device when the record was logged
+  const char *fmt; // format string in flash
+  uint8_t level; // level of the record
+  uint8_t size; // used bytes of "payload"
+  uint8_t payload[LOG_PAYLOAD_SIZE]; // arguments, numbers as 4 bytes, strings zero terminated
+};
+
+// global variables
+extern LogSlot logSlots[LOG_NUM_OF_SLOTS]; // ring buffer with the records
+extern uint32_t logSequence; // sequence number of the next record
+extern uint32_t logDropped; // number of records that were overwritten before they were written to the DEBUG_PORT
+
+// stores the arguments of a record
+void packLogArg(LogSlot &slot, const long arg);
+void packLogArg(LogSlot &slot, const unsigned long arg);
+void packLogArg(LogSlot &slot, const double arg);
+void packLogArg(LogSlot &slot, const char *arg);
+inline void packLogArg(LogSlot &slot, const unsigned char *arg) { packLogArg(slot, (const char*)arg); }
+inline void packLogArg(LogSlot &slot, const bool arg) { packLogArg(slot, long(arg)); }
+inline void packLogArg(LogSlot &slot, const char arg) { packLogArg(slot, long(arg)); }
+inline void packLogArg(LogSlot &slot, const signed char arg) { packLogArg(slot, long(arg)); }
+inline void packLogArg(LogSlot &slot, const unsigned char arg) { packLogArg(slot, (unsigned long)(arg)); }
+inline void packLogArg(LogSlot &slot, const short arg) { packLogArg(slot, long(arg)); }
+inline void packLogArg(LogSlot &slot, const unsigned short arg) { packLogArg(slot, (unsigned long)(arg)); }
+inline void packLogArg(LogSlot &slot, const int arg) { packLogArg(slot, long(arg)); }
+inline void packLogArg(LogSlot &slot, const unsigned int arg) { packLogArg(slot, (unsigned long)(arg)); }
+inline void packLogArg(LogSlot &slot, const float arg) { packLogArg(slot, double(arg)); }
+
+inline void packLogArgs(LogSlot &slot) {}
+template<typename T, typename... Args> void packLogArgs(LogSlot &slot, const T arg, const Args... args) {
+  packLogArg(slot, arg);
+  packLogArgs(slot, args...);
+}
+
+// reserves the next slot in the ring buffer
+LogSlot &nextLogSlot(const uint8_t level, const char *fmt);
+
+// logs a record with format string "fmt" in flash and its arguments
+template<typename... Args> void logRecord(const uint8_t level, const char *fmt, const Args... args) {
+  packLogArgs(nextLogSlot(level, fmt), args...);
+}
+
+// formats the record with sequence number "seq" to "line", returns false if the record has been overwritten
+bool formatLogRecord(const uint32_t seq, char *line, const size_t len);
+
+// writes the records to the DEBUG_PORT without blocking in the main loop
+void handleLog();
+
+#endif
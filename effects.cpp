@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "effects.h"
+#include "channel.h"
+#include "pwm.h"
+#include "debug.h"
+#include <Arduino.h>
+
+/*
+ * Global variables
+ */
+uint8_t effect; // current effect
+uint8_t effectIntensity; // intensity of the effect in %, defines how often and how strong clouds and lightnings are
+uint32_t effectSeed; // seed of the random numbers, so the same seed gives always the same sequence of clouds and lightnings
+volatile uint32_t effectFrames; // number of rendered frames since the effect has started
+volatile uint32_t effectFrameCycles; // CPU cycles needed to render the last frame
+volatile uint32_t effectMaxFrameCycles; // maximal CPU cycles needed to render a frame
+
+/*
+ * State of the renderer
+ * The frames are rendered in the interrupt of timer0, so all functions of the renderer are in the IRAM and
+ * all values are fixed point numbers with 16 fractional bits (Q16), so no floats are needed in the interrupt
+ * Dimming levels are going from 0 (no dimming) to Q16 (dark)
+ */
+static const int32_t Q16 = 65536;
+static const int32_t MAX_DIMMING = Q16 - Q16/20; // the effects never dim more than 95%
+
+static const uint8_t PHASE_IDLE = 0; // Macros for the phases of clouds and storms
+static const uint8_t PHASE_IN = 1;
+static const uint8_t PHASE_HOLD = 2;
+static const uint8_t PHASE_OUT = 3;
+
+static uint32_t randomState; // state of the xorshift random number generator
+static uint32_t cloudChance; // chance per frame that a cloud starts, compared to a random number
+static uint32_t lightningChance; // chance per frame that a lightning starts during a storm
+
+static uint8_t cloudPhase;
+static uint32_t cloudFramesLeft;
+static int32_t cloudLevel; // current dimming by the cloud
+static int32_t cloudStep; // change of "cloudLevel" per frame
+
+static uint8_t stormPhase;
+static uint32_t stormFramesLeft;
+static int32_t stormLevel; // current dimming by the storm
+static int32_t stormStep; // change of "stormLevel" per frame
+
+static uint8_t flashesLeft; // number of flashes left in the current lightning
+static uint16_t flashFramesLeft;
+static bool flashOn;
+static int32_t flashLevel; // brightness of the current flash
+
+static uint8_t numOfRenderedChannels; // number of channels the effect is rendered on
+static volatile uint16_t baseDuty[MAX_NUM_OF_CHANNELS]; // duty cycle of the channels without the effect (0..65535)
+static volatile uint16_t flashDuty[MAX_NUM_OF_CHANNELS]; // max duty cycle of a flash on the lightning channels
+static volatile uint16_t frameDuty[MAX_NUM_OF_CHANNELS]; // duty cycle of the last frame
+static volatile uint32_t writtenDuty[MAX_NUM_OF_CHANNELS]; // duty cycle that was written to the output last
+static volatile bool framePending; // true if a frame has to be written in the main loop
+static uint32_t cyclesPerFrame; // cpu cycles between two frames
+static volatile uint32_t nextFrameCycles; // cycle count of the next timer interrupt
+
+
+/*
+ * xorshift32 random number generator, so the sequence of the effects
+ * only depends on "effectSeed"
+ */
+static uint32_t IRAM_ATTR nextRandom() {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+// returns a random number between lo and hi (both included)
+static uint32_t IRAM_ATTR randomBetween(const uint32_t lo, const uint32_t hi) {
+  return lo + nextRandom() % (hi - lo + 1);
+}
+
+
+/*
+ * passing clouds
+ * a cloud dims all channels within a few seconds, stays for a while and passes again
+ */
+static void IRAM_ATTR renderClouds() {
+  switch(cloudPhase) {
+    case PHASE_IDLE:
+      if(nextRandom() < cloudChance) {
+        int32_t depth = Q16 / 100 * randomBetween(10, 10 + 50 * effectIntensity / 100);
+        cloudFramesLeft = randomBetween(EFFECT_FRAME_RATE, 4 * EFFECT_FRAME_RATE);
+        cloudStep = depth / int32_t(cloudFramesLeft);
+        cloudPhase = PHASE_IN;
+      }
+      break;
+    case PHASE_IN:
+      cloudLevel += cloudStep;
+      if(--cloudFramesLeft == 0) {
+        cloudFramesLeft = randomBetween(2 * EFFECT_FRAME_RATE, 20 * EFFECT_FRAME_RATE);
+        cloudPhase = PHASE_HOLD;
+      }
+      break;
+    case PHASE_HOLD:
+      if(--cloudFramesLeft == 0) {
+        cloudFramesLeft = randomBetween(EFFECT_FRAME_RATE, 4 * EFFECT_FRAME_RATE);
+        cloudStep = cloudLevel / int32_t(cloudFramesLeft);
+        cloudPhase = PHASE_OUT;
+      }
+      break;
+    case PHASE_OUT:
+      cloudLevel -= cloudStep;
+      if(--cloudFramesLeft == 0) {
+        cloudLevel = 0;
+        cloudPhase = PHASE_IDLE;
+      }
+      break;
+  }
+}
+
+
+/*
+ * storm sequence
+ * after a random pause the storm approaches within 30s, stays for 1 to 5 minutes with lightnings
+ * and passes within 30s again
+ */
+static void IRAM_ATTR renderStorm() {
+  switch(stormPhase) {
+    case PHASE_IDLE:
+      if(--stormFramesLeft == 0) {
+        int32_t depth = Q16 / 100 * (30 + 40 * effectIntensity / 100);
+        stormFramesLeft = 30 * EFFECT_FRAME_RATE;
+        stormStep = depth / int32_t(stormFramesLeft);
+        stormPhase = PHASE_IN;
+      }
+      break;
+    case PHASE_IN:
+      stormLevel += stormStep;
+      if(--stormFramesLeft == 0) {
+        stormFramesLeft = randomBetween(60 * EFFECT_FRAME_RATE, 300 * EFFECT_FRAME_RATE);
+        stormPhase = PHASE_HOLD;
+      }
+      break;
+    case PHASE_HOLD:
+      if(flashesLeft == 0 && nextRandom() < lightningChance) {
+        flashesLeft = randomBetween(1, 4);
+        flashFramesLeft = randomBetween(3, 15);
+        flashOn = false;
+      }
+      if(--stormFramesLeft == 0) {
+        stormFramesLeft = 30 * EFFECT_FRAME_RATE;
+        stormStep = stormLevel / int32_t(stormFramesLeft);
+        stormPhase = PHASE_OUT;
+      }
+      break;
+    case PHASE_OUT:
+      stormLevel -= stormStep;
+      if(--stormFramesLeft == 0) {
+        stormLevel = 0;
+        stormFramesLeft = randomBetween(120 * EFFECT_FRAME_RATE, 600 * EFFECT_FRAME_RATE);
+        stormPhase = PHASE_IDLE;
+      }
+      break;
+  }
+}
+
+
+/*
+ * lightning consisting of 1 to 4 short flashes of 20 to 60ms
+ */
+static void IRAM_ATTR renderLightning() {
+  if(flashesLeft == 0) return;
+  if(--flashFramesLeft > 0) return;
+  if(flashOn) {
+    flashOn = false;
+    flashesLeft--;
+    flashFramesLeft = randomBetween(3, 15);
+  }
+  else {
+    flashOn = true;
+    flashLevel = Q16 / 100 * randomBetween(60, 100);
+    flashFramesLeft = randomBetween(2, 6);
+  }
+}
+
+
+/*
+ * Renders a single frame of the effect
+ * The dimming of clouds and storms is applied to the duty cycle of all channels,
+ * the flashes of the lightnings are shown on the lightning channels only.
+ * The frame is only rendered here, it is written to the outputs by "handleEffects" in the main loop. Neither the
+ * I2C bus of the PCA9685 nor the waveforms of the ESP8266 can be written in an interrupt, the core waits for the
+ * waveform generator when a waveform is started.
+ * No memory is allocated and no floats are used, so the frame takes always the same time.
+ */
+void IRAM_ATTR renderEffectFrame() {
+  uint32_t startCycles = ESP.getCycleCount();
+
+  renderClouds();
+  if(effect == EFFECT_STORM) {
+    renderStorm();
+    renderLightning();
+  }
+  int32_t dimming = cloudLevel + stormLevel;
+  if(dimming > MAX_DIMMING) dimming = MAX_DIMMING;
+  if(dimming < 0) dimming = 0;
+  uint32_t factor = Q16 - dimming;
+
+  for(uint8_t c=0; c<numOfRenderedChannels; c++) {
+    uint32_t duty = (uint32_t(baseDuty[c]) * factor) >> 16;
+    if(flashOn) {
+      uint32_t flash = (uint32_t(flashDuty[c]) * uint32_t(flashLevel)) >> 16;
+      if(flash > duty) duty = flash;
+    }
+    frameDuty[c] = duty;
+    if(duty != writtenDuty[c]) framePending = true;
+  }
+
+  effectFrames++;
+  effectFrameCycles = ESP.getCycleCount() - startCycles;
+  if(effectFrameCycles > effectMaxFrameCycles) effectMaxFrameCycles = effectFrameCycles;
+}
+
+
+/*
+ * Interrupt of timer0, renders a frame every "cyclesPerFrame"
+ * The next interrupt is set relative to the last one and not to the current cycle count, so the frames do not drift
+ */
+static void IRAM_ATTR effectTimerInterrupt() {
+  uint32_t next = nextFrameCycles + cyclesPerFrame;
+  // after a missed frame the next one is set from now, a compare value in the past would only match after the overflow
+  if(int32_t(next - ESP.getCycleCount()) <= 0) next = ESP.getCycleCount() + cyclesPerFrame;
+  nextFrameCycles = next;
+  timer0_write(next);
+  renderEffectFrame();
+}
+
+
+/*
+ * Starts the timer rendering the frames of "effect"
+ * The frames are rendered by the interrupt of timer0, the cycle count compare timer of the CPU, so the effect runs at
+ * its frame rate even while the main loop is blocked. Timer1 is not used, it generates the waveforms of the ESP8266 PWM.
+ * The random number generator is reset to "effectSeed", so the effect is deterministic
+ * If "effect" is EFFECT_NONE the timer is stopped and the outputs are set according to the schedule again
+ */
+void startEffects() {
+  timer0_detachInterrupt();
+  randomState = effectSeed ? effectSeed : 1;
+  cloudPhase = PHASE_IDLE;
+  cloudLevel = 0;
+  stormPhase = PHASE_IDLE;
+  stormLevel = 0;
+  stormFramesLeft = 60 * EFFECT_FRAME_RATE;
+  flashesLeft = 0;
+  flashOn = false;
+  framePending = false;
+  effectFrames = 0;
+  effectMaxFrameCycles = 0;
+  // a cloud every 60s at 100% intensity, a lightning every 5s during a storm at 100% intensity
+  if(effectIntensity > 100) effectIntensity = 100;
+  cloudChance = 0xFFFFFFFFUL / (60 * EFFECT_FRAME_RATE) / 100 * effectIntensity;
+  lightningChance = 0xFFFFFFFFUL / (5 * EFFECT_FRAME_RATE) / 100 * effectIntensity;
+  for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) writtenDuty[c] = 0xFFFFFFFF;
+
+  if(effect == EFFECT_NONE) {
+    DEBUG_INFO("[startEffects] no effect");
+    numOfRenderedChannels = 0;
+    handlePWM(true);
+    return;
+  }
+  DEBUG_INFO("[startEffects] effect: %d, intensity: %d%%", effect, effectIntensity);
+  updateEffectOutputs();
+  cyclesPerFrame = ESP.getCpuFreqMHz() * 1000000UL / EFFECT_FRAME_RATE;
+  noInterrupts();
+  timer0_isr_init();
+  timer0_attachInterrupt(effectTimerInterrupt);
+  nextFrameCycles = ESP.getCycleCount() + cyclesPerFrame;
+  timer0_write(nextFrameCycles);
+  interrupts();
+}
+
+
+/*
+ * Takes over the "output" of the channels after a PWM update as base of the frames
+ * The flashes of the lightning channels are limited by "maxPower", so the lightnings
+ * never exceed the power limit
+ */
+void updateEffectOutputs() {
+  uint8_t numOfLightningChannels = 0;
+  for(uint8_t c=0; c<numOfChannels; c++) if(channels[c].lightning) numOfLightningChannels++;
+  float remainingPower = maxPower - currentPower;
+
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    baseDuty[c] = channels[c].output / 100. * 65535;
+    float flash = 0;
+    if(channels[c].lightning) {
+      flash = 100;
+      if(maxPower > 0 && channels[c].power > 0) {
+        flash = channels[c].output + remainingPower / numOfLightningChannels / channels[c].power * 100.;
+        if(flash > 100) flash = 100;
+      }
+    }
+    flashDuty[c] = flash / 100. * 65535;
+  }
+  numOfRenderedChannels = numOfChannels;
+}
+
+
+/*
+ * handles the effect renderer in the main loop
+ * writes the last frame rendered by the timer to the outputs, frames rendered while the loop was blocked are skipped
+ */
+void handleEffects() {
+  if(!framePending) return;
+  framePending = false;
+  for(uint8_t c=0; c<numOfRenderedChannels; c++) {
+    uint16_t duty = frameDuty[c];
+    if(duty != writtenDuty[c]) {
+      pwmOutput.write(c, duty);
+      writtenDuty[c] = duty;
+    }
+  }
+  pwmOutput.commit();
+}
+
+
+uint32_t millisUntilEffectFrame() {
+  if(framePending) return 0;
+  // the frames are written by the main loop
+  if(effect != EFFECT_NONE) return MILLIS_BETWEEN_EFFECT_FRAMES;
+  return UINT32_MAX;
+}
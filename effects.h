@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef EFFECTS__H
+#define EFFECTS__H
+
+#include <Arduino.h>
+
+// constants
+static const uint8_t EFFECT_NONE = 0; // Macros for the effects: no effect, the channels follow the schedule only
+static const uint8_t EFFECT_CLOUDS = 1; // passing clouds are dimming all channels
+static const uint8_t EFFECT_STORM = 2; // storms with dark clouds and lightning flashes on the lightning channels
+static const uint16_t EFFECT_FRAME_RATE = 100; // number of frames rendered per second
+static const uint32_t MILLIS_BETWEEN_EFFECT_FRAMES = 1000 / EFFECT_FRAME_RATE; // time between two frames in ms
+
+// global variables
+extern uint8_t effect; // current effect
+extern uint8_t effectIntensity; // intensity of the effect in %, defines how often and how strong clouds and lightnings are
+extern uint32_t effectSeed; // seed of the random numbers, so the same seed gives always the same sequence of clouds and lightnings
+extern volatile uint32_t effectFrames; // number of rendered frames since the effect has started
+extern volatile uint32_t effectFrameCycles; // CPU cycles needed to render the last frame
+extern volatile uint32_t effectMaxFrameCycles; // maximal CPU cycles needed to render a frame
+
+// starts the effect renderer according to "effect" or stops it if "effect" is EFFECT_NONE
+void startEffects();
+// sets the outputs of the channels the effect is rendered on, called after every PWM update
+void updateEffectOutputs();
+// renders a single frame, called by the interrupt of timer0 every MILLIS_BETWEEN_EFFECT_FRAMES
+void renderEffectFrame();
+// handles the effect renderer in the main loop, writes the last rendered frame to the outputs
+void handleEffects();
+// returns the time in ms until "handleEffects" has to write a frame, UINT32_MAX if the frames are written by the timer
+uint32_t millisUntilEffectFrame();
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "idle.h"
+#include "settings.h"
+#include "channel.h"
+#include "server.h"
+#include "ntp.h"
+#include "effects.h"
+#include "scenes.h"
+#include "sync.h"
+#include "profiles.h"
+#include "mqtt.h"
+#include "debug.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESP8266WiFi.h>
+#include <ESPAsyncWebServer.h>
+
+// global variables
+bool idleSleep = true; // true if the main loop sleeps until the next stage is due, false to measure the power without sleep
+WiFiSleepType_t idleSleepMode = WIFI_NONE_SLEEP; // sleep mode set by "handleIdle"
+unsigned long idleMeasureStart = 0; // millis uptime at the start of the measurement
+uint32_t idleSleptMillis = 0; // time slept since the start of the measurement in ms
+uint32_t idleSleeps = 0; // number of sleeps since the start of the measurement
+uint32_t idleInterrupted = 0; // number of sleeps that ended early for a network event
+
+
+/*
+ * Returns the sleep mode that keeps the PWM outputs running
+ * In light sleep the CPU stops, so does the PWM of the ESP8266 and the timer of the effect renderer. The PCA9685
+ * generates its PWM on its own. A leader of the sync keeps the modem sleep, so the beacons are sent on time.
+ */
+WiFiSleepType_t selectSleepMode() {
+  if(!idleSleep) return WIFI_NONE_SLEEP;
+  if(PWMGenerator == PWM_GENERATOR_PCA9685 && effect == EFFECT_NONE && syncMode == SYNC_OFF) return WIFI_LIGHT_SLEEP;
+  return WIFI_MODEM_SLEEP;
+}
+
+
+/*
+ * Returns the time in ms until the next stage of the main loop has work to do
+ */
+uint32_t millisUntilWakeup() {
+  if(!serverIdle()) return 0;
+  uint32_t wakeup = millisUntilPWMUpdate();
+  wakeup = min(wakeup, millisUntilProfileCheck());
+  wakeup = min(wakeup, millisUntilSceneCheck());
+  wakeup = min(wakeup, millisUntilSync());
+  wakeup = min(wakeup, millisUntilNextSecond());
+  wakeup = min(wakeup, millisUntilEffectFrame());
+  wakeup = min(wakeup, millisUntilMqtt());
+  return wakeup;
+}
+
+
+/*
+ * Sleeps until the next stage is due, at most "MAX_IDLE_MILLIS"
+ * "delay" lets the SDK switch off the modem or, in light sleep, the CPU between the beacons of the WiFi. The sleep is
+ * cut into "IDLE_POLL_MILLIS" parts, so a websocket message or an http request waits at most that long.
+ */
+void handleIdle() {
+  WiFiSleepType_t mode = selectSleepMode();
+  if(mode != idleSleepMode) {
+    DEBUG_INFO("[handleIdle] sleep mode: %d", mode);
+    WiFi.setSleepMode(mode);
+    idleSleepMode = mode;
+  }
+  if(idleMeasureStart == 0) idleMeasureStart = millis();
+  // the outputs are checked in the idle time, so the check never delays a PWM update
+  if(millisUntilWakeup() > 0) checkPWM();
+  if(!idleSleep) return;
+
+  uint32_t idle = millisUntilWakeup();
+  if(idle < MIN_IDLE_MILLIS) return;
+  if(idle > MAX_IDLE_MILLIS) idle = MAX_IDLE_MILLIS;
+  unsigned long start = millis();
+  while(millis() - start < idle) {
+    if(!serverIdle()) {
+      idleInterrupted++;
+      break;
+    }
+    uint32_t left = idle - (millis() - start);
+    delay(left < IDLE_POLL_MILLIS ? left : IDLE_POLL_MILLIS);
+  }
+  idleSleeps++;
+  idleSleptMillis += millis() - start;
+}
+
+
+/*
+ * Sends the share of the time the main loop was awake since the start of the measurement as json to the http client
+ * parameters of the http request:
+ *   sleep: 1 to sleep between the stages, 0 to keep the main loop spinning, e.g. to compare the current of both
+ *   reset: starts a new measurement, also done if "sleep" changes
+ */
+void handleIdleRequest(AsyncWebServerRequest *request) {
+  bool reset = request->hasArg("reset");
+  if(request->hasArg("sleep")) {
+    bool sleep = request->arg("sleep").toInt() != 0;
+    if(sleep != idleSleep) reset = true;
+    idleSleep = sleep;
+  }
+  if(reset) {
+    idleMeasureStart = millis();
+    idleSleptMillis = idleSleeps = idleInterrupted = 0;
+  }
+  uint32_t measured = millis() - idleMeasureStart;
+
+  DynamicJsonBuffer jsonBuffer;
+  JsonObject& jsonOut = jsonBuffer.createObject();
+  // sleep between the stages
+  jsonOut[CHAR_IDLE_SLEEP] = idleSleep;
+  // sleep mode of the WiFi: 0 none, 1 light, 2 modem
+  jsonOut[CHAR_IDLE_SLEEP_MODE] = uint8_t(selectSleepMode());
+  // duration of the measurement and the time slept in ms
+  jsonOut[CHAR_IDLE_MEASURED_MILLIS] = measured;
+  jsonOut[CHAR_IDLE_SLEPT_MILLIS] = idleSleptMillis;
+  // share of the time the main loop was awake in %
+  jsonOut[CHAR_IDLE_AWAKE_PERCENT] = measured ? 100. * (measured - min(idleSleptMillis, measured)) / measured : 100.;
+  // number of sleeps and the ones interrupted by a network event
+  jsonOut[CHAR_IDLE_SLEEPS] = idleSleeps;
+  jsonOut[CHAR_IDLE_INTERRUPTED] = idleInterrupted;
+
+  String jsonOutStr;
+  jsonOut.printTo(jsonOutStr);
+  AsyncWebServerResponse *response = request->beginResponse(200, F("application/json"), jsonOutStr);
+  response->addHeader(F("Cache-Control"), F("no-cache"));
+  request->send(response);
+}
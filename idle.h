@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef IDLE__H
+#define IDLE__H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// constants
+static const uint32_t MIN_IDLE_MILLIS = 20; // shorter idle times are not worth a sleep
+static const uint32_t MAX_IDLE_MILLIS = 1000; // max time of one sleep
+static const uint32_t IDLE_POLL_MILLIS = 100; // a sleep is interrupted after this time if a network event is waiting
+
+// global variables
+extern bool idleSleep; // true if the main loop sleeps until the next stage is due, false to measure the power without sleep
+
+// sleeps until the next stage of the main loop is due
+void handleIdle();
+// reports the share of the time the main loop was awake and switches the sleep on or off
+void handleIdleRequest(AsyncWebServerRequest *request);
+
+#endif
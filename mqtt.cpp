@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "mqtt.h"
+#include "server.h"
+#include "settings.h"
+#include "channel.h"
+#include "scenes.h"
+#include "debug.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESP8266WiFi.h>
+#include <AsyncMqttClient.h>
+
+/*
+ * Global variables
+ */
+char mqttHost[LEN_MQTT_HOST + 1]; // name or IP of the broker, empty if mqtt is off
+uint16_t mqttPort = DEFAULT_MQTT_PORT; // port of the broker
+char mqttTopic[LEN_MQTT_TOPIC + 1]; // prefix of the topics, e.g. "reeflight" for "reeflight/state"
+char mqttUser[LEN_MQTT_USER + 1]; // user name at the broker, empty if the broker needs no login
+char mqttPassword[LEN_MQTT_PASSWORD + 1]; // password at the broker, stored with the other passwords
+uint32_t mqttPublished = 0; // number of published states and replies
+uint32_t mqttDropped = 0; // number of states, replies and commands that were dropped
+AsyncMqttClient mqttClient; // client of the broker, runs on the TCP stack like the webserver
+char mqttBuffer[MQTT_BUFFER_SIZE]; // the state is serialized here, so publishing needs no heap for the message
+char mqttClientId[24]; // id of the device at the broker
+char mqttStatusTopic[LEN_MQTT_TOPIC + 8]; // "<topic>/status", also the last will, so it must stay valid while connected
+char mqttSetTopic[LEN_MQTT_TOPIC + 8]; // "<topic>/set", the commands are received there
+char mqttClientUser[LEN_MQTT_USER + 1]; // login given to the client, it must stay valid while connected
+char mqttClientPassword[LEN_MQTT_PASSWORD + 1];
+String mqttStarted; // broker, port, topic and login of the last "startMqtt", the connection is kept if they are unchanged
+bool mqttConnecting = false; // true while a connect is running
+bool mqttStateDue = false; // true if the state is published by the next "handleMqtt", e.g. after a connect
+unsigned long millisAtLastTry; // millis uptime of the last connect
+unsigned long mqttReconnectMillis = MIN_MQTT_RECONNECT_MILLIS; // wait until the next connect in ms
+unsigned long millisAtLastState; // millis uptime of the last published state
+uint32_t publishedRevision; // "revisionChannels" of the last published state
+uint16_t pendingPacket = 0; // packet id of the state waiting for the acknowledgement of the broker, 0 if none
+
+
+/*
+ * Called by the TCP stack if the connection to the broker is established
+ * Subscribes the commands and marks the device as online, the state is published by the next "handleMqtt"
+ */
+void onMqttConnect(bool sessionPresent) {
+  DEBUG_INFO("[onMqttConnect] connected to %s", mqttHost);
+  mqttConnecting = false;
+  mqttReconnectMillis = MIN_MQTT_RECONNECT_MILLIS;
+  pendingPacket = 0;
+  mqttStateDue = true;
+  mqttClient.subscribe(mqttSetTopic, 0);
+  mqttClient.publish(mqttStatusTopic, 0, true, "online");
+}
+
+
+/*
+ * Called by the TCP stack if the connection to the broker is lost or could not be established
+ * "handleMqtt" tries again after "mqttReconnectMillis"
+ */
+void onMqttDisconnect(AsyncMqttClientDisconnectReason reason) {
+  DEBUG_WARNING("[onMqttDisconnect] reason: %d", int(reason));
+  mqttConnecting = false;
+  pendingPacket = 0;
+  millisAtLastTry = millis();
+}
+
+
+/*
+ * Called by the TCP stack if the broker acknowledged a message with QoS 1
+ */
+void onMqttPublish(uint16_t packetId) {
+  if(packetId == pendingPacket) pendingPacket = 0;
+}
+
+
+/*
+ * Called by the TCP stack for each part of a received command
+ * The command is copied to the heap and queued like a websocket message, so it is handled by "handleServer" in
+ * the main loop and answered with "publishMqttReply". Commands that arrive in more than one part are dropped.
+ */
+void onMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+  if(index != 0 || len != total || total > MAX_MQTT_COMMAND_SIZE) {
+    if(index == 0) {
+      DEBUG_WARNING("[onMqttMessage] command of %u bytes dropped", total);
+      mqttDropped++;
+    }
+    return;
+  }
+  char *command = (char *) malloc(len + 1);
+  if(!command) {
+    mqttDropped++;
+    return;
+  }
+  memcpy(command, payload, len);
+  command[len] = '\0';
+  queueMessage(MQTT_CLIENT, command);
+}
+
+
+/*
+ * Publishes the values and outputs of the channels, the power and the health of the device to "<topic>/state"
+ * The state is serialized into "mqttBuffer" and published with QoS 1 and retained, so a new subscriber gets the last
+ * state at once. The client writes the message into the TCP buffer or returns 0 if it has no space, so nothing
+ * is queued on the heap. A state that is too large or finds no space is dropped, the next one follows the changes.
+ */
+void publishState() {
+  DynamicJsonBuffer jsonBuffer;
+  JsonObject& json = jsonBuffer.createObject();
+  // revision of the channels
+  json[CHAR_REVISION] = revisionChannels;
+  // channel values and the outputs after the power limit in %
+  JsonArray& jsonValues = json.createNestedArray(CHAR_CHANNEL_VALUES);
+  JsonArray& jsonOutputs = json.createNestedArray(CHAR_MQTT_OUTPUTS);
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    jsonValues.add(channels[c].value);
+    jsonOutputs.add(channels[c].output);
+  }
+  // current power
+  json[CHAR_CURRENT_POWER] = currentPower;
+  // power limit factor
+  json[CHAR_POWER_LIMIT_FACTOR] = powerLimitFactor;
+  // active scene
+  json[CHAR_ACTIVE_SCENE] = activeScene;
+  // uptime in ms, free heap in bytes and signal strength of the WiFi in dBm
+  json[CHAR_METRICS_UPTIME] = millis();
+  json[CHAR_METRICS_FREE_HEAP] = ESP.getFreeHeap();
+  json[CHAR_MQTT_RSSI] = WiFi.RSSI();
+
+  publishedRevision = revisionChannels;
+  millisAtLastState = millis();
+  mqttStateDue = false;
+
+  size_t len = json.measureLength();
+  if(len >= MQTT_BUFFER_SIZE) {
+    DEBUG_WARNING("[publishState] state of %u bytes dropped", len);
+    mqttDropped++;
+    return;
+  }
+  json.printTo(mqttBuffer, MQTT_BUFFER_SIZE);
+  char topic[LEN_MQTT_TOPIC + 8];
+  snprintf(topic, sizeof(topic), "%s/state", mqttTopic);
+  pendingPacket = mqttClient.publish(topic, 1, true, mqttBuffer, len);
+  if(pendingPacket == 0) {
+    mqttDropped++;
+    return;
+  }
+  mqttPublished++;
+}
+
+
+/*
+ * Publishes the reply "reply" to a command received by mqtt to "<topic>/reply"
+ * The reply is published with QoS 0, it is dropped if the connection is lost or the TCP buffer is full.
+ */
+void publishMqttReply(const String& reply) {
+  char topic[LEN_MQTT_TOPIC + 8];
+  snprintf(topic, sizeof(topic), "%s/reply", mqttTopic);
+  if(!mqttClient.connected() || mqttClient.publish(topic, 0, false, reply.c_str(), reply.length()) == 0) {
+    mqttDropped++;
+    return;
+  }
+  mqttPublished++;
+}
+
+
+/*
+ * Connects to the broker in "mqttHost"
+ * Called at the start and after the settings are saved. If the broker, the port, the topic and the login did not
+ * change, the running connection is kept, otherwise it is closed first. An empty "mqttHost" turns mqtt off. The connect
+ * itself is done by "handleMqtt".
+ */
+void startMqtt() {
+  static bool callbacksSet = false;
+  String started = String(mqttHost) + ':' + mqttPort + '/' + mqttTopic + '@' + mqttUser + ':' + mqttPassword;
+  if(callbacksSet && started == mqttStarted) return;
+  mqttStarted = started;
+  if(!callbacksSet) {
+    mqttClient.onConnect(onMqttConnect);
+    mqttClient.onDisconnect(onMqttDisconnect);
+    mqttClient.onPublish(onMqttPublish);
+    mqttClient.onMessage(onMqttMessage);
+    callbacksSet = true;
+  }
+  if(mqttClient.connected() || mqttConnecting) mqttClient.disconnect(true);
+  mqttConnecting = false;
+  pendingPacket = 0;
+  if(mqttHost[0] == '\0') return;
+
+  snprintf(mqttClientId, sizeof(mqttClientId), "reeflight-%06x", ESP.getChipId());
+  snprintf(mqttStatusTopic, sizeof(mqttStatusTopic), "%s/status", mqttTopic);
+  snprintf(mqttSetTopic, sizeof(mqttSetTopic), "%s/set", mqttTopic);
+  mqttClient.setServer(mqttHost, mqttPort);
+  mqttClient.setClientId(mqttClientId);
+  mqttClient.setWill(mqttStatusTopic, 0, true, "offline");
+  // the login is copied, so a change of the settings does not change it while connected
+  strlcpy(mqttClientUser, mqttUser, sizeof(mqttClientUser));
+  strlcpy(mqttClientPassword, mqttPassword, sizeof(mqttClientPassword));
+  mqttClient.setCredentials(mqttClientUser[0] ? mqttClientUser : nullptr, mqttClientUser[0] ? mqttClientPassword : nullptr);
+  // the first connect is done at once
+  mqttReconnectMillis = MIN_MQTT_RECONNECT_MILLIS;
+  millisAtLastTry = millis() - mqttReconnectMillis;
+}
+
+
+/*
+ * Handles the connection to the broker and publishes the state in the main loop
+ * The connect does not block, its result is reported to "onMqttConnect" or "onMqttDisconnect". The wait between the
+ * tries is doubled up to "MAX_MQTT_RECONNECT_MILLIS". The changes of the channels are batched, the state is published
+ * at most every "MILLIS_BETWEEN_MQTT_STATES" and at least every "MILLIS_BETWEEN_MQTT_HEALTH". Only one state waits for
+ * the acknowledgement at a time, so a slow broker does not fill the TCP buffer.
+ */
+void handleMqtt() {
+  if(mqttHost[0] == '\0') return;
+
+  if(!mqttClient.connected()) {
+    if(mqttConnecting && millis() - millisAtLastTry < MAX_MQTT_RECONNECT_MILLIS) return;
+    if(WiFi.status() != WL_CONNECTED || millis() - millisAtLastTry < mqttReconnectMillis) return;
+    DEBUG_INFO("[handleMqtt] connecting to %s:%u", mqttHost, mqttPort);
+    mqttConnecting = true;
+    millisAtLastTry = millis();
+    mqttReconnectMillis = mqttReconnectMillis * 2 < MAX_MQTT_RECONNECT_MILLIS ? mqttReconnectMillis * 2 : MAX_MQTT_RECONNECT_MILLIS;
+    mqttClient.connect();
+    return;
+  }
+
+  unsigned long sinceLastState = millis() - millisAtLastState;
+  if(pendingPacket != 0) {
+    if(sinceLastState < MQTT_PUBLISH_TIMEOUT) return;
+    DEBUG_WARNING("[handleMqtt] state %u not acknowledged", pendingPacket);
+    pendingPacket = 0;
+  }
+  if(mqttStateDue || sinceLastState >= MILLIS_BETWEEN_MQTT_HEALTH ||
+     (revisionChannels != publishedRevision && sinceLastState >= MILLIS_BETWEEN_MQTT_STATES)) {
+    publishState();
+  }
+}
+
+
+/*
+ * Returns true if the device is connected to the broker
+ */
+bool mqttConnected() {
+  return mqttClient.connected();
+}
+
+
+/*
+ * Returns the time in ms until "handleMqtt" has work to do
+ * While the state waits for the acknowledgement or no state is due, the broker is handled by the TCP stack alone.
+ */
+uint32_t millisUntilMqtt() {
+  if(mqttHost[0] == '\0') return UINT32_MAX;
+  unsigned long now = millis();
+  if(!mqttClient.connected()) {
+    if(mqttConnecting || WiFi.status() != WL_CONNECTED) return MIN_MQTT_RECONNECT_MILLIS;
+    unsigned long since = now - millisAtLastTry;
+    return since >= mqttReconnectMillis ? 0 : mqttReconnectMillis - since;
+  }
+  if(mqttStateDue) return 0;
+  unsigned long since = now - millisAtLastState;
+  unsigned long wait = pendingPacket != 0 ? MQTT_PUBLISH_TIMEOUT
+                     : revisionChannels != publishedRevision ? MILLIS_BETWEEN_MQTT_STATES : MILLIS_BETWEEN_MQTT_HEALTH;
+  return since >= wait ? 0 : wait - since;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef MQTT__H
+#define MQTT__H
+
+#include <Arduino.h>
+
+// constants
+static const uint8_t LEN_MQTT_HOST = 40; // max length of the name of the broker
+static const uint8_t LEN_MQTT_TOPIC = 32; // max length of the topic prefix
+static const uint8_t LEN_MQTT_USER = 32; // max length of the user name at the broker
+static const uint8_t LEN_MQTT_PASSWORD = 32; // max length of the password at the broker
+static const uint16_t DEFAULT_MQTT_PORT = 1883; // port of the broker without TLS
+static const char DEFAULT_MQTT_TOPIC[] = "reeflight"; // prefix of the topics if none is set
+static const uint32_t MQTT_CLIENT = 0xFFFFFFFF; // client number of the commands received by mqtt, their replies are published
+static const size_t MQTT_BUFFER_SIZE = 1024; // size of the buffer the state is serialized into, larger states are dropped
+static const size_t MAX_MQTT_COMMAND_SIZE = 2048; // larger commands are dropped
+static const unsigned long MILLIS_BETWEEN_MQTT_STATES = 1000; // min time between two states in ms, changes in between are batched
+static const unsigned long MILLIS_BETWEEN_MQTT_HEALTH = 30000; // max time between two states in ms, even without changes
+static const unsigned long MQTT_PUBLISH_TIMEOUT = 10000; // time in ms until an unacknowledged state is given up
+static const unsigned long MIN_MQTT_RECONNECT_MILLIS = 5000; // first wait in ms before the connection is retried
+static const unsigned long MAX_MQTT_RECONNECT_MILLIS = 60000; // the wait is doubled after each failed try up to this
+
+// global variables
+extern char mqttHost[LEN_MQTT_HOST + 1]; // name or IP of the broker, empty if mqtt is off
+extern uint16_t mqttPort; // port of the broker
+extern char mqttTopic[LEN_MQTT_TOPIC + 1]; // prefix of the topics, e.g. "reeflight" for "reeflight/state"
+extern char mqttUser[LEN_MQTT_USER + 1]; // user name at the broker, empty if the broker needs no login
+extern char mqttPassword[LEN_MQTT_PASSWORD + 1]; // password at the broker, stored with the other passwords
+extern uint32_t mqttPublished; // number of published states and replies
+extern uint32_t mqttDropped; // number of states, replies and commands that were dropped
+
+// connects to the broker in "mqttHost", a running connection is only closed if the broker or the login changed
+void startMqtt();
+// returns true if the device is connected to the broker
+bool mqttConnected();
+// handles the reconnect and publishes the state in the main loop
+void handleMqtt();
+// returns the time in ms until "handleMqtt" has work to do
+uint32_t millisUntilMqtt();
+// publishes the reply "reply" to a command received by mqtt
+void publishMqttReply(const String& reply);
+
+#endif
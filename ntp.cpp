@@ -25,6 +25,13 @@ WiFiUDP ntpUDP; // UDP Obeject for polling the NTP data from "NTPServer"
 NTPClient timeClient(ntpUDP); // Object that automatically updates the time from the "NTPServer"
 int8_t timezone; // timezone in full hours from the GMT time
 char NTPServer[40]; // name of the NTP Server
+bool syncedClock = false; // true if the clock follows the clock of the sync leader instead of the NTP Server
+int64_t syncedClockOffset; // offset in ms between millis() and the epoch time of the sync leader
+unsigned long epochAtLastSecond; // epoch time of the "timeClient" at its last full second
+int64_t simulatedEpochMillis = -1; // epoch time in ms of the simulator, -1 if the clock is used
+unsigned long millisAtLastSecond; // millis uptime of the device at the last full second of the "timeClient"
+bool clockSet = false; // true if the clock has been set by "setClock"
+bool ntpAnswered = false; // true after the first answer of the NTP server
 
 
 /*
@@ -45,24 +52,69 @@ void startNTP() {
  * handles the timeClient object in the Main Loop
  * if the time since the last update is greater than "NTP_UPDATE_INTERVAL"
  * a new update is made
+ * the millis uptime at the full seconds of the "timeClient" are tracked, so the
+ * epoch time is also available in ms
+ * "update" returns false until the NTP server has answered, until then a clock set by "setClock" keeps running
  */
 void handleNTP() {
-  timeClient.update();
+  if(timeClient.update()) ntpAnswered = true;
+  if(clockSet && !ntpAnswered) return;
+  unsigned long epoch = timeClient.getEpochTime();
+  if(epoch != epochAtLastSecond) {
+    epochAtLastSecond = epoch;
+    millisAtLastSecond = millis();
+  }
+}
+
+
+/*
+ * Sets the clock to "epochMillis" until the first answer of the NTP server
+ * After a restart the schedule continues at the held time instead of midnight of 1.1.1970.
+ */
+void setClock(const uint64_t epochMillis) {
+  epochAtLastSecond = epochMillis / 1000;
+  millisAtLastSecond = millis() - epochMillis % 1000;
+  clockSet = true;
+}
+
+
+uint32_t millisUntilNextSecond() {
+  return 1000 - (millis() - millisAtLastSecond) % 1000;
 }
 
 
 /*
  * returns the seconds that has passed in the current day
- * it also consideres the "timezone"
+ * it also consideres the "timezone", so the result is always between 0 and 24*60*60-1
  */
 uint32_t getLocalSecondsOfTheDay() {
-  return uint32_t(timeClient.getSeconds()) + uint32_t(60*timeClient.getMinutes()) + uint32_t(3600*timeClient.getHours()) + 60*60*timezone;
+  return (epochTime() + 24*60*60 + 60*60*int32_t(timezone)) % (24*60*60);
+}
+
+/*
+ * returns the days that has passed since 1.1.1970 in the "timezone"
+ * the weekday is (getLocalDay() + 4) % 7 with 0 for sunday
+ */
+uint32_t getLocalDay() {
+  return (epochTime() + 24*60*60 + 60*60*int32_t(timezone)) / (24*60*60) - 1;
 }
 
 /*
  * returns the EPOCH time
  */
 unsigned long epochTime() {
-  return timeClient.getEpochTime();
+  return epochMillis() / 1000;
+}
+
+/*
+ * returns the EPOCH time in ms
+ * if the clock is synced to the sync leader, the clock of the sync leader is used,
+ * otherwise the time of the "timeClient"
+ * while the simulator runs, the simulated time is returned
+ */
+uint64_t epochMillis() {
+  if(simulatedEpochMillis >= 0) return simulatedEpochMillis;
+  if(syncedClock) return uint64_t(int64_t(millis()) + syncedClockOffset);
+  return uint64_t(epochAtLastSecond) * 1000 + (millis() - millisAtLastSecond);
 }
 
@@ -24,14 +24,25 @@ static uint32_t NTP_UPDATE_INTERVAL = 60000; // time between updates from the NT
 // global variables
 extern int8_t timezone; // timezone in full hours from the GMT time
 extern char NTPServer[40]; // name of the NTP Server
+extern bool syncedClock; // true if the clock follows the clock of the sync leader instead of the NTP Server
+extern int64_t simulatedEpochMillis; // epoch time in ms of the simulator, -1 if the clock is used
+extern int64_t syncedClockOffset; // offset in ms between millis() and the epoch time of the sync leader
 
 // starts the NTP updating
 void startNTP();
 // handling function in the main loop
 void handleNTP();
+// sets the clock to "epochMillis" until the first answer of the NTP server, e.g. to the time held across a restart
+void setClock(const uint64_t epochMillis);
+// returns the time in ms until the next second of the clock, "handleNTP" must see each new second on time
+uint32_t millisUntilNextSecond();
 // returns seconds of the day considering the "timezone"
 uint32_t getLocalSecondsOfTheDay();
+// returns the days since 1.1.1970 considering the "timezone"
+uint32_t getLocalDay();
 // returns the epoch time
 unsigned long epochTime();
+// returns the epoch time in ms
+uint64_t epochMillis();
 
 #endif
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "ota.h"
+#include "channel.h"
+#include "settings.h"
+#include "profiles.h"
+#include "storage.h"
+#include "ntp.h"
+#include "debug.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <Updater.h>
+#include <flash_hal.h>
+#include <user_interface.h>
+
+/*
+ * Global variables
+ */
+char otaPassword[LEN_OTA_PASSWORD + 1]; // password of the updates, the updates are refused if it is empty
+AsyncWebServerRequest *otaRequest = NULL; // request of the running update, other uploads are refused meanwhile
+bool otaRunning = false; // true while the image is written
+bool otaSucceeded = false; // true if the last image has been written and verified
+bool otaFileSystem = false; // true if the image is a file system image
+bool otaStorageStopped = false; // true if the storage has been stopped for a file system image
+bool otaRestart = false; // true if the device restarts after "OTA_RESTART_DELAY"
+String otaError; // reason why the last update failed
+unsigned long millisAtOtaStart; // millis uptime at the first chunk
+unsigned long millisAtOtaChunk; // millis uptime at the last chunk, or at the end of the update
+uint32_t otaBytes; // bytes written
+uint32_t otaMaxWriteMillis; // longest time a chunk blocked the main loop in ms
+uint32_t otaStartMissedTicks; // "pwmMissedTicks" at the start
+uint32_t otaSavedMaxLateness; // "pwmMaxLateness" before the update, the max lateness during the update is measured from 0
+
+
+/*
+ * Writes the outputs of the channels and the time to the RTC memory, which keeps its content across a restart
+ */
+void holdOutputs() {
+  HeldOutputs held;
+  held.magic = HOLD_MAGIC;
+  held.numOfChannels = numOfChannels;
+  held.epochMillis = epochMillis();
+  for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) held.outputs[c] = c < numOfChannels ? channels[c].output / 100. * 65535 : 0;
+  ESP.rtcUserMemoryWrite(HOLD_RTC_OFFSET, (uint32_t*)&held, sizeof(held));
+}
+
+
+/*
+ * Sets the values and outputs of the channels and the clock to the ones held before a restart
+ * "configurePWM" then starts the outputs with these values instead of 0, so the light stays on during a restart, with
+ * the PCA9685 without any gap, with the ESP8266 only dark while it boots. The clock runs on from the held time until the
+ * NTP server answers, so the first PWM update continues the schedule. The held outputs are used only once.
+ */
+void restoreOutputs() {
+  HeldOutputs held;
+  // the RTC memory is random after a power on
+  if(ESP.getResetInfoPtr()->reason == REASON_DEFAULT_RST) return;
+  ESP.rtcUserMemoryRead(HOLD_RTC_OFFSET, (uint32_t*)&held, sizeof(held));
+  if(held.magic != HOLD_MAGIC || held.numOfChannels != numOfChannels) return;
+  held.magic = 0;
+  ESP.rtcUserMemoryWrite(HOLD_RTC_OFFSET, &held.magic, sizeof(held.magic));
+
+  DEBUG_INFO("[restoreOutputs] outputs of %u channels restored", held.numOfChannels);
+  for(uint8_t c=0; c<numOfChannels; c++) channels[c].value = channels[c].output = held.outputs[c] / 65535. * 100;
+  // the time spent in the boot loader is not known, the clock is late by it until the NTP server answers
+  setClock(held.epochMillis + millis());
+}
+
+
+/*
+ * Returns true if "request" may update the device
+ * The client must send the user "OTA_USER" and "otaPassword" with http authentication. Without a password the updates
+ * are refused, so a device can not be flashed by anyone in the network before a password is set.
+ */
+static bool otaAuthorized(AsyncWebServerRequest *request) {
+  return otaPassword[0] != 0 && request->authenticate(OTA_USER, otaPassword);
+}
+
+
+/*
+ * Ends the update with "error", the storage is resumed by "handleOta"
+ */
+static void failUpdate(const String& error) {
+  DEBUG_ERROR("[handleUpdateUpload] %s", error.c_str());
+  otaError = error;
+  otaRunning = false;
+  millisAtOtaChunk = millis();
+}
+
+
+/*
+ * Writes a chunk of the uploaded image to the flash, called by the TCP stack
+ * The update class collects the chunks of at most one TCP segment and writes each full sector of the flash, so the main
+ * loop with the PWM updates runs between the chunks and is blocked at most for the erase and write of one sector.
+ * A file system image replaces the settings and profiles, the storage is stopped until they are written again.
+ */
+void handleUpdateUpload(AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final) {
+  if(index == 0) {
+    // the image is not written before the request is authorized, "handleUpdate" answers the request
+    if(otaRunning || !otaAuthorized(request)) return;
+    otaRequest = request;
+    otaFileSystem = request->hasArg("fs");
+    otaSucceeded = false;
+    otaError = "";
+    otaBytes = otaMaxWriteMillis = 0;
+    millisAtOtaStart = millisAtOtaChunk = millis();
+    otaStartMissedTicks = pwmMissedTicks;
+    otaSavedMaxLateness = pwmMaxLateness;
+    pwmMaxLateness = 0;
+    DEBUG_INFO("[handleUpdateUpload] %s image %s", otaFileSystem ? "file system" : "firmware", filename.c_str());
+
+    size_t space;
+    if(otaFileSystem) {
+      space = FS_end - FS_start;
+      stopStorage();
+      otaStorageStopped = true;
+    }
+    else space = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
+    // the update must not yield, it runs in the callback of the TCP stack
+    Update.runAsync(true);
+    otaRunning = true;
+    if(!Update.begin(space, otaFileSystem ? U_FS : U_FLASH)) return failUpdate(Update.getErrorString());
+  }
+  if(request != otaRequest || !otaRunning) return;
+
+  millisAtOtaChunk = millis();
+  if(Update.write(data, len) != len) return failUpdate(Update.getErrorString());
+  uint32_t writeMillis = millis() - millisAtOtaChunk;
+  if(writeMillis > otaMaxWriteMillis) otaMaxWriteMillis = writeMillis;
+  otaBytes += len;
+
+  if(final) {
+    if(!Update.end(true)) return failUpdate(Update.getErrorString());
+    otaSucceeded = true;
+    otaRunning = false;
+    millisAtOtaChunk = millis();
+    DEBUG_INFO("[handleUpdateUpload] %u bytes written in %u ms", otaBytes, millisAtOtaChunk - millisAtOtaStart);
+  }
+}
+
+
+/*
+ * Sends the result of the update as json to the http client, called after the last chunk
+ * The report contains the throughput and how much the PWM updates were delayed by the writes. After a successful
+ * update the device restarts with the outputs held, see "handleOta".
+ */
+void handleUpdate(AsyncWebServerRequest *request) {
+  if(otaPassword[0] == 0) {
+    request->send(403, F("text/plain"), F("no update password set"));
+    return;
+  }
+  if(!otaAuthorized(request)) {
+    request->requestAuthentication();
+    return;
+  }
+  if(otaRequest == NULL) {
+    request->send(400, F("text/plain"), F("no image uploaded"));
+    return;
+  }
+  if(request != otaRequest) {
+    request->send(409, F("text/plain"), F("another update is running"));
+    return;
+  }
+  otaRequest = NULL;
+  // the max lateness of the PWM updates is measured from 0 during the update, the max since the start is kept
+  uint32_t maxLateness = pwmMaxLateness;
+  if(otaSavedMaxLateness > pwmMaxLateness) pwmMaxLateness = otaSavedMaxLateness;
+  if(!otaSucceeded) {
+    request->send(500, F("text/plain"), "update failed, " + otaError);
+    return;
+  }
+
+  uint32_t duration = millisAtOtaChunk - millisAtOtaStart;
+  DynamicJsonBuffer jsonBuffer;
+  JsonObject& jsonOut = jsonBuffer.createObject();
+  // firmware or file system
+  jsonOut[CHAR_OTA_TARGET] = otaFileSystem ? "fs" : "firmware";
+  // size of the image and duration of the upload
+  jsonOut[CHAR_OTA_BYTES] = otaBytes;
+  jsonOut[CHAR_OTA_MILLIS] = duration;
+  jsonOut[CHAR_OTA_KBPS] = duration ? otaBytes / 1.024 / duration : 0;
+  // longest time a chunk blocked the main loop in ms
+  jsonOut[CHAR_OTA_MAX_WRITE_MILLIS] = otaMaxWriteMillis;
+  // missed PWM updates and the max lateness of the PWM updates in ms during the upload
+  jsonOut[CHAR_METRICS_PWM_MISSED_TICKS] = pwmMissedTicks - otaStartMissedTicks;
+  jsonOut[CHAR_METRICS_PWM_MAX_LATENESS] = maxLateness;
+
+  String jsonOutStr;
+  jsonOut.printTo(jsonOutStr);
+  request->send(200, F("application/json"), jsonOutStr);
+  otaRestart = true;
+}
+
+
+/*
+ * Handles the end of an update in the main loop
+ * An upload without a chunk for "OTA_TIMEOUT" is aborted. After a file system image the storage is mounted again and
+ * the settings and profiles are written to it, also if the image could not be written. After a successful update the
+ * outputs are held and the device restarts, the new firmware is copied by the boot loader.
+ */
+void handleOta() {
+  if(otaRunning) {
+    if(millis() - millisAtOtaChunk < OTA_TIMEOUT) return;
+    Update.end();
+    failUpdate(F("upload timed out"));
+    otaRequest = NULL;
+    if(otaSavedMaxLateness > pwmMaxLateness) pwmMaxLateness = otaSavedMaxLateness;
+  }
+  if(!otaStorageStopped && !otaRestart) return;
+  if(millis() - millisAtOtaChunk < OTA_RESTART_DELAY) return;
+
+  if(otaStorageStopped) {
+    resumeStorage();
+    saveSettings();
+    saveProfiles();
+    saveSecrets();
+    otaStorageStopped = false;
+  }
+  if(otaRestart) {
+    DEBUG_INFO("[handleOta] restart");
+    holdOutputs();
+    ESP.restart();
+  }
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef OTA__H
+#define OTA__H
+
+#include <Arduino.h>
+#include "channel.h"
+#include <ESPAsyncWebServer.h>
+
+// constants
+static const uint32_t HOLD_RTC_OFFSET = 96; // first block (4 bytes) of the held outputs in the RTC user memory, after the dump of the watchdog
+static const uint32_t HOLD_MAGIC = 0x524C4844; // marks valid held outputs in the RTC memory
+static const unsigned long OTA_RESTART_DELAY = 1000; // time in ms between the reply to the update and the restart
+static const unsigned long OTA_TIMEOUT = 10000; // time in ms without a chunk until an update is aborted
+static const uint8_t LEN_OTA_PASSWORD = 32; // max length of the password of the updates
+static const char OTA_USER[] = "admin"; // user name of the http authentication of the updates
+
+// outputs and time held across a restart in the RTC memory
+struct HeldOutputs {
+  uint32_t magic; // HOLD_MAGIC if the outputs are valid
+  uint32_t numOfChannels; // number of channels at the restart
+  uint64_t epochMillis; // epoch time in ms at the restart
+  uint16_t outputs[MAX_NUM_OF_CHANNELS]; // output of each channel in 1/65535
+};
+
+// global variables
+extern char otaPassword[LEN_OTA_PASSWORD + 1]; // password of the updates, the updates are refused if it is empty
+
+// writes the outputs and the time to the RTC memory before a restart
+void holdOutputs();
+// sets the outputs and the clock to the values held before a restart, call before "configurePWM"
+void restoreOutputs();
+// writes a chunk of an uploaded firmware image, or with the argument "fs" of a file system image, to the flash
+void handleUpdateUpload(AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final);
+// sends the result of the update as json to the http client, the device restarts afterwards
+void handleUpdate(AsyncWebServerRequest *request);
+// restarts the device after an update and aborts a stalled upload in the main loop
+void handleOta();
+
+#endif
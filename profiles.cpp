@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "profiles.h"
+#include "channel.h"
+#include "settings.h"
+#include "debug.h"
+#include "ntp.h"
+#include "storage.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/*
+ * Global variables
+ */
+uint8_t numOfProfiles; // current number of profiles
+Profile profiles[MAX_NUM_OF_PROFILES]; // array storing all profiles
+int8_t weekProfiles[7] = {DEFAULT_PROFILE, DEFAULT_PROFILE, DEFAULT_PROFILE, DEFAULT_PROFILE, DEFAULT_PROFILE, DEFAULT_PROFILE, DEFAULT_PROFILE}; // profile of each weekday, 0 is sunday
+uint8_t numOfDateOverrides; // current number of dates with their own profile
+DateOverride dateOverrides[MAX_NUM_OF_DATE_OVERRIDES]; // dates with their own profile
+uint16_t acclimationStart; // local day the acclimation starts, 0 means no acclimation
+uint8_t acclimationWeeks; // number of weeks until the full values of the schedule are reached
+uint8_t acclimationPercent; // values of the schedule in % on the first day of the acclimation
+int8_t activeProfile = DEFAULT_PROFILE; // profile of the current day
+float acclimationFactor = 1; // factor of the values of the schedule on the current day
+uint32_t resolvedDay; // local day the profiles were resolved for
+unsigned long millisAtLastProfileCheck; // millis uptime of the device at the last check for a new day
+
+
+/*
+ * Constructor, Destructor
+ */
+Profile::Profile() {}
+Profile::~Profile() {}
+
+
+/*
+ * Sorts the entries of channel c by time, the segments are computed from sorted entries
+ */
+void Profile::sortEntries(const uint8_t c) {
+  if(numOfEntries[c] > MAX_NUM_OF_ENTRIES) numOfEntries[c] = MAX_NUM_OF_ENTRIES;
+  for(uint8_t i=1; i<numOfEntries[c]; i++) {
+    ProfileEntry e = entries[c][i];
+    uint8_t j = i;
+    for(; j>0 && entries[c][j-1].minute>e.minute; j--) entries[c][j] = entries[c][j-1];
+    entries[c][j] = e;
+  }
+}
+
+
+/*
+ * Returns true if "p" is a stored profile with entries in at least one channel
+ */
+bool profileHasEntries(const int8_t p) {
+  if(p < 0 || p >= numOfProfiles) return false;
+  for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
+    if(profiles[p].numOfEntries[c] > 0) return true;
+  }
+  return false;
+}
+
+
+/*
+ * Returns the profile of the local day "day"
+ * a date override has priority over the profile of the weekday
+ * a profile that does not exist or has no entries falls back to the schedule of the channels ("DEFAULT_PROFILE")
+ */
+int8_t profileOfDay(const uint32_t day) {
+  int8_t p = weekProfiles[(day + 4) % 7];
+  for(uint8_t i=0; i<numOfDateOverrides; i++) {
+    if(dateOverrides[i].day == day) {
+      p = dateOverrides[i].profile;
+      break;
+    }
+  }
+  return profileHasEntries(p) ? p : DEFAULT_PROFILE;
+}
+
+
+/*
+ * Returns the factor of the values of the schedule on the local day "day"
+ * During the acclimation the values rise linear from "acclimationPercent" on the first day
+ * to the full values after "acclimationWeeks"
+ */
+float acclimationFactorOfDay(const uint32_t day) {
+  if(acclimationStart == 0 || acclimationWeeks == 0 || day < acclimationStart) return 1;
+  uint32_t days = day - acclimationStart;
+  uint32_t totalDays = 7 * uint32_t(acclimationWeeks);
+  if(days >= totalDays) return 1;
+  return (acclimationPercent + (100. - acclimationPercent) * days / totalDays) / 100.;
+}
+
+
+/*
+ * Resolves the profile and the acclimation of the current day and computes the segments of all channels
+ * This is done only at midnight and if the profiles or the schedule have changed, so the PWM updates
+ * evaluate the segments exactly like a single daily schedule
+ */
+void resolveProfiles() {
+  resolvedDay = getLocalDay();
+  activeProfile = profileOfDay(resolvedDay);
+  if(activeProfile < 0 || activeProfile >= numOfProfiles) activeProfile = DEFAULT_PROFILE;
+  acclimationFactor = acclimationFactorOfDay(resolvedDay);
+  DEBUG_INFO("[resolveProfiles] day: %d, profile: %d, acclimation factor: %f", resolvedDay, activeProfile, acclimationFactor);
+
+  for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
+    // a channel without entries in the profile keeps its schedule, so it does not hold a stale value
+    if(activeProfile == DEFAULT_PROFILE || profiles[activeProfile].numOfEntries[c] == 0) {
+      channels[c].computeSegments(channels[c].t, channels[c].v, channels[c].numOfEntries, acclimationFactor);
+      continue;
+    }
+    const Profile &p = profiles[activeProfile];
+    uint32_t t[MAX_NUM_OF_ENTRIES];
+    float v[MAX_NUM_OF_ENTRIES];
+    for(uint8_t i=0; i<p.numOfEntries[c]; i++) {
+      t[i] = uint32_t(p.entries[c][i].minute) * 60;
+      v[i] = p.entries[c][i].value / 100.;
+    }
+    channels[c].computeSegments(t, v, p.numOfEntries[c], acclimationFactor);
+  }
+}
+
+
+/*
+ * Handles the profiles in the main loop
+ * every "MILLIS_BETWEEN_PROFILE_CHECKS" it is checked if a new day has started
+ */
+void handleProfiles() {
+  if(millis() - millisAtLastProfileCheck < MILLIS_BETWEEN_PROFILE_CHECKS) return;
+  millisAtLastProfileCheck = millis();
+  if(getLocalDay() != resolvedDay) resolveProfiles();
+}
+
+
+
+uint32_t millisUntilProfileCheck() {
+  unsigned long passed = millis() - millisAtLastProfileCheck;
+  return passed >= MILLIS_BETWEEN_PROFILE_CHECKS ? 0 : MILLIS_BETWEEN_PROFILE_CHECKS - passed;
+}
+
+/*
+ * saves the profiles to the file "PROFILES_FILE_NAME" in the flash
+ * the entries are stored as minutes and 0.01%, so the file stays small
+ */
+bool saveProfiles() {
+  DEBUG_INFO("[saveProfiles]");
+  // the profiles in memory changed, even if the file can not be written
+  revisionProfiles++;
+
+  // main json object
+  DynamicJsonBuffer jsonBuffer(MAX_JSON_SIZE);
+  JsonObject& json = jsonBuffer.createObject();
+
+  // profiles
+  JsonArray& jsonProfiles = json.createNestedArray(CHAR_PROFILES);
+  for(uint8_t p=0; p<numOfProfiles; p++) {
+    JsonObject& jsonProfilesProfile = jsonProfiles.createNestedObject();
+    // profile name
+    jsonProfilesProfile[CHAR_PROFILE_NAME] = jsonBuffer.strdup(profiles[p].name);
+    // channels
+    JsonArray& jsonChannels = jsonProfilesProfile.createNestedArray(CHAR_CHANNELS);
+    for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
+      JsonObject& jsonChannelsChannel = jsonChannels.createNestedObject();
+      // times array
+      JsonArray& jsonChannelsChannelT = jsonChannelsChannel.createNestedArray(CHAR_CHANNEL_TIMES);
+      // values array
+      JsonArray& jsonChannelsChannelV = jsonChannelsChannel.createNestedArray(CHAR_CHANNEL_VALUES);
+      for(uint8_t i=0; i<profiles[p].numOfEntries[c]; i++) {
+        jsonChannelsChannelT.add(profiles[p].entries[c][i].minute);
+        jsonChannelsChannelV.add(profiles[p].entries[c][i].value);
+      }
+    }
+  }
+  // week profiles
+  JsonArray& jsonWeek = json.createNestedArray(CHAR_WEEK_PROFILES);
+  for(uint8_t d=0; d<7; d++) jsonWeek.add(weekProfiles[d]);
+  // date overrides
+  JsonArray& jsonDates = json.createNestedArray(CHAR_DATE_OVERRIDES);
+  for(uint8_t i=0; i<numOfDateOverrides; i++) {
+    JsonObject& jsonDatesDate = jsonDates.createNestedObject();
+    jsonDatesDate[CHAR_DATE] = dateOverrides[i].day;
+    jsonDatesDate[CHAR_PROFILE] = dateOverrides[i].profile;
+  }
+  // acclimation
+  json[CHAR_ACCLIMATION_START] = acclimationStart;
+  json[CHAR_ACCLIMATION_WEEKS] = acclimationWeeks;
+  json[CHAR_ACCLIMATION_PERCENT] = acclimationPercent;
+
+  if(json.measureLength()+1 > MAX_JSON_SIZE) {
+    DEBUG_WARNING("[saveProfiles] json size too large");
+    return false;
+  }
+
+  String content;
+  json.printTo(content);
+  if(!writeFile(PROFILES_FILE_NAME, content)) return false;
+  return true;
+}
+
+
+/*
+ * loads the profiles from the file "PROFILES_FILE_NAME" in the flash
+ * if there is no file, there are no profiles and the schedule of the channels is used every day
+ */
+bool loadProfiles() {
+  DEBUG_INFO("[loadProfiles]");
+  revisionProfiles++;
+  numOfProfiles = 0;
+  for(uint8_t d=0; d<7; d++) weekProfiles[d] = DEFAULT_PROFILE;
+  numOfDateOverrides = 0;
+  acclimationStart = 0;
+
+  // try to read file
+  String content;
+  if (!readFile(PROFILES_FILE_NAME, content)) {
+    DEBUG_INFO("[loadProfiles] no profiles file found");
+    return false;
+  }
+
+  // check filesize
+  if (content.length() > MAX_JSON_SIZE) {
+    DEBUG_WARNING("[loadProfiles] profiles file size is too large");
+    return false;
+  }
+
+  // the json is parsed in place, so "content" is a copy of the cached file
+  DynamicJsonBuffer jsonBuffer(MAX_JSON_SIZE);
+  JsonObject& json = jsonBuffer.parseObject(content.begin());
+
+  // check json parsing
+  if (!json.success()) {
+    DEBUG_WARNING("[loadProfiles] json parsing failed");
+    return false;
+  }
+
+  // profiles
+  numOfProfiles = json[CHAR_PROFILES].size();
+  if(numOfProfiles > MAX_NUM_OF_PROFILES) numOfProfiles = MAX_NUM_OF_PROFILES;
+  for(uint8_t p=0; p<numOfProfiles; p++) {
+    // profile name
+    strlcpy(profiles[p].name, json[CHAR_PROFILES][p][CHAR_PROFILE_NAME] | "", sizeof(profiles[p].name));
+    // channels
+    for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
+      profiles[p].numOfEntries[c] = json[CHAR_PROFILES][p][CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES].size();
+      if(profiles[p].numOfEntries[c] > MAX_NUM_OF_ENTRIES) profiles[p].numOfEntries[c] = MAX_NUM_OF_ENTRIES;
+      for(uint8_t i=0; i<profiles[p].numOfEntries[c]; i++) {
+        profiles[p].entries[c][i].minute = json[CHAR_PROFILES][p][CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES][i];
+        profiles[p].entries[c][i].value = json[CHAR_PROFILES][p][CHAR_CHANNELS][c][CHAR_CHANNEL_VALUES][i];
+      }
+      profiles[p].sortEntries(c);
+    }
+  }
+  // week profiles
+  for(uint8_t d=0; d<7; d++) weekProfiles[d] = json[CHAR_WEEK_PROFILES][d] | DEFAULT_PROFILE;
+  // date overrides
+  numOfDateOverrides = json[CHAR_DATE_OVERRIDES].size();
+  if(numOfDateOverrides > MAX_NUM_OF_DATE_OVERRIDES) numOfDateOverrides = MAX_NUM_OF_DATE_OVERRIDES;
+  for(uint8_t i=0; i<numOfDateOverrides; i++) {
+    dateOverrides[i].day = json[CHAR_DATE_OVERRIDES][i][CHAR_DATE];
+    dateOverrides[i].profile = json[CHAR_DATE_OVERRIDES][i][CHAR_PROFILE];
+  }
+  // acclimation
+  acclimationStart = json[CHAR_ACCLIMATION_START];
+  acclimationWeeks = json[CHAR_ACCLIMATION_WEEKS];
+  acclimationPercent = json[CHAR_ACCLIMATION_PERCENT];
+  return true;
+}
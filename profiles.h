@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef PROFILES__H
+#define PROFILES__H
+
+#include <Arduino.h>
+#include "channel.h"
+
+// constants
+static const uint8_t LEN_PROFILE_NAME = 20; // max length of the profile name
+static const uint8_t MAX_NUM_OF_PROFILES = 4; // max number of profiles
+static const uint8_t MAX_NUM_OF_DATE_OVERRIDES = 8; // max number of dates with their own profile
+static const int8_t DEFAULT_PROFILE = -1; // the schedule of the channels is used
+static const unsigned long MILLIS_BETWEEN_PROFILE_CHECKS = 1000; // time between the checks for a new day in ms
+
+// entry (time-value pair) of a profile, stored compactly
+struct ProfileEntry {
+  uint16_t minute; // minute of the day
+  uint16_t value; // value in 0.01%
+};
+
+// Class defining the profile objects, a profile replaces the schedule of all channels on certain days
+class Profile {
+
+  public:
+    // name of the profile
+    char name[LEN_PROFILE_NAME + 1];
+
+    // number of entries of each channel
+    uint8_t numOfEntries[MAX_NUM_OF_CHANNELS];
+
+    // entries of each channel sorted by time
+    ProfileEntry entries[MAX_NUM_OF_CHANNELS][MAX_NUM_OF_ENTRIES];
+
+    // constructor
+    Profile();
+    // destructor
+    ~Profile();
+
+    // sorts the entries of channel c by time
+    void sortEntries(const uint8_t c);
+};
+
+// date with its own profile
+struct DateOverride {
+  uint16_t day; // local days since 1.1.1970
+  int8_t profile; // profile of the day, DEFAULT_PROFILE for the schedule of the channels
+};
+
+
+// global variables
+extern uint8_t numOfProfiles; // current number of profiles
+extern Profile profiles[MAX_NUM_OF_PROFILES]; // array with all possible profiles
+extern int8_t weekProfiles[7]; // profile of each weekday, 0 is sunday
+extern uint8_t numOfDateOverrides; // current number of dates with their own profile
+extern DateOverride dateOverrides[MAX_NUM_OF_DATE_OVERRIDES]; // dates with their own profile
+extern uint16_t acclimationStart; // local day the acclimation starts, 0 means no acclimation
+extern uint8_t acclimationWeeks; // number of weeks until the full values of the schedule are reached
+extern uint8_t acclimationPercent; // values of the schedule in % on the first day of the acclimation
+extern int8_t activeProfile; // profile of the current day
+extern float acclimationFactor; // factor of the values of the schedule on the current day
+
+// loads the profiles from the file "PROFILES_FILE_NAME", returns false if there are no profiles
+bool loadProfiles();
+
+// saves the profiles to the file "PROFILES_FILE_NAME"
+bool saveProfiles();
+
+// computes the segments of all channels with the profile and acclimation of the current day
+void resolveProfiles();
+
+// resolves the profiles at midnight in the main loop
+void handleProfiles();
+// returns the time in ms until the next check for a new day
+uint32_t millisUntilProfileCheck();
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "pwm.h"
+#include "debug.h"
+#include <Arduino.h>
+#include <Wire.h>
+#include <Adafruit_PWMServoDriver.h>
+
+/*
+ * Global variables
+ */
+Adafruit_PWMServoDriver PCA9685Shield = Adafruit_PWMServoDriver(PCA9685_ADDRESS); // Object representing the PCA9685 PWM Module
+PWMOutput pwmOutput = makePWMOutput<ESP8266PWMDriver>(); // functions of the driver selected by "PWMGenerator"
+uint16_t ESP8266PWMDriver::duty[MAX_NUM_OF_CHANNELS]; // duty cycles set by "write"
+bool ESP8266PWMDriver::changed; // true if a duty cycle has changed since the last "commit"
+uint32_t ESP8266PWMDriver::periodCycles; // length of the PWM period in cpu cycles
+bool ESP8266PWMDriver::openDrain; // output mode of the last "begin"
+#ifdef PWM_PHASE_ESP8266
+uint8_t ESP8266PWMDriver::writtenPin[MAX_NUM_OF_CHANNELS]; // pin of the last waveform of each channel, set to NO_PIN by "begin"
+uint32_t ESP8266PWMDriver::writtenHigh[MAX_NUM_OF_CHANNELS]; // high time of the last waveform in cpu cycles
+uint32_t ESP8266PWMDriver::writtenPhase[MAX_NUM_OF_CHANNELS]; // phase offset of the last waveform in cpu cycles
+int8_t ESP8266PWMDriver::writtenReference[MAX_NUM_OF_CHANNELS]; // pin the phase of the last waveform refers to
+#endif
+uint16_t PCA9685PWMDriver::duty[MAX_NUM_OF_CHANNELS]; // duty cycles (0..4095) set by "write"
+uint16_t PCA9685PWMDriver::on[MAX_NUM_OF_CHANNELS]; // on counts written to the module
+uint16_t PCA9685PWMDriver::off[MAX_NUM_OF_CHANNELS]; // off counts written to the module
+bool PCA9685PWMDriver::changed; // true if a duty cycle has changed since the last "commit"
+bool PCA9685PWMDriver::openDrain; // output mode of the last "begin", used to initialize the module again
+uint32_t PCA9685PWMDriver::frequency; // PWM frequency of the last "setFrequency" in Hz
+uint8_t PCA9685PWMDriver::checked; // channel of the last "check"
+unsigned long PCA9685PWMDriver::millisAtRestart; // millis uptime of the last "restart"
+uint16_t RecordingPWMDriver::duty[MAX_NUM_OF_CHANNELS]; // last duty cycle written to each channel
+uint32_t RecordingPWMDriver::writes; // number of writes since "begin"
+uint32_t RecordingPWMDriver::frequency; // last frequency in Hz
+uint32_t i2cClock = 0; // clock of the I2C bus in Hz selected by "probeI2CClock", 0 if no PCA9685 answered
+uint32_t pwmCheckErrors = 0; // number of channels that were read back with wrong registers and corrected
+uint32_t i2cRecoveries = 0; // number of times the I2C bus was freed and the PCA9685 initialized again
+
+
+/*
+ * Selects the driver for "generator"
+ * This is the only place where the drivers are distinguished at runtime
+ */
+void selectPWMOutput(const uint16_t generator, const bool inverted) {
+  switch(generator) {
+    case PWM_GENERATOR_PCA9685:
+      DEBUG_INFO("[selectPWMOutput] pwm generated by PCA9685, inverted: %d", inverted);
+      pwmOutput = inverted ? makePWMOutput<InvertedPWMDriver<PCA9685PWMDriver>>() : makePWMOutput<PCA9685PWMDriver>();
+      break;
+    case PWM_GENERATOR_RECORDING:
+      DEBUG_INFO("[selectPWMOutput] pwm recorded only, inverted: %d", inverted);
+      pwmOutput = inverted ? makePWMOutput<InvertedPWMDriver<RecordingPWMDriver>>() : makePWMOutput<RecordingPWMDriver>();
+      break;
+    default:
+      DEBUG_INFO("[selectPWMOutput] pwm generated by ESP8266, inverted: %d", inverted);
+      pwmOutput = inverted ? makePWMOutput<InvertedPWMDriver<ESP8266PWMDriver>>() : makePWMOutput<ESP8266PWMDriver>();
+      break;
+  }
+}
+
+
+/*
+ * Computes the on and off counts of the 4096 counts of the PCA9685 period
+ * Each channel switches on at the count where the previous channel switches off, so the pulses are placed
+ * one after the other and wrap around at the end of the period.
+ * Only the channels with changed counts are written to the module, a channel that is completely off or on
+ * is written with the full off or full on bit of the PCA9685.
+ */
+void PCA9685PWMDriver::staggerPCA9685PWM() {
+  changed = false;
+  uint16_t phase = 0;
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    uint16_t onCount, offCount;
+    if(duty[c] == 0) {
+      onCount = 0;
+      offCount = 4096;
+    }
+    else if(duty[c] >= 4095) {
+      onCount = 4096;
+      offCount = 0;
+    }
+    else {
+      onCount = phase;
+      offCount = (phase + duty[c]) & 4095;
+      phase = offCount;
+    }
+    if(onCount != on[c] || offCount != off[c]) {
+      PCA9685Shield.setPWM(c, onCount, offCount);
+      on[c] = onCount;
+      off[c] = offCount;
+    }
+  }
+}
+
+
+/*
+ * Reads "len" registers of the PCA9685 from register "reg" on, returns false if the module does not answer
+ */
+static bool readPCA9685(const uint8_t reg, uint8_t *buf, const uint8_t len) {
+  Wire.beginTransmission(PCA9685_ADDRESS);
+  Wire.write(reg);
+  if(Wire.endTransmission(false) != 0) return false;
+  if(Wire.requestFrom(PCA9685_ADDRESS, len) != len) return false;
+  for(uint8_t i=0; i<len; i++) buf[i] = Wire.read();
+  return true;
+}
+
+
+/*
+ * Writes the 4 registers of channel "c" of the PCA9685, returns false if the module does not answer
+ */
+static bool writePCA9685(const uint8_t c, const uint8_t *buf) {
+  Wire.beginTransmission(PCA9685_ADDRESS);
+  Wire.write(PCA9685_REG_LED0 + 4*c);
+  Wire.write(buf, 4);
+  return Wire.endTransmission() == 0;
+}
+
+
+/*
+ * Frees the I2C bus if a device holds SDA low, e.g. after a glitch in the middle of a transfer
+ * SCL is clocked up to 9 times until the device has shifted out its byte and releases SDA, then a stop condition
+ * ends the transfer. Returns true if SDA is high afterwards.
+ */
+static bool recoverI2CBus() {
+  pinMode(SDA, INPUT_PULLUP);
+  pinMode(SCL, OUTPUT_OPEN_DRAIN);
+  digitalWrite(SCL, HIGH);
+  for(uint8_t i=0; i<9 && digitalRead(SDA) == LOW; i++) {
+    digitalWrite(SCL, LOW);
+    delayMicroseconds(5);
+    digitalWrite(SCL, HIGH);
+    delayMicroseconds(5);
+  }
+  // stop condition: SDA rises while SCL is high
+  pinMode(SDA, OUTPUT_OPEN_DRAIN);
+  digitalWrite(SCL, LOW);
+  delayMicroseconds(5);
+  digitalWrite(SDA, LOW);
+  delayMicroseconds(5);
+  digitalWrite(SCL, HIGH);
+  delayMicroseconds(5);
+  digitalWrite(SDA, HIGH);
+  delayMicroseconds(5);
+  pinMode(SDA, INPUT_PULLUP);
+  pinMode(SCL, INPUT_PULLUP);
+  return digitalRead(SDA) == HIGH;
+}
+
+
+/*
+ * Selects the fastest of "I2C_CLOCKS" at which the PCA9685 reads back "I2C_PROBES" patterns correctly
+ * The patterns are written to the registers of the unused "PCA9685_PROBE_CHANNEL" with the full off bit set, so its
+ * output stays off. Long wires or weak pull-ups round the edges, then a slower clock is used.
+ */
+void PCA9685PWMDriver::probeI2CClock() {
+  i2cClock = 0;
+  for(uint8_t k=0; k<sizeof(I2C_CLOCKS)/sizeof(I2C_CLOCKS[0]) && i2cClock == 0; k++) {
+    Wire.setClock(I2C_CLOCKS[k]);
+    bool ok = true;
+    for(uint8_t p=0; p<I2C_PROBES && ok; p++) {
+      uint8_t pattern[4] = {uint8_t(0x55 << (p & 1)), uint8_t(p & 0x0F), uint8_t(0xAA >> (p & 1)), uint8_t(0x10 | (~p & 0x0F))};
+      uint8_t read[4];
+      ok = writePCA9685(PCA9685_PROBE_CHANNEL, pattern) && readPCA9685(PCA9685_REG_LED0 + 4*PCA9685_PROBE_CHANNEL, read, 4) && memcmp(pattern, read, 4) == 0;
+    }
+    if(ok) i2cClock = I2C_CLOCKS[k];
+  }
+  const uint8_t fullOff[4] = {0, 0, 0, 0x10};
+  if(i2cClock == 0) {
+    // no answer at any clock, the writes are tried at the slowest one
+    Wire.setClock(I2C_CLOCKS[sizeof(I2C_CLOCKS)/sizeof(I2C_CLOCKS[0]) - 1]);
+    DEBUG_ERROR("[probeI2CClock] PCA9685 does not answer");
+  }
+  else DEBUG_INFO("[probeI2CClock] I2C clock: %u Hz", i2cClock);
+  writePCA9685(PCA9685_PROBE_CHANNEL, fullOff);
+}
+
+
+/*
+ * Frees the I2C bus and initializes the PCA9685 again with the last output mode, frequency and duty cycles
+ */
+void PCA9685PWMDriver::restart() {
+  bool freed = recoverI2CBus();
+  i2cRecoveries++;
+  millisAtRestart = millis();
+  DEBUG_WARNING("[PCA9685PWMDriver] I2C bus recovered, SDA released: %d", freed);
+  begin(openDrain);
+  setFrequency(frequency);
+  commit();
+}
+
+
+/*
+ * Reads back the registers of the next channel and corrects them if the module lost them, e.g. by a glitch on the bus
+ * Once per round the mode register is read, a PCA9685 that has been reset by a brown-out sleeps and is initialized
+ * again. If the module does not answer, the bus is freed and the module initialized again, while it does not answer at
+ * all only every "PCA9685_RETRY_MILLIS". A check takes about 0.2 ms at 400 kHz, one channel is checked at a time so the
+ * main loop is never held up.
+ */
+void PCA9685PWMDriver::check() {
+  if(numOfChannels == 0) return;
+  if(i2cClock == 0) {
+    if(millis() - millisAtRestart >= PCA9685_RETRY_MILLIS) restart();
+    return;
+  }
+  checked = (checked + 1) % numOfChannels;
+  uint8_t read[4];
+  if(checked == 0) {
+    if(!readPCA9685(PCA9685_REG_MODE1, read, 1)) return restart();
+    if((read[0] & PCA9685_REG_MODE1_SLEEP) || !(read[0] & PCA9685_REG_MODE1_AI)) {
+      DEBUG_WARNING("[PCA9685PWMDriver] mode 0x%02x, PCA9685 has been reset", read[0]);
+      pwmCheckErrors++;
+      return restart();
+    }
+  }
+  // not written yet
+  if(on[checked] == 0xFFFF) return;
+  if(!readPCA9685(PCA9685_REG_LED0 + 4*checked, read, 4)) return restart();
+  uint16_t readOn = read[0] | read[1] << 8;
+  uint16_t readOff = read[2] | read[3] << 8;
+  if(readOn != on[checked] || readOff != off[checked]) {
+    DEBUG_WARNING("[PCA9685PWMDriver] channel %u: %u/%u instead of %u/%u", checked, readOn, readOff, on[checked], off[checked]);
+    pwmCheckErrors++;
+    PCA9685Shield.setPWM(checked, on[checked], off[checked]);
+  }
+}
+
+
+/*
+ * Starts the waveforms of the ESP8266 with the same staggering as the PCA9685
+ * The phase of each channel is given as offset to the first channel that is not completely off or on
+ */
+void ESP8266PWMDriver::staggerESP8266PWM() {
+#ifdef PWM_PHASE_ESP8266
+  changed = false;
+  uint32_t phase = 0;
+  int8_t reference = -1;
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    uint8_t pin = channels[c].pin;
+    uint32_t high = uint64_t(periodCycles) * duty[c] / 65535;
+    // a channel on a new pin is written in any case
+    bool newPin = pin != writtenPin[c];
+    writtenPin[c] = pin;
+    if(high == 0 || high >= periodCycles) {
+      if(newPin || writtenHigh[c] != high) {
+        stopWaveform(pin);
+        digitalWrite(pin, high ? HIGH : LOW);
+        writtenHigh[c] = high;
+      }
+      continue;
+    }
+    if(newPin || high != writtenHigh[c] || phase != writtenPhase[c] || reference != writtenReference[c]) {
+      startWaveformClockCycles(pin, high, periodCycles - high, 0, reference, phase, false);
+      // starting a waveform switches the pin to push pull
+      if(openDrain) pinMode(pin, OUTPUT_OPEN_DRAIN);
+      writtenHigh[c] = high;
+      writtenPhase[c] = phase;
+      writtenReference[c] = reference;
+    }
+    if(reference < 0) reference = pin;
+    phase = (phase + high) % periodCycles;
+  }
+#endif
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef PWM__H
+#define PWM__H
+
+#include "channel.h"
+#include <Arduino.h>
+#include <core_version.h>
+#include <Adafruit_PWMServoDriver.h>
+
+// the waveform generator of the ESP8266 core 3.x can start a PWM signal with a phase offset to another pin
+#if defined(ARDUINO_ESP8266_MAJOR) && ARDUINO_ESP8266_MAJOR >= 3
+  #define PWM_PHASE_ESP8266
+  #include <core_esp8266_waveform.h>
+#endif
+
+// constants
+static const uint8_t NO_PIN = 0xFF; // no pin is assigned
+static const uint8_t PCA9685_ADDRESS = 0x40; // I2C address of the PCA9685
+static const uint8_t PCA9685_REG_MODE1 = 0x00; // mode register 1 of the PCA9685
+static const uint8_t PCA9685_REG_MODE1_SLEEP = 0x10; // oscillator off, set after a power on of the PCA9685
+static const uint8_t PCA9685_REG_MODE1_AI = 0x20; // register auto increment
+static const uint8_t PCA9685_REG_LED0 = 0x06; // first of the 4 registers of channel 0, the next channels follow every 4 registers
+static const uint8_t PCA9685_PROBE_CHANNEL = 15; // unused channel of the PCA9685, its registers are used to probe the I2C clock
+static const uint32_t I2C_CLOCKS[] = {1000000, 400000, 100000}; // I2C clocks in Hz, the fastest that reads back correctly is used
+static const uint8_t I2C_PROBES = 8; // number of patterns written and read back for each I2C clock
+static const unsigned long PCA9685_RETRY_MILLIS = 10000; // time between two tries to initialize a PCA9685 that does not answer
+
+/*
+ * PWM output drivers
+ * A driver is a class with static functions only, so the functions of the driver are resolved at compile time
+ * and the loops writing the duty cycles of all channels compile to direct analogWrite or I2C calls.
+ * Every driver provides
+ *   begin(openDrain): configures the outputs
+ *   setFrequency(f): sets the PWM frequency in Hz
+ *   write(c, pin, duty): sets the duty cycle (0..65535) of channel c on pin "pin"
+ *   commit(): outputs the duty cycles set by "write" if the driver does not output them directly
+ *   check(): reads back the next channel from the PWM generator and corrects it, called in the idle time of the main loop
+ * The driver selected by "PWMGenerator" is instantiated once for all functions in "pwmOutput", so there is
+ * only one indirect call for each PWM update instead of a switch for every channel.
+ */
+
+extern Adafruit_PWMServoDriver PCA9685Shield; // Object representing the PCA9685 PWM Module
+
+/*
+ * Phase staggering
+ * If all channels switch on at the start of the PWM period, the current of all LED drivers rises at the same time.
+ * The drivers with phase staggering place the pulses of the channels one after the other in the period, each
+ * channel switches on when the previous one switches off. So the number of channels that are on at the same
+ * time is as low as possible. The offsets depend on the duty cycles, so the duty cycles are collected by "write"
+ * and the offsets are recomputed by "commit" only if a duty cycle has changed.
+ */
+
+// PWM generated by the ESP8266 with a resolution of 10 bit, phase staggered with the ESP8266 core 3.x
+struct ESP8266PWMDriver {
+  static uint16_t duty[MAX_NUM_OF_CHANNELS]; // duty cycles set by "write"
+  static bool changed; // true if a duty cycle has changed since the last "commit"
+  static uint32_t periodCycles; // length of the PWM period in cpu cycles
+  static bool openDrain; // output mode of the last "begin", set again after the core switched a pin to push pull
+#ifdef PWM_PHASE_ESP8266
+  static uint8_t writtenPin[MAX_NUM_OF_CHANNELS]; // pin of the last waveform of each channel, NO_PIN after "begin"
+  static uint32_t writtenHigh[MAX_NUM_OF_CHANNELS]; // high time of the last waveform in cpu cycles
+  static uint32_t writtenPhase[MAX_NUM_OF_CHANNELS]; // phase offset of the last waveform in cpu cycles
+  static int8_t writtenReference[MAX_NUM_OF_CHANNELS]; // pin the phase of the last waveform refers to
+#endif
+  static void begin(const bool openDrain_) {
+    openDrain = openDrain_;
+#ifdef PWM_PHASE_ESP8266
+    // without the phase locked mode the core ignores the phase offset of the waveforms
+    enablePhaseLockedWaveform();
+    // the waveforms of the last configuration are stopped, the pins or the number of channels may have changed
+    for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
+      if(writtenPin[c] != NO_PIN) stopWaveform(writtenPin[c]);
+      writtenPin[c] = NO_PIN;
+    }
+#endif
+    for(uint8_t c=0; c<numOfChannels; c++) pinMode(channels[c].pin, openDrain ? OUTPUT_OPEN_DRAIN : OUTPUT);
+    changed = true;
+  }
+  static void setFrequency(const uint32_t f) {
+    analogWriteFreq(f);
+    periodCycles = ESP.getCpuFreqMHz() * 1000000UL / (f ? f : 1);
+    changed = true;
+  }
+#ifdef PWM_PHASE_ESP8266
+  static void write(const uint8_t c, const uint8_t pin, const uint16_t d) {
+    if(d != duty[c]) changed = true;
+    duty[c] = d;
+  }
+  static void commit() { if(changed) staggerESP8266PWM(); }
+#else
+  // analogWrite switches the pin to push pull, so the open drain mode is set again
+  static void write(const uint8_t c, const uint8_t pin, const uint16_t d) {
+    analogWrite(pin, d >> 6);
+    if(openDrain) pinMode(pin, OUTPUT_OPEN_DRAIN);
+  }
+  static void commit() {}
+#endif
+  // the waveforms are generated in the ESP8266 itself
+  static void check() {}
+  // writes the waveforms of all channels with staggered phases
+  static void staggerESP8266PWM();
+};
+
+// PWM generated by the I2C PCA9685 module with a resolution of 12 bit, phase staggered
+// the I2C bus runs with the fastest clock the wiring allows, the registers are read back by "check"
+struct PCA9685PWMDriver {
+  static uint16_t duty[MAX_NUM_OF_CHANNELS]; // duty cycles (0..4095) set by "write"
+  static uint16_t on[MAX_NUM_OF_CHANNELS]; // on counts written to the module
+  static uint16_t off[MAX_NUM_OF_CHANNELS]; // off counts written to the module
+  static bool changed; // true if a duty cycle has changed since the last "commit"
+  static bool openDrain; // output mode of the last "begin", used to initialize the module again
+  static uint32_t frequency; // PWM frequency of the last "setFrequency" in Hz
+  static uint8_t checked; // channel of the last "check"
+  static unsigned long millisAtRestart; // millis uptime of the last "restart"
+  static void begin(const bool openDrain_) {
+    openDrain = openDrain_;
+    PCA9685Shield.begin();
+    probeI2CClock();
+    PCA9685Shield.setOutputMode(!openDrain);
+    for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) on[c] = off[c] = 0xFFFF;
+    changed = true;
+  }
+  static void setFrequency(const uint32_t f) {
+    frequency = f;
+    PCA9685Shield.setPWMFreq(f);
+  }
+  static void write(const uint8_t c, const uint8_t pin, const uint16_t d) {
+    if((d >> 4) != duty[c]) changed = true;
+    duty[c] = d >> 4;
+  }
+  static void commit() { if(changed) staggerPCA9685PWM(); }
+  static void check();
+  // computes the on and off counts of all channels and writes the changed ones to the module
+  static void staggerPCA9685PWM();
+  // selects the fastest of "I2C_CLOCKS" at which the registers of the module read back correctly
+  static void probeI2CClock();
+  // frees the I2C bus and initializes the module again with the last duty cycles
+  static void restart();
+};
+
+// no PWM signal, the duty cycles are only recorded, e.g. to measure the PWM updates without hardware
+struct RecordingPWMDriver {
+  static uint16_t duty[MAX_NUM_OF_CHANNELS]; // last duty cycle written to each channel
+  static uint32_t writes; // number of writes since "begin"
+  static uint32_t frequency; // last frequency in Hz
+  static void begin(const bool openDrain) { writes = 0; }
+  static void setFrequency(const uint32_t f) { frequency = f; }
+  static void write(const uint8_t c, const uint8_t pin, const uint16_t d) {
+    duty[c] = d;
+    writes++;
+  }
+  static void commit() {}
+  static void check() {}
+};
+
+// inverts the duty cycle of "Driver", e.g. for drivers of the LEDs that are dimmed by pulling their input low
+template<class Driver> struct InvertedPWMDriver {
+  static void begin(const bool openDrain) { Driver::begin(openDrain); }
+  static void setFrequency(const uint32_t f) { Driver::setFrequency(f); }
+  static void write(const uint8_t c, const uint8_t pin, const uint16_t duty) { Driver::write(c, pin, 65535 - duty); }
+  static void commit() { Driver::commit(); }
+  static void check() { Driver::check(); }
+};
+
+
+// configures the outputs of "Driver" and starts all channels with their "output", 0 after a power on
+// after a restart with held outputs (see "restoreOutputs") the light keeps its brightness
+template<class Driver> void beginPWMOutput(const bool openDrain) {
+  Driver::begin(openDrain);
+  for(uint8_t c=0; c<numOfChannels; c++) Driver::write(c, channels[c].pin, channels[c].output / 100. * 65535);
+  Driver::commit();
+}
+
+// sets the duty cycle (0..65535) of channel c, it is output with the next "commit"
+template<class Driver> void writePWMOutput(const uint8_t c, const uint16_t duty) {
+  Driver::write(c, channels[c].pin, duty);
+}
+
+// sets the duty cycles of all channels according to their "output" and outputs them
+template<class Driver> void writeAllPWMOutputs() {
+  for(uint8_t c=0; c<numOfChannels; c++) Driver::write(c, channels[c].pin, channels[c].output / 100. * 65535);
+  Driver::commit();
+}
+
+// functions of the selected driver
+struct PWMOutput {
+  void (*begin)(const bool openDrain);
+  void (*setFrequency)(const uint32_t f);
+  void (*write)(const uint8_t c, const uint16_t duty);
+  void (*commit)();
+  void (*writeAll)();
+  void (*check)();
+};
+
+// instantiates all functions for "Driver"
+template<class Driver> PWMOutput makePWMOutput() {
+  PWMOutput output;
+  output.begin = beginPWMOutput<Driver>;
+  output.setFrequency = Driver::setFrequency;
+  output.write = writePWMOutput<Driver>;
+  output.commit = Driver::commit;
+  output.writeAll = writeAllPWMOutputs<Driver>;
+  output.check = Driver::check;
+  return output;
+}
+
+// global variables
+extern PWMOutput pwmOutput; // functions of the driver selected by "PWMGenerator"
+extern uint32_t i2cClock; // clock of the I2C bus in Hz selected by "probeI2CClock", 0 if no PCA9685 answered
+extern uint32_t pwmCheckErrors; // number of channels that were read back with wrong registers and corrected
+extern uint32_t i2cRecoveries; // number of times the I2C bus was freed and the PCA9685 initialized again
+
+// selects the driver for "generator", inverted if "inverted" is true
+void selectPWMOutput(const uint16_t generator, const bool inverted);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "scenes.h"
+#include "channel.h"
+#include "debug.h"
+#include "ntp.h"
+#include "sync.h"
+#include <Arduino.h>
+
+/*
+ * Global variables
+ */
+uint8_t numOfScenes; // current number of scenes
+Scene scenes[MAX_NUM_OF_SCENES]; // array storing all scenes
+int8_t activeScene = NO_SCENE; // number of the scene that is currently recalled, NO_SCENE otherwise
+uint32_t sceneFadeMillis; // fade time of the last recall or release of a scene in ms
+uint32_t sceneHoldSeconds; // time the active scene is held, 0 means until it is released
+uint8_t sceneChanges; // counts the recalls and releases of the scenes, so other devices can follow them
+unsigned long millisAtSceneRecall; // millis uptime of the device when the active scene was recalled
+unsigned long millisAtLastSceneCheck; // millis uptime of the device at the last check for scheduled scenes
+uint32_t secondsOfTheDayAtLastSceneCheck; // local seconds of the day at the last check for scheduled scenes
+bool sceneCheckStarted = false; // true after the first check for scheduled scenes
+bool manualBeforeScene[MAX_NUM_OF_CHANNELS]; // true if the channel was in manual mode before the active scene was recalled
+float valueBeforeScene[MAX_NUM_OF_CHANNELS]; // manual value of the channel before the active scene was recalled
+
+
+/*
+ * Constructor, Destructor
+ */
+Scene::Scene() {}
+Scene::~Scene() {}
+
+
+/*
+ * Fades all channels that are not in moonlight mode to the values of scene s
+ * The channels are set to manual mode, so the schedule does not change their value
+ * If "holdSeconds" is greater than 0, the channels fade back to the schedule after
+ * "holdSeconds" have passed since the recall
+ * The mode and manual value of the channels before the first of several recalls are kept, so "releaseScene"
+ * restores them. A channel fading back to the schedule counts as automatic, a fading one with its target.
+ */
+void recallScene(const uint8_t s, const uint32_t fadeMillis, const uint32_t holdSeconds) {
+  if(s >= numOfScenes) {
+    DEBUG_WARNING("[recallScene] scene %d does not exist", s);
+    return;
+  }
+  DEBUG_INFO("[recallScene] scene: %s, fade: %d ms, hold: %d s", scenes[s].name, fadeMillis, holdSeconds);
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    if(!channels[c].moonlight) {
+      if(activeScene == NO_SCENE) {
+        bool fading = channels[c].fadeStepsLeft > 0;
+        manualBeforeScene[c] = channels[c].manual && !(fading && channels[c].fadeToAutomatic);
+        valueBeforeScene[c] = fading ? channels[c].fadeTarget : channels[c].value;
+      }
+      channels[c].manual = true;
+      channels[c].startFade(scenes[s].v[c], fadeMillis, false);
+    }
+  }
+  activeScene = s;
+  sceneFadeMillis = fadeMillis;
+  sceneHoldSeconds = holdSeconds;
+  sceneChanges++;
+  millisAtSceneRecall = millis();
+  handlePWM(true);
+}
+
+
+/*
+ * Fades all channels that are not in moonlight mode back to the schedule
+ * Each channel fades to the value of its schedule at the end of the fade, so it continues
+ * smoothly with the schedule afterwards
+ * The channels that were in manual mode before the scene fade back to their manual value and stay manual
+ */
+void releaseScene(const uint32_t fadeMillis) {
+  DEBUG_INFO("[releaseScene] fade: %d ms", fadeMillis);
+  uint32_t t = (getLocalSecondsOfTheDay() + fadeMillis / 1000) % (24*60*60);
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    if(!channels[c].moonlight) {
+      channels[c].manual = true;
+      if(activeScene != NO_SCENE && manualBeforeScene[c]) channels[c].startFade(valueBeforeScene[c], fadeMillis, false);
+      else channels[c].startFade(channels[c].getScheduleValue(t), fadeMillis, true);
+    }
+  }
+  activeScene = NO_SCENE;
+  sceneFadeMillis = fadeMillis;
+  sceneChanges++;
+  handlePWM(true);
+}
+
+
+/*
+ * Stops the active scene and all fades, e.g. if the channels are changed manually
+ */
+void cancelScene() {
+  activeScene = NO_SCENE;
+  for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) channels[c].stopFade();
+}
+
+
+/*
+ * returns true if "start" has passed between the local seconds of the day "last" and "now"
+ */
+bool startPassed(const uint32_t last, const uint32_t now, const uint32_t start) {
+  if(last <= now) return last < start && start <= now;
+  // midnight has passed
+  return last < start || start <= now;
+}
+
+
+/*
+ * Handles the scenes in the main loop
+ * every "MILLIS_BETWEEN_SCENE_CHECKS" it is checked if
+ *  - the start of a scheduled scene has passed, so the scene is recalled
+ *  - the active scene has been held long enough, so the channels fade back to the schedule
+ * Time jumps (e.g. the first NTP update) do not recall scheduled scenes
+ * A sync follower does not recall scheduled scenes itself, it follows the recalls of the sync leader
+ */
+void handleScenes() {
+  if(millis() - millisAtLastSceneCheck < MILLIS_BETWEEN_SCENE_CHECKS) return;
+  millisAtLastSceneCheck = millis();
+
+  uint32_t now = getLocalSecondsOfTheDay();
+  uint32_t passed = (now + 24*60*60 - secondsOfTheDayAtLastSceneCheck) % (24*60*60);
+  if(sceneCheckStarted && passed < 60 && !(syncMode == SYNC_FOLLOWER && syncedClock)) {
+    for(uint8_t s=0; s<numOfScenes; s++) {
+      if(scenes[s].scheduled && startPassed(secondsOfTheDayAtLastSceneCheck, now, scenes[s].start)) {
+        recallScene(s, uint32_t(scenes[s].fade) * 1000, scenes[s].duration);
+      }
+    }
+  }
+  secondsOfTheDayAtLastSceneCheck = now;
+  sceneCheckStarted = true;
+
+  if(activeScene != NO_SCENE && sceneHoldSeconds > 0 && millis() - millisAtSceneRecall >= sceneHoldSeconds * 1000) {
+    releaseScene(uint32_t(scenes[activeScene].fade) * 1000);
+  }
+}
+
+
+uint32_t millisUntilSceneCheck() {
+  unsigned long passed = millis() - millisAtLastSceneCheck;
+  return passed >= MILLIS_BETWEEN_SCENE_CHECKS ? 0 : MILLIS_BETWEEN_SCENE_CHECKS - passed;
+}
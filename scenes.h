@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef SCENES__H
+#define SCENES__H
+
+#include <Arduino.h>
+#include "channel.h"
+
+// constants
+static const uint8_t LEN_SCENE_NAME = 20; // max length of the scene name
+static const uint8_t MAX_NUM_OF_SCENES = 8; // max number of scenes
+static const int8_t NO_SCENE = -1; // no scene is active
+static const unsigned long MILLIS_BETWEEN_SCENE_CHECKS = 1000; // time between the checks for scheduled scenes in ms
+
+// Class defining the scene objects
+class Scene {
+
+  public:
+    // name of the scene
+    char name[LEN_SCENE_NAME + 1];
+
+    // values of the channels in %
+    float v[MAX_NUM_OF_CHANNELS];
+
+    // if true: the scene is recalled every day at "start"
+    bool scheduled;
+
+    // time the scene is recalled if it is scheduled, stored as seconds that has passed since midnight
+    uint32_t start;
+
+    // time in seconds the scene is held before the channels fade back to the schedule, 0 means until it is released
+    uint32_t duration;
+
+    // time in seconds the channels need to fade to the scene and back to the schedule
+    uint16_t fade;
+
+    // constructor
+    Scene();
+    // destructor
+    ~Scene();
+};
+
+
+// global variables
+extern uint8_t numOfScenes; // current number of scenes
+extern Scene scenes[MAX_NUM_OF_SCENES]; // array with all possible scenes
+extern int8_t activeScene; // number of the scene that is currently recalled, NO_SCENE otherwise
+extern uint32_t sceneFadeMillis; // fade time of the last recall or release of a scene in ms
+extern uint32_t sceneHoldSeconds; // time the active scene is held, 0 means until it is released
+extern uint8_t sceneChanges; // counts the recalls and releases of the scenes, so other devices can follow them
+
+// fades all channels that are not in moonlight mode to scene s within "fadeMillis"
+// if "holdSeconds" > 0 the channels fade back to the schedule after "holdSeconds"
+void recallScene(const uint8_t s, const uint32_t fadeMillis, const uint32_t holdSeconds);
+
+// fades all channels that are not in moonlight mode back to the schedule within "fadeMillis"
+void releaseScene(const uint32_t fadeMillis);
+
+// stops the active scene and all fades, the channels keep their current value
+void cancelScene();
+
+// handles the scheduled scenes in the main loop
+void handleScenes();
+// returns the time in ms until the next check for scheduled scenes
+uint32_t millisUntilSceneCheck();
+
+#endif
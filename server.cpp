@@ -17,62 +17,1015 @@
 #include "debug.h"
 #include "settings.h"
 #include "channel.h"
+#include "pwm.h"
 #include "ntp.h"
-#include <ESP8266WebServer.h>
-#include <WebSocketsServer.h>
-#include <FS.h>
+#include "effects.h"
+#include "scenes.h"
+#include "sync.h"
+#include "profiles.h"
+#include "transfer.h"
+#include "simulator.h"
+#include "benchmark.h"
+#include "storage.h"
+#include "watchdog.h"
+#include "idle.h"
+#include "mqtt.h"
+#include "ota.h"
+#include <ESPAsyncWebServer.h>
 #include <Arduino.h>
 #include <ArduinoJson.h>
 
-// constants for the Websocket interaction 
-static const uint8_t ID_REQUEST_MANUAL_FROM_SERVER = 0;
-static const uint8_t ID_SEND_MANUAL_TO_CLIENT = 1;
-static const uint8_t ID_UPDATE_MANUAL = 2;
+// constants
+static const uint8_t MAX_NUM_OF_LOG_LINES = 16; // max number of log records in one message
+static const uint8_t WS_QUEUE_SIZE = 8; // max number of received websocket messages waiting for the main loop
+static const size_t MAX_WS_MESSAGE_SIZE = 8192; // larger websocket messages are dropped
 
-static const uint8_t ID_REQUEST_SCHEDULE_FROM_SERVER = 10;
-static const uint8_t ID_SEND_SCHEDULE_TO_CLIENT = 11;
-static const uint8_t ID_SAVE_SCHEDULE = 12;
+// status of the commands in a batch
+static const uint8_t BATCH_STATUS_OK = 0; // the command is valid and applied
+static const uint8_t BATCH_STATUS_INVALID = 1; // the command is invalid, so no command of the batch is applied
+static const uint8_t BATCH_STATUS_SKIPPED = 2; // the command is valid, but not applied because another command is invalid
 
-static const uint8_t ID_REQUEST_SETTINGS_FROM_SERVER = 20;
-static const uint8_t ID_SEND_SETTINGS_TO_CLIENT = 21;
-static const uint8_t ID_SAVE_SETTINGS = 22;
+// work that is done once after all commands of a message are applied
+static const uint8_t FLUSH_RESOLVE = 1; // computes the segments with the profile of the day
+static const uint8_t FLUSH_SETTINGS = 2; // saves the settings
+static const uint8_t FLUSH_PROFILES = 4; // saves the profiles
+static const uint8_t FLUSH_OUTPUTS = 8; // reconfigures the outputs and restarts the effect and the sync
+static const uint8_t FLUSH_PWM = 16; // forces a PWM update
+static const uint8_t FLUSH_RESTART = 32; // restarts the ESP8266
+static const uint8_t FLUSH_SECRETS = 64; // saves the passwords
 
-static const uint8_t ID_RESTART = 50;
-static const uint8_t ID_FACTORY_SETTINGS = 51;
+
+// received websocket message waiting for the main loop
+struct QueuedMessage {
+  uint32_t client; // id of the websocket client
+  char *payload; // zero terminated json, allocated on the heap
+};
 
 
 // global variables
-ESP8266WebServer server(80); // webserver object
-WebSocketsServer webSocket = WebSocketsServer(81); // websocket object
+AsyncWebServer server(80); // webserver object
+AsyncWebSocket webSocket("/ws"); // websocket object, served by "server" on the same port
+uint8_t pendingFlush; // work collected by the applied commands, see FLUSH_*
+QueuedMessage wsQueue[WS_QUEUE_SIZE]; // received websocket messages, handled one per loop
+uint8_t wsQueueHead = 0; // index of the oldest message in "wsQueue"
+uint8_t wsQueueLength = 0; // number of messages in "wsQueue"
+AsyncWebServerRequest *deferredRequest = NULL; // http request handled in the main loop, NULL if the client is gone
+void (*deferredHandler)(AsyncWebServerRequest *request) = NULL; // handler of "deferredRequest", NULL if there is none
+uint32_t wsMessages = 0; // number of received websocket messages
+uint32_t wsDroppedMessages = 0; // number of received websocket messages that were too large or found the queue full
+uint32_t wsInvalidMessages = 0; // number of received websocket messages that were not applied
+uint32_t wsMaxMessageMillis = 0; // max time in ms to handle a websocket message
+String *capturedReply = NULL; // if set, the replies are stored there instead of being sent, e.g. by the benchmark
+
+
+/*
+ * Sends the file "SETTINGS_FILE_NAME" to the http client
+ * The ETag is the revision of the settings, so the file is only sent if the settings changed since the last request
+ */
+void handleSettingsFile(AsyncWebServerRequest *request) {
+  String etag = "\"" + String(revisionSettings) + "\"";
+  AsyncWebServerResponse *response;
+  if(request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == etag) {
+    response = request->beginResponse(304);
+  }
+  else {
+    // usually answered from the read cache, without an access to the flash
+    String content;
+    if(!readFile(SETTINGS_FILE_NAME, content)) {
+      request->send(404, F("text/plain"), F("Settings not found"));
+      return;
+    }
+    response = request->beginResponse(200, F("application/json"), content);
+  }
+  response->addHeader(F("ETag"), etag);
+  response->addHeader(F("Cache-Control"), F("no-cache"));
+  request->send(response);
+}
+
+
+/*
+ * Sends the counters of the websocket messages and the PWM updates as json to the http client
+ * With the argument "reset" the counters and maxima are reset after they are sent, so a load test can start from 0.
+ */
+void handleMetrics(AsyncWebServerRequest *request) {
+  DynamicJsonBuffer jsonBuffer;
+  JsonObject& jsonOut = jsonBuffer.createObject();
+  // uptime in ms
+  jsonOut[CHAR_METRICS_UPTIME] = millis();
+  // free heap in bytes
+  jsonOut[CHAR_METRICS_FREE_HEAP] = ESP.getFreeHeap();
+  // websocket messages
+  jsonOut[CHAR_METRICS_MESSAGES] = wsMessages;
+  jsonOut[CHAR_METRICS_INVALID_MESSAGES] = wsInvalidMessages;
+  jsonOut[CHAR_METRICS_DROPPED_MESSAGES] = wsDroppedMessages;
+  jsonOut[CHAR_METRICS_MAX_MESSAGE_MILLIS] = wsMaxMessageMillis;
+  // PWM updates
+  jsonOut[CHAR_METRICS_PWM_UPDATES] = pwmUpdates;
+  jsonOut[CHAR_METRICS_PWM_MAX_LATENESS] = pwmMaxLateness;
+  jsonOut[CHAR_METRICS_PWM_MISSED_TICKS] = pwmMissedTicks;
+  // read back of the PCA9685 and recoveries of the I2C bus
+  jsonOut[CHAR_METRICS_PWM_CHECK_ERRORS] = pwmCheckErrors;
+  jsonOut[CHAR_METRICS_I2C_CLOCK] = i2cClock;
+  jsonOut[CHAR_METRICS_I2C_RECOVERIES] = i2cRecoveries;
+  // read cache of the files
+  jsonOut[CHAR_METRICS_CACHE_HITS] = storageCacheHits;
+  jsonOut[CHAR_METRICS_CACHE_MISSES] = storageCacheMisses;
+  // published and dropped mqtt messages
+  jsonOut[CHAR_METRICS_MQTT_PUBLISHED] = mqttPublished;
+  jsonOut[CHAR_METRICS_MQTT_DROPPED] = mqttDropped;
+  // dump of the watchdog before the last reset
+  addWatchdogDump(jsonOut.createNestedObject(CHAR_WATCHDOG));
+
+  String jsonOutStr;
+  jsonOut.printTo(jsonOutStr);
+  AsyncWebServerResponse *response = request->beginResponse(200, F("application/json"), jsonOutStr);
+  response->addHeader(F("Cache-Control"), F("no-cache"));
+  request->send(response);
+
+  if(request->hasArg("reset")) {
+    wsMessages = wsInvalidMessages = wsDroppedMessages = wsMaxMessageMillis = 0;
+    pwmUpdates = pwmMaxLateness = pwmMissedTicks = 0;
+    pwmCheckErrors = i2cRecoveries = 0;
+    storageCacheHits = storageCacheMisses = 0;
+    mqttPublished = mqttDropped = 0;
+  }
+}
+
+
+/*
+ * Sends "jsonOut" to client "num"
+ * The message is queued by the websocket and sent by the TCP stack, so the main loop does not wait for the client.
+ * The replies to the commands received by mqtt ("MQTT_CLIENT") are published to the broker instead.
+ * if "capturedReply" is set, "jsonOut" is stored there instead
+ */
+void sendJson(const uint32_t num, JsonObject& jsonOut) {
+  String jsonOutStr;
+  jsonOut.printTo(jsonOutStr);
+  if(capturedReply) {
+    *capturedReply = jsonOutStr;
+    return;
+  }
+  if(num == MQTT_CLIENT) {
+    publishMqttReply(jsonOutStr);
+    return;
+  }
+  webSocket.text(num, jsonOutStr);
+}
+
+
+/*
+ * Sends the binary message "data" with "len" bytes to client "num"
+ * "data" is copied by the websocket. Binary messages are only sent to websocket clients, they are dropped for
+ * mqtt ("MQTT_CLIENT") and if "capturedReply" is set.
+ */
+void sendBinary(const uint32_t num, const uint8_t *data, const size_t len) {
+  if(capturedReply || num == MQTT_CLIENT) return;
+  webSocket.binary(num, (const char*)data, len);
+}
+
+
+/*
+ * Adds the revision "revision" of the requested data to "jsonOut"
+ * returns true and marks "jsonOut" as "unchanged" if the client already has this revision ("rev" in "jsonIn"), so
+ * the data must not be serialized again, false otherwise
+ */
+bool checkRevision(JsonObject& jsonIn, JsonObject& jsonOut, const uint32_t revision) {
+  jsonOut[CHAR_REVISION] = revision;
+  if(!jsonIn.containsKey(CHAR_REVISION) || jsonIn[CHAR_REVISION].as<uint32_t>() != revision) return false;
+  jsonOut[CHAR_UNCHANGED] = true;
+  return true;
+}
+
+
+/*
+ * Applies the command "jsonIn" received from client "num"
+ * The saving of the settings and profiles and the PWM update are not done here, they are collected
+ * in "pendingFlush" and done once by "flushCommands" after all commands of a message are applied.
+ */
+void applyCommand(const uint32_t num, JsonObject& jsonIn, DynamicJsonBuffer& jsonBuffer) {
+  uint8_t id = jsonIn["id"];
+  switch(id) {
+
+    case ID_REQUEST_MANUAL_FROM_SERVER: {
+      DEBUG_INFO("ID_REQUEST_INDEX_FROM_SERVER");
+
+      // create json
+      JsonObject& jsonOut = jsonBuffer.createObject();
+      // id
+      jsonOut["id"] = ID_SEND_MANUAL_TO_CLIENT;
+      // power limit factor
+      jsonOut[CHAR_POWER_LIMIT_FACTOR] = powerLimitFactor;
+      // revision
+      if(checkRevision(jsonIn, jsonOut, revisionChannels)) {
+        sendJson(num, jsonOut);
+        break;
+      }
+      // channels array
+      JsonArray& jsonChannels = jsonOut.createNestedArray(CHAR_CHANNELS);
+      for(uint8_t c=0; c<numOfChannels; c++) {
+        JsonObject& jsonChannelsChannel = jsonChannels.createNestedObject();
+        // channel name
+        jsonChannelsChannel[CHAR_CHANNEL_NAME] = jsonBuffer.strdup(channels[c].name);
+        // channel color
+        jsonChannelsChannel[CHAR_CHANNEL_COLOR] = jsonBuffer.strdup(channels[c].color);
+        // channel manual
+        jsonChannelsChannel[CHAR_CHANNEL_MANUAL] = channels[c].manual;
+        // channel moonlight
+        jsonChannelsChannel[CHAR_CHANNEL_MOONLIGHT] = channels[c].moonlight;
+        // channel pwm value
+        jsonChannelsChannel[CHAR_CHANNEL_VALUE] = channels[c].value;
+        // channel pwm value after the power limit
+        jsonChannelsChannel[CHAR_CHANNEL_OUTPUT] = channels[c].output;
+      }
+      
+      // send json
+      sendJson(num, jsonOut);
+      break;
+    }
+
+    case ID_UPDATE_MANUAL: {
+      DEBUG_INFO("ID_UPDATE_MANUAL");
+      cancelScene();
+      for(uint8_t c=0; c<numOfChannels; c++) {
+        if(!channels[c].moonlight) {
+          channels[c].manual = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_MANUAL];
+          channels[c].value = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_VALUE];
+        }
+      }
+      // forces PWM update
+      pendingFlush |= FLUSH_PWM;
+      break;
+    }
+    
+    case ID_REQUEST_SCHEDULE_FROM_SERVER: {
+      DEBUG_INFO("ID_REQUEST_SCHEDULE_FROM_SERVER");
+
+      // create json
+      JsonObject& jsonOut = jsonBuffer.createObject();
+      // id
+      jsonOut["id"] = ID_SEND_SCHEDULE_TO_CLIENT;
+      // time
+      jsonOut[CHAR_TIME] = getLocalSecondsOfTheDay();
+      // revision
+      if(checkRevision(jsonIn, jsonOut, revisionSchedule)) {
+        sendJson(num, jsonOut);
+        break;
+      }
+      // max num of entries
+      jsonOut[CHAR_MAX_NUM_OF_ENTRIES] = MAX_NUM_OF_ENTRIES;
+      // channels
+      JsonArray& jsonChannels = jsonOut.createNestedArray(CHAR_CHANNELS);
+      for(uint8_t c=0; c<numOfChannels; c++) {
+        JsonObject& jsonChannelsChannel = jsonChannels.createNestedObject();
+        // channel name
+        jsonChannelsChannel[CHAR_CHANNEL_NAME] = jsonBuffer.strdup(channels[c].name);
+        // channel color
+        jsonChannelsChannel[CHAR_CHANNEL_COLOR] = jsonBuffer.strdup(channels[c].color);
+        // channel moonlight
+        jsonChannelsChannel[CHAR_CHANNEL_MOONLIGHT] = channels[c].moonlight;
+        // channel interpolation
+        jsonChannelsChannel[CHAR_CHANNEL_INTERPOLATION] = channels[c].interpolation;
+        
+        // times array
+        JsonArray& jsonChannelsChannelT = jsonChannelsChannel.createNestedArray(CHAR_CHANNEL_TIMES);
+        // values array
+        JsonArray& jsonChannelsChannelV = jsonChannelsChannel.createNestedArray(CHAR_CHANNEL_VALUES);
+        for(uint8_t i=0; i<channels[c].numOfEntries; i++) {
+          jsonChannelsChannelT.add(channels[c].t[i]);
+          jsonChannelsChannelV.add(channels[c].v[i]);
+        }
+      }
+
+      // send json
+      sendJson(num, jsonOut);
+      break;
+    }
+
+    case ID_REQUEST_CURVE_FROM_SERVER: {
+      DEBUG_INFO("ID_REQUEST_CURVE_FROM_SERVER");
+      sendCurve(num, jsonIn);
+      break;
+    }
+
+    case ID_SAVE_SCHEDULE: {
+      DEBUG_INFO("ID_SAVE_SCHEDULE");
+      // only the channels in the message are changed, the schedule of the others is kept
+      uint8_t numOfSentChannels = numOfChannels;
+      if(jsonIn[CHAR_CHANNELS].size() < numOfSentChannels) numOfSentChannels = jsonIn[CHAR_CHANNELS].size();
+      for(uint8_t c=0; c<numOfSentChannels; c++) {
+        if(!channels[c].moonlight) {
+          channels[c].numOfEntries = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES].size();
+          for(uint8_t i=0; i<channels[c].numOfEntries ;i++) {
+            channels[c].v[i] = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_VALUES][i];
+            channels[c].t[i] = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES][i];
+          }
+          channels[c].prepareSchedule();
+        }
+      }
+      revisionSchedule++;
+      // the segments are computed with the profile of the day, the settings are saved and a PWM update is forced
+      pendingFlush |= FLUSH_RESOLVE | FLUSH_SETTINGS | FLUSH_PWM;
+      break;
+    }
+    
+    case ID_REQUEST_SETTINGS_FROM_SERVER: {
+      DEBUG_INFO("ID_REQUEST_SETTINGS_FROM_SERVER");
+
+      // create json
+      JsonObject& jsonOut = jsonBuffer.createObject();
+      // id
+      jsonOut["id"] = ID_SEND_SETTINGS_TO_CLIENT;
+      // time
+      jsonOut[CHAR_TIME] = epochTime();
+      // current power
+      jsonOut[CHAR_CURRENT_POWER] = currentPower;
+      // power limit factor
+      jsonOut[CHAR_POWER_LIMIT_FACTOR] = powerLimitFactor;
+      // sync state
+      jsonOut[CHAR_SYNC_LOCKED] = syncedClock;
+      jsonOut[CHAR_SYNC_BEACONS] = syncBeacons;
+      // mqtt state
+      jsonOut[CHAR_MQTT_CONNECTED] = mqttConnected();
+      // revision, the state above changes without a new revision, so it is always sent
+      if(checkRevision(jsonIn, jsonOut, revisionSettings)) {
+        sendJson(num, jsonOut);
+        break;
+      }
+      // number of channels
+      jsonOut[CHAR_NUM_OF_CHANNELS] = numOfChannels;
+      // maximum number of channels
+      jsonOut[CHAR_MAX_NUM_OF_CHANNELS] = MAX_NUM_OF_CHANNELS;
+      // timezone
+      jsonOut[CHAR_TIMEZONE] = timezone;
+      // PWMFrequency
+      jsonOut[CHAR_PWM_FREQUENCY] = PWMFrequency;
+      // pwm generator
+      jsonOut[CHAR_PWM_GENERATOR] = PWMGenerator;
+      // pwm inverted
+      jsonOut[CHAR_PWM_INVERTED] = PWMInverted;
+      // pwm open drain
+      jsonOut[CHAR_PWM_OPEN_DRAIN] = PWMOpenDrain;
+      // max power
+      jsonOut[CHAR_MAX_POWER] = maxPower;
+      // power limit mode
+      jsonOut[CHAR_POWER_LIMIT_MODE] = powerLimitMode;
+      // effect
+      jsonOut[CHAR_EFFECT] = effect;
+      // effect intensity
+      jsonOut[CHAR_EFFECT_INTENSITY] = effectIntensity;
+      // effect seed
+      jsonOut[CHAR_EFFECT_SEED] = effectSeed;
+      // sync mode
+      jsonOut[CHAR_SYNC_MODE] = syncMode;
+      // mqtt broker and topic prefix
+      jsonOut[CHAR_MQTT_HOST] = jsonBuffer.strdup(mqttHost);
+      jsonOut[CHAR_MQTT_PORT] = mqttPort;
+      jsonOut[CHAR_MQTT_TOPIC] = jsonBuffer.strdup(mqttTopic);
+      // mqtt login, only if a password is set, the passwords are never sent
+      jsonOut[CHAR_MQTT_USER] = jsonBuffer.strdup(mqttUser);
+      jsonOut[CHAR_MQTT_PASSWORD_SET] = mqttPassword[0] != 0;
+      // only if a password of the updates is set, the password itself is never sent
+      jsonOut[CHAR_OTA_PASSWORD_SET] = otaPassword[0] != 0;
+      // channels
+      JsonArray& jsonChannels = jsonOut.createNestedArray(CHAR_CHANNELS);
+      for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
+        JsonObject& jsonChannelsChannel = jsonChannels.createNestedObject();
+        // channel name
+        jsonChannelsChannel[CHAR_CHANNEL_NAME] = jsonBuffer.strdup(channels[c].name);
+        // channel color
+        jsonChannelsChannel[CHAR_CHANNEL_COLOR] = jsonBuffer.strdup(channels[c].color);
+        // channel moonlight
+        jsonChannelsChannel[CHAR_CHANNEL_MOONLIGHT] = channels[c].moonlight;
+        // channel max moonlight value
+        jsonChannelsChannel[CHAR_CHANNEL_MAX_MOONLIGHT_VALUE] = channels[c].maxMoonlightValue;
+        // channel power
+        jsonChannelsChannel[CHAR_CHANNEL_POWER] = channels[c].power;
+        // channel priority
+        jsonChannelsChannel[CHAR_CHANNEL_PRIORITY] = channels[c].priority;
+        // channel lightning
+        jsonChannelsChannel[CHAR_CHANNEL_LIGHTNING] = channels[c].lightning;
+        // channel interpolation
+        jsonChannelsChannel[CHAR_CHANNEL_INTERPOLATION] = channels[c].interpolation;
+        // channel pin
+        jsonChannelsChannel[CHAR_CHANNEL_PIN] = channels[c].pin;
+      }
+      
+      // send json
+      sendJson(num, jsonOut);
+      break;  
+    } 
+
+    case ID_SAVE_SETTINGS: {
+      DEBUG_INFO("ID_REQUEST_SAVE_SETTINGS");
+      
+      // number of channels
+      numOfChannels = jsonIn[CHAR_NUM_OF_CHANNELS];
+      // timezone
+      timezone = jsonIn[CHAR_TIMEZONE];
+      // PWMFrequency
+      PWMFrequency= jsonIn[CHAR_PWM_FREQUENCY];
+      // pwm generator
+      PWMGenerator = jsonIn[CHAR_PWM_GENERATOR];
+      // pwm inverted
+      PWMInverted = jsonIn[CHAR_PWM_INVERTED];
+      // pwm open drain
+      PWMOpenDrain = jsonIn[CHAR_PWM_OPEN_DRAIN];
+      // max power
+      maxPower = jsonIn[CHAR_MAX_POWER];
+      // power limit mode
+      powerLimitMode = jsonIn[CHAR_POWER_LIMIT_MODE];
+      // effect
+      effect = jsonIn[CHAR_EFFECT];
+      // effect intensity
+      effectIntensity = jsonIn[CHAR_EFFECT_INTENSITY];
+      // effect seed
+      effectSeed = jsonIn[CHAR_EFFECT_SEED];
+      // sync mode
+      syncMode = jsonIn[CHAR_SYNC_MODE];
+      // mqtt broker and topic prefix
+      strlcpy(mqttHost, jsonIn[CHAR_MQTT_HOST] | "", sizeof(mqttHost));
+      mqttPort = jsonIn[CHAR_MQTT_PORT];
+      if(mqttPort == 0) mqttPort = DEFAULT_MQTT_PORT;
+      strlcpy(mqttTopic, jsonIn[CHAR_MQTT_TOPIC] | DEFAULT_MQTT_TOPIC, sizeof(mqttTopic));
+      // mqtt login, an empty password keeps the current one, without a user no login is used
+      strlcpy(mqttUser, jsonIn[CHAR_MQTT_USER] | "", sizeof(mqttUser));
+      if(strlen(jsonIn[CHAR_MQTT_PASSWORD] | "") > 0) {
+        strlcpy(mqttPassword, jsonIn[CHAR_MQTT_PASSWORD], sizeof(mqttPassword));
+        pendingFlush |= FLUSH_SECRETS;
+      }
+      // password of the updates, an empty one keeps the current password, a set one is only changed with it
+      const char *password = jsonIn[CHAR_OTA_PASSWORD] | "";
+      if(password[0] != 0) {
+        if(otaPassword[0] != 0 && strcmp(otaPassword, jsonIn[CHAR_OTA_CURRENT_PASSWORD] | "") != 0) {
+          DEBUG_WARNING("[webSocket_event] wrong current update password, the password is not changed");
+        }
+        else {
+          strlcpy(otaPassword, password, sizeof(otaPassword));
+          pendingFlush |= FLUSH_SECRETS;
+        }
+      }
+      
+      //channels
+      for(uint8_t c=0; c<numOfChannels; c++) {
+    
+        // channel number
+        channels[c].channelNumber = c;
+        // channel name
+        strcpy(channels[c].name, jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_NAME]); 
+        // channel color
+        strcpy(channels[c].color, jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_COLOR]); 
+        // channel moonlight
+        channels[c].moonlight = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_MOONLIGHT];
+        // channel max moonlight value
+        channels[c].maxMoonlightValue = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_MAX_MOONLIGHT_VALUE];
+        // channel pin
+        channels[c].pin = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_PIN];
+        // channel power
+        channels[c].power = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_POWER];
+        // channel priority
+        channels[c].priority = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_PRIORITY];
+        // channel lightning
+        channels[c].lightning = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_LIGHTNING];
+        // channel interpolation
+        channels[c].interpolation = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_INTERPOLATION];
+        channels[c].prepareSchedule();
+      }
+
+      revisionChannels++;
+      revisionSchedule++;
+      // the settings are saved, the outputs, the effect and the sync are restarted with the new settings
+      pendingFlush |= FLUSH_RESOLVE | FLUSH_SETTINGS | FLUSH_OUTPUTS | FLUSH_PWM;
+
+      break;
+   }
+ 
+    case ID_REQUEST_SCENES_FROM_SERVER: {
+      DEBUG_INFO("ID_REQUEST_SCENES_FROM_SERVER");
+
+      // create json
+      JsonObject& jsonOut = jsonBuffer.createObject();
+      // id
+      jsonOut["id"] = ID_SEND_SCENES_TO_CLIENT;
+      // active scene
+      jsonOut[CHAR_ACTIVE_SCENE] = activeScene;
+      // scenes
+      JsonArray& jsonScenes = jsonOut.createNestedArray(CHAR_SCENES);
+      for(uint8_t s=0; s<numOfScenes; s++) {
+        JsonObject& jsonScenesScene = jsonScenes.createNestedObject();
+        // scene name
+        jsonScenesScene[CHAR_SCENE_NAME] = jsonBuffer.strdup(scenes[s].name);
+        // scene scheduled
+        jsonScenesScene[CHAR_SCENE_SCHEDULED] = scenes[s].scheduled;
+        // scene start
+        jsonScenesScene[CHAR_SCENE_START] = scenes[s].start;
+        // scene duration
+        jsonScenesScene[CHAR_SCENE_DURATION] = scenes[s].duration;
+        // scene fade
+        jsonScenesScene[CHAR_SCENE_FADE] = scenes[s].fade;
+        // values array
+        JsonArray& jsonScenesSceneV = jsonScenesScene.createNestedArray(CHAR_SCENE_VALUES);
+        for(uint8_t c=0; c<numOfChannels; c++) jsonScenesSceneV.add(scenes[s].v[c]);
+      }
+
+      // send json
+      sendJson(num, jsonOut);
+      break;
+    }
+
+    case ID_SAVE_SCENE: {
+      DEBUG_INFO("ID_SAVE_SCENE");
+      uint8_t s = jsonIn[CHAR_SCENE];
+      if(s > numOfScenes || s >= MAX_NUM_OF_SCENES) {
+        DEBUG_WARNING("[webSocket_event] scene %d can not be saved", s);
+        break;
+      }
+      if(s == numOfScenes) numOfScenes++;
+      // scene name
+      strlcpy(scenes[s].name, jsonIn[CHAR_SCENE_NAME] | "", sizeof(scenes[s].name));
+      // scene scheduled
+      scenes[s].scheduled = jsonIn[CHAR_SCENE_SCHEDULED];
+      // scene start
+      scenes[s].start = jsonIn[CHAR_SCENE_START];
+      // scene duration
+      scenes[s].duration = jsonIn[CHAR_SCENE_DURATION];
+      // scene fade
+      scenes[s].fade = jsonIn[CHAR_SCENE_FADE];
+      // scene values, the current values of the channels if there are no values
+      for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
+        if(jsonIn.containsKey(CHAR_SCENE_VALUES)) scenes[s].v[c] = jsonIn[CHAR_SCENE_VALUES][c];
+        else scenes[s].v[c] = channels[c].value;
+      }
+      // save Settings
+      pendingFlush |= FLUSH_SETTINGS;
+      break;
+    }
+
+    case ID_DELETE_SCENE: {
+      DEBUG_INFO("ID_DELETE_SCENE");
+      uint8_t s = jsonIn[CHAR_SCENE];
+      if(s >= numOfScenes) break;
+      if(activeScene == s) activeScene = NO_SCENE;
+      if(activeScene > s) activeScene--;
+      for(uint8_t i=s; i+1<numOfScenes; i++) scenes[i] = scenes[i+1];
+      numOfScenes--;
+      // save Settings
+      pendingFlush |= FLUSH_SETTINGS;
+      break;
+    }
+
+    case ID_RECALL_SCENE: {
+      DEBUG_INFO("ID_RECALL_SCENE");
+      uint32_t fade = jsonIn[CHAR_SCENE_FADE];
+      recallScene(jsonIn[CHAR_SCENE], fade * 1000, jsonIn[CHAR_SCENE_DURATION]);
+      break;
+    }
+
+    case ID_RELEASE_SCENE: {
+      DEBUG_INFO("ID_RELEASE_SCENE");
+      uint32_t fade = jsonIn[CHAR_SCENE_FADE];
+      releaseScene(fade * 1000);
+      break;
+    }
+
+    case ID_REQUEST_PROFILES_FROM_SERVER: {
+      DEBUG_INFO("ID_REQUEST_PROFILES_FROM_SERVER");
+
+      // create json
+      JsonObject& jsonOut = jsonBuffer.createObject();
+      // id
+      jsonOut["id"] = ID_SEND_PROFILES_TO_CLIENT;
+      // current day
+      jsonOut[CHAR_TODAY] = getLocalDay();
+      // active profile
+      jsonOut[CHAR_ACTIVE_PROFILE] = activeProfile;
+      // acclimation factor of the current day
+      jsonOut[CHAR_ACCLIMATION_FACTOR] = acclimationFactor;
+      // profiles
+      JsonArray& jsonProfiles = jsonOut.createNestedArray(CHAR_PROFILES);
+      for(uint8_t p=0; p<numOfProfiles; p++) {
+        JsonObject& jsonProfilesProfile = jsonProfiles.createNestedObject();
+        // profile name
+        jsonProfilesProfile[CHAR_PROFILE_NAME] = jsonBuffer.strdup(profiles[p].name);
+        // channels
+        JsonArray& jsonChannels = jsonProfilesProfile.createNestedArray(CHAR_CHANNELS);
+        for(uint8_t c=0; c<numOfChannels; c++) {
+          JsonObject& jsonChannelsChannel = jsonChannels.createNestedObject();
+          // times array
+          JsonArray& jsonChannelsChannelT = jsonChannelsChannel.createNestedArray(CHAR_CHANNEL_TIMES);
+          // values array
+          JsonArray& jsonChannelsChannelV = jsonChannelsChannel.createNestedArray(CHAR_CHANNEL_VALUES);
+          for(uint8_t i=0; i<profiles[p].numOfEntries[c]; i++) {
+            jsonChannelsChannelT.add(uint32_t(profiles[p].entries[c][i].minute) * 60);
+            jsonChannelsChannelV.add(profiles[p].entries[c][i].value / 100.);
+          }
+        }
+      }
+      // week profiles
+      JsonArray& jsonWeek = jsonOut.createNestedArray(CHAR_WEEK_PROFILES);
+      for(uint8_t d=0; d<7; d++) jsonWeek.add(weekProfiles[d]);
+      // date overrides
+      JsonArray& jsonDates = jsonOut.createNestedArray(CHAR_DATE_OVERRIDES);
+      for(uint8_t i=0; i<numOfDateOverrides; i++) {
+        JsonObject& jsonDatesDate = jsonDates.createNestedObject();
+        jsonDatesDate[CHAR_DATE] = dateOverrides[i].day;
+        jsonDatesDate[CHAR_PROFILE] = dateOverrides[i].profile;
+      }
+      // acclimation
+      jsonOut[CHAR_ACCLIMATION_START] = acclimationStart;
+      jsonOut[CHAR_ACCLIMATION_WEEKS] = acclimationWeeks;
+      jsonOut[CHAR_ACCLIMATION_PERCENT] = acclimationPercent;
+
+      // send json
+      sendJson(num, jsonOut);
+      break;
+    }
+
+    case ID_SAVE_PROFILE: {
+      DEBUG_INFO("ID_SAVE_PROFILE");
+      uint8_t p = jsonIn[CHAR_PROFILE];
+      if(p > numOfProfiles || p >= MAX_NUM_OF_PROFILES) {
+        DEBUG_WARNING("[webSocket_event] profile %d can not be saved", p);
+        break;
+      }
+      if(p == numOfProfiles) numOfProfiles++;
+      // profile name
+      strlcpy(profiles[p].name, jsonIn[CHAR_PROFILE_NAME] | "", sizeof(profiles[p].name));
+      // entries, the schedule of the channels if there are no channels
+      for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
+        if(jsonIn.containsKey(CHAR_CHANNELS)) {
+          if(c >= numOfChannels || channels[c].moonlight) continue;
+          profiles[p].numOfEntries[c] = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES].size();
+          if(profiles[p].numOfEntries[c] > MAX_NUM_OF_ENTRIES) profiles[p].numOfEntries[c] = MAX_NUM_OF_ENTRIES;
+          for(uint8_t i=0; i<profiles[p].numOfEntries[c]; i++) {
+            uint32_t t = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES][i];
+            float v = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_VALUES][i];
+            profiles[p].entries[c][i].minute = t / 60;
+            profiles[p].entries[c][i].value = lroundf(v * 100);
+          }
+        }
+        else {
+          profiles[p].numOfEntries[c] = channels[c].numOfEntries;
+          for(uint8_t i=0; i<channels[c].numOfEntries; i++) {
+            profiles[p].entries[c][i].minute = channels[c].t[i] / 60;
+            profiles[p].entries[c][i].value = lroundf(channels[c].v[i] * 100);
+          }
+        }
+        profiles[p].sortEntries(c);
+      }
+      // save profiles
+      pendingFlush |= FLUSH_PROFILES | FLUSH_RESOLVE | FLUSH_PWM;
+      break;
+    }
+
+    case ID_DELETE_PROFILE: {
+      DEBUG_INFO("ID_DELETE_PROFILE");
+      int8_t p = jsonIn[CHAR_PROFILE];
+      if(p < 0 || p >= numOfProfiles) break;
+      for(uint8_t i=p; i+1<numOfProfiles; i++) profiles[i] = profiles[i+1];
+      numOfProfiles--;
+      // the weekdays and dates of the profile fall back to the schedule
+      for(uint8_t d=0; d<7; d++) {
+        if(weekProfiles[d] == p) weekProfiles[d] = DEFAULT_PROFILE;
+        else if(weekProfiles[d] > p) weekProfiles[d]--;
+      }
+      for(uint8_t i=0; i<numOfDateOverrides; i++) {
+        if(dateOverrides[i].profile == p) dateOverrides[i].profile = DEFAULT_PROFILE;
+        else if(dateOverrides[i].profile > p) dateOverrides[i].profile--;
+      }
+      // save profiles
+      pendingFlush |= FLUSH_PROFILES | FLUSH_RESOLVE | FLUSH_PWM;
+      break;
+    }
+
+    case ID_SAVE_CALENDAR: {
+      DEBUG_INFO("ID_SAVE_CALENDAR");
+      // week profiles
+      for(uint8_t d=0; d<7; d++) weekProfiles[d] = jsonIn[CHAR_WEEK_PROFILES][d] | DEFAULT_PROFILE;
+      // date overrides
+      numOfDateOverrides = jsonIn[CHAR_DATE_OVERRIDES].size();
+      if(numOfDateOverrides > MAX_NUM_OF_DATE_OVERRIDES) numOfDateOverrides = MAX_NUM_OF_DATE_OVERRIDES;
+      for(uint8_t i=0; i<numOfDateOverrides; i++) {
+        dateOverrides[i].day = jsonIn[CHAR_DATE_OVERRIDES][i][CHAR_DATE];
+        dateOverrides[i].profile = jsonIn[CHAR_DATE_OVERRIDES][i][CHAR_PROFILE];
+      }
+      // acclimation
+      acclimationStart = jsonIn[CHAR_ACCLIMATION_START];
+      acclimationWeeks = jsonIn[CHAR_ACCLIMATION_WEEKS];
+      acclimationPercent = jsonIn[CHAR_ACCLIMATION_PERCENT];
+      // save profiles
+      pendingFlush |= FLUSH_PROFILES | FLUSH_RESOLVE | FLUSH_PWM;
+      break;
+    }
+
+    case ID_REQUEST_LOG_FROM_SERVER: {
+      uint32_t seq = jsonIn[CHAR_LOG_SEQ];
+      if(seq > logSequence) seq = logSequence;
+      if(logSequence - seq > LOG_NUM_OF_SLOTS) seq = logSequence - LOG_NUM_OF_SLOTS;
+
+      // create json
+      JsonObject& jsonOut = jsonBuffer.createObject();
+      // id
+      jsonOut["id"] = ID_SEND_LOG_TO_CLIENT;
+      // formatted records
+      JsonArray& jsonLines = jsonOut.createNestedArray(CHAR_LOG_LINES);
+      char line[LOG_LINE_SIZE];
+      for(uint8_t i=0; i<MAX_NUM_OF_LOG_LINES && seq != logSequence; i++, seq++) {
+        if(formatLogRecord(seq, line, sizeof(line))) jsonLines.add(jsonBuffer.strdup(line));
+      }
+      // sequence number of the next record
+      jsonOut[CHAR_LOG_SEQ] = seq;
+      // dropped records
+      jsonOut[CHAR_LOG_DROPPED] = logDropped;
+
+      // send json
+      sendJson(num, jsonOut);
+      break;
+    }
+
+    case ID_REQUEST_WATCHDOG_FROM_SERVER: {
+      // create json
+      JsonObject& jsonOut = jsonBuffer.createObject();
+      // id
+      jsonOut["id"] = ID_SEND_WATCHDOG_TO_CLIENT;
+      // dump of the last run
+      addWatchdogDump(jsonOut);
+
+      // send json
+      sendJson(num, jsonOut);
+      break;
+    }
+
+    case ID_RESTART: {
+      DEBUG_INFO("restart in 5s");
+      pendingFlush |= FLUSH_RESTART;
+      break;
+    }
+
+    case ID_FACTORY_SETTINGS: {
+      DEBUG_INFO("RESTORE_FACTORY_SETTINGS");
+      saveDefaultSettings();
+      loadSettings();
+      // the outputs, the effect, the sync and mqtt are restarted with the default settings, like after saving the settings
+      pendingFlush |= FLUSH_RESOLVE | FLUSH_OUTPUTS | FLUSH_PWM;
+      break;
+    }
+  }
+}
+
+
+/*
+ * Checks the command "op" of client "num" before it is applied
+ * "numOfScenes_" and "numOfProfiles_" are the number of scenes and profiles after the previous commands of a batch,
+ * they are updated if the command adds or deletes a scene or profile
+ * Over mqtt only the manual values, the scenes and the requests are allowed, anyone who can publish to the broker could send
+ * the other commands.
+ * returns NULL if the command is valid, the reason otherwise
+ */
+const char *validateCommand(const uint32_t num, JsonObject& op, uint8_t &numOfScenes_, uint8_t &numOfProfiles_) {
+  if(!op.containsKey("id")) return "no id";
+  uint8_t id = op["id"];
+  if(num == MQTT_CLIENT) {
+    switch(id) {
+      case ID_UPDATE_MANUAL:
+      case ID_RECALL_SCENE:
+      case ID_RELEASE_SCENE:
+      case ID_REQUEST_MANUAL_FROM_SERVER:
+      case ID_REQUEST_SCHEDULE_FROM_SERVER:
+      case ID_REQUEST_CURVE_FROM_SERVER:
+      case ID_REQUEST_SETTINGS_FROM_SERVER:
+      case ID_REQUEST_SCENES_FROM_SERVER:
+      case ID_REQUEST_PROFILES_FROM_SERVER:
+      case ID_REQUEST_LOG_FROM_SERVER:
+      case ID_REQUEST_WATCHDOG_FROM_SERVER:
+        break;
+      default:
+        return "not allowed by mqtt";
+    }
+  }
+  switch(id) {
+    case ID_REQUEST_MANUAL_FROM_SERVER:
+    case ID_REQUEST_SCHEDULE_FROM_SERVER:
+    case ID_REQUEST_CURVE_FROM_SERVER:
+    case ID_REQUEST_SETTINGS_FROM_SERVER:
+    case ID_REQUEST_SCENES_FROM_SERVER:
+    case ID_REQUEST_PROFILES_FROM_SERVER:
+    case ID_REQUEST_LOG_FROM_SERVER:
+    case ID_REQUEST_WATCHDOG_FROM_SERVER:
+    case ID_RELEASE_SCENE:
+    case ID_RESTART:
+    case ID_FACTORY_SETTINGS:
+      return NULL;
+
+    case ID_UPDATE_MANUAL:
+      for(uint8_t c=0; c<numOfChannels; c++) {
+        float v = op[CHAR_CHANNELS][c][CHAR_CHANNEL_VALUE];
+        if(v < 0 || v > 100) return "value out of range";
+      }
+      return NULL;
+
+    case ID_SAVE_SCHEDULE:
+    case ID_SAVE_PROFILE:
+      if(id == ID_SAVE_PROFILE) {
+        uint8_t p = op[CHAR_PROFILE];
+        if(p > numOfProfiles_ || p >= MAX_NUM_OF_PROFILES) return "profile out of range";
+        if(p == numOfProfiles_) numOfProfiles_++;
+      }
+      for(uint8_t c=0; c<op[CHAR_CHANNELS].size(); c++) {
+        JsonArray& times = op[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES];
+        JsonArray& values = op[CHAR_CHANNELS][c][CHAR_CHANNEL_VALUES];
+        if(times.size() > MAX_NUM_OF_ENTRIES) return "too many entries";
+        if(times.size() != values.size()) return "number of times and values differ";
+        for(uint8_t i=0; i<times.size(); i++) {
+          uint32_t t = times[i];
+          float v = values[i];
+          if(t >= 24*60*60) return "time out of range";
+          if(v < 0 || v > 100) return "value out of range";
+        }
+      }
+      return NULL;
+
+    case ID_SAVE_SETTINGS: {
+      // the numbers are read as int32_t, so values outside of their type do not wrap into the range
+      int32_t n = op[CHAR_NUM_OF_CHANNELS];
+      if(n < 1 || n > MAX_NUM_OF_CHANNELS) return "number of channels out of range";
+      if(op[CHAR_CHANNELS].size() < uint32_t(n)) return "missing channels";
+      int32_t generator = op[CHAR_PWM_GENERATOR];
+      if(generator < PWM_GENERATOR_ESP8266 || generator > PWM_GENERATOR_RECORDING) return "pwm generator out of range";
+      int32_t powerLimit = op[CHAR_POWER_LIMIT_MODE];
+      if(powerLimit < POWER_LIMIT_PROPORTIONAL || powerLimit > POWER_LIMIT_PRIORITY) return "power limit mode out of range";
+      int32_t effect_ = op[CHAR_EFFECT];
+      if(effect_ < EFFECT_NONE || effect_ > EFFECT_STORM) return "effect out of range";
+      int32_t sync = op[CHAR_SYNC_MODE];
+      if(sync < SYNC_OFF || sync > SYNC_FOLLOWER) return "sync mode out of range";
+      int32_t port = op[CHAR_MQTT_PORT];
+      if(port < 0 || port > 0xFFFF) return "mqtt port out of range";
+      for(uint8_t c=0; c<n; c++) {
+        // the pins are only used by the ESP8266, the GPIOs 6 to 11 are connected to the flash
+        int32_t pin = op[CHAR_CHANNELS][c][CHAR_CHANNEL_PIN];
+        if(generator == PWM_GENERATOR_ESP8266 && (pin < 0 || pin > 16 || (pin >= 6 && pin <= 11))) return "pin out of range";
+        if(strlen(op[CHAR_CHANNELS][c][CHAR_CHANNEL_NAME] | "") > LEN_CHANNEL_NAME) return "channel name too long";
+        if(strlen(op[CHAR_CHANNELS][c][CHAR_CHANNEL_COLOR] | "") > LEN_CHANNEL_COLOR) return "channel color too long";
+        int32_t priority = op[CHAR_CHANNELS][c][CHAR_CHANNEL_PRIORITY];
+        if(priority < 0 || priority >= NUM_OF_PRIORITIES) return "priority out of range";
+        int32_t interpolation = op[CHAR_CHANNELS][c][CHAR_CHANNEL_INTERPOLATION];
+        if(interpolation < INTERPOLATION_LINEAR || interpolation > INTERPOLATION_CUBIC) return "interpolation out of range";
+      }
+      if(strlen(op[CHAR_MQTT_HOST] | "") > LEN_MQTT_HOST) return "mqtt host too long";
+      if(strlen(op[CHAR_MQTT_TOPIC] | "") > LEN_MQTT_TOPIC) return "mqtt topic too long";
+      if(strlen(op[CHAR_MQTT_USER] | "") > LEN_MQTT_USER) return "mqtt user too long";
+      if(strlen(op[CHAR_MQTT_PASSWORD] | "") > LEN_MQTT_PASSWORD) return "mqtt password too long";
+      if(strlen(op[CHAR_OTA_PASSWORD] | "") > LEN_OTA_PASSWORD) return "update password too long";
+      return NULL;
+    }
+
+    case ID_SAVE_SCENE: {
+      uint8_t s = op[CHAR_SCENE];
+      if(s > numOfScenes_ || s >= MAX_NUM_OF_SCENES) return "scene out of range";
+      if(s == numOfScenes_) numOfScenes_++;
+      return NULL;
+    }
+
+    case ID_DELETE_SCENE: {
+      uint8_t s = op[CHAR_SCENE];
+      if(s >= numOfScenes_) return "scene out of range";
+      numOfScenes_--;
+      return NULL;
+    }
+
+    case ID_RECALL_SCENE: {
+      uint8_t s = op[CHAR_SCENE];
+      if(s >= numOfScenes_) return "scene out of range";
+      return NULL;
+    }
+
+    case ID_DELETE_PROFILE: {
+      uint8_t p = op[CHAR_PROFILE];
+      if(p >= numOfProfiles_) return "profile out of range";
+      numOfProfiles_--;
+      return NULL;
+    }
+
+    case ID_SAVE_CALENDAR:
+      // the profiles are read as int32_t, so values outside of int8_t do not wrap into the range
+      for(uint8_t d=0; d<7; d++) {
+        int32_t p = op[CHAR_WEEK_PROFILES][d] | int32_t(DEFAULT_PROFILE);
+        if(p < DEFAULT_PROFILE || p >= numOfProfiles_) return "profile out of range";
+      }
+      if(op[CHAR_DATE_OVERRIDES].size() > MAX_NUM_OF_DATE_OVERRIDES) return "too many dates";
+      for(uint8_t i=0; i<op[CHAR_DATE_OVERRIDES].size(); i++) {
+        int32_t p = op[CHAR_DATE_OVERRIDES][i][CHAR_PROFILE];
+        if(p < DEFAULT_PROFILE || p >= numOfProfiles_) return "profile out of range";
+        // the date is stored as local days since 1.1.1970 in 16 bits
+        int32_t day = op[CHAR_DATE_OVERRIDES][i][CHAR_DATE];
+        if(day <= 0 || day > 0xFFFF) return "date out of range";
+      }
+      return NULL;
+  }
+  return "unknown id";
+}
 
 
 /*
- * called if there is interaction with the websocket.
- * can be eiter
- *  - Disconnected
- *  - Connected
+ * Applies the batch "jsonIn" received from client "num"
+ * All commands in "ops" are validated first, if one of them is invalid, none of them is applied.
+ * Otherwise they are applied in their order and the settings and profiles are saved and the PWM
+ * is updated only once afterwards. The client gets the status of each command in a json with id
+ * "ID_BATCH_RESULT".
+ */
+void applyBatch(const uint32_t num, JsonObject& jsonIn, DynamicJsonBuffer& jsonBuffer) {
+  JsonArray& ops = jsonIn[CHAR_BATCH_OPS];
+  JsonObject& jsonOut = jsonBuffer.createObject();
+  jsonOut["id"] = ID_BATCH_RESULT;
+  JsonArray& jsonResults = jsonOut.createNestedArray(CHAR_BATCH_RESULTS);
+
+  // validate all commands
+  uint8_t numOfScenes_ = numOfScenes;
+  uint8_t numOfProfiles_ = numOfProfiles;
+  bool valid = ops.size() > 0;
+  for(JsonObject& op : ops) {
+    JsonObject& jsonResult = jsonResults.createNestedObject();
+    const char *error = op.success() ? validateCommand(num, op, numOfScenes_, numOfProfiles_) : "no command";
+    if(error == NULL && op["id"] == ID_BATCH) error = "nested batch";
+    jsonResult[CHAR_BATCH_STATUS] = error ? BATCH_STATUS_INVALID : BATCH_STATUS_OK;
+    if(error) {
+      jsonResult[CHAR_BATCH_ERROR] = error;
+      valid = false;
+    }
+  }
+  DEBUG_INFO("[applyBatch] %d commands, valid: %d", ops.size(), valid);
+
+  // apply all commands or none of them
+  if(valid) {
+    for(JsonObject& op : ops) applyCommand(num, op, jsonBuffer);
+  }
+  else {
+    for(JsonObject& jsonResult : jsonResults) {
+      if(jsonResult[CHAR_BATCH_STATUS] == BATCH_STATUS_OK) jsonResult[CHAR_BATCH_STATUS] = BATCH_STATUS_SKIPPED;
+    }
+  }
+  jsonOut[CHAR_BATCH_APPLIED] = valid;
+
+  // send json
+  sendJson(num, jsonOut);
+}
+
+
+/*
+ * Does the work collected in "pendingFlush" by the applied commands
+ * the settings and profiles are saved once, the outputs are reconfigured once and the PWM is updated once
+ */
+void flushCommands() {
+  uint8_t flush = pendingFlush;
+  pendingFlush = 0;
+  if(flush & FLUSH_RESOLVE) resolveProfiles();
+  if(flush & FLUSH_SETTINGS) saveSettings();
+  if(flush & FLUSH_PROFILES) saveProfiles();
+  if(flush & FLUSH_SECRETS) saveSecrets();
+  if(flush & FLUSH_OUTPUTS) {
+    configurePWM();
+    resetPowerLimit();
+  }
+  if(flush & (FLUSH_PWM | FLUSH_OUTPUTS)) handlePWM(true);
+  if(flush & FLUSH_OUTPUTS) {
+    startEffects();
+    startSync();
+    startMqtt();
+  }
+  if(flush & FLUSH_RESTART) {
+    delay(5000);
+    holdOutputs();
+    ESP.restart();
+  }
+}
+
+
+/*
+ * called from the main loop for each text message received by the websocket, see "webSocketEvent".
  *  - Text
  *      The function is parsing the incoming String as a JSON object and acts according to
  *      the "id" of the incoming json to return data back to the websocket client or
  *      to save data eg.
+ *      The answers to ID_REQUEST_MANUAL_FROM_SERVER, ID_REQUEST_SCHEDULE_FROM_SERVER and ID_REQUEST_SETTINGS_FROM_SERVER
+ *      contain the revision "rev" of the data. If the request contains the same "rev", the answer is marked "unchanged"
+ *      and only contains the "time" and the other state that changes without a new revision.
  *            
  *      id's are
  *      ID_REQUEST_MANUAL_FROM_SERVER:
- *        The "name", "color", "value", "manual" and "moonlight" of the active channels are send to the client
- *        in a json with id "ID_SEND_MANUAL_TO_CLIENT" to display a table with the current values that can be changed 
- *        manually from the client.
+ *        The "name", "color", "value", "output", "manual" and "moonlight" of the active channels and the "powerLimitFactor"
+ *        are send to the client in a json with id "ID_SEND_MANUAL_TO_CLIENT" to display a table with the current values
+ *        that can be changed manually from the client.
  *        
  *      ID_UPDATE_MANUAL:
  *        "value" and "mode" of the channels are updated according to the incomming JSON 
- *        and a PWM Update is forced
+ *        and a PWM Update is forced. The active scene and all fades are stopped.
  *        
  *      ID_REQUEST_SCHEDULE_FROM_SERVER:
- *        The "name", "color", "values", "times" and "moonlight" of the active channels and the "time" are send to the client
+ *        The "name", "color", "values", "times", "interpolation" and "moonlight" of the active channels and the "time" are send to the client
  *        in a json with id "ID_SEND_SCHEDULE_TO_CLIENT" to display the Schedule in a chart together with the current time
  *        
  *      ID_SAVE_SCHEDULE:
  *        The "times" and "values" of the channels are updated according to the incomming JSON and the new values are stored to the
- *        "SETTINGS_FILE" in the SPIFFS.
+ *        "SETTINGS_FILE" in the flash. The segments of the schedule are computed again.
  *        A PWM update is forced.
  *        
  *      ID_REQUEST_SETTINGS_FROM_SERVER:
@@ -80,251 +1033,204 @@ WebSocketsServer webSocket = WebSocketsServer(81); // websocket object
  *        client
  *        
  *      ID_SAVE_SETTINGS:
- *        The (changed) settings are send back from the client, updated and stored in the "SETTINGS_FILE" in the SPIFFS
+ *        The (changed) settings are send back from the client, updated and stored in the "SETTINGS_FILE" in the flash
+ *        A PWM update is forced, so a changed power limit is applied immediately.
  *        A restart of the ESP8266 is might necessary
  *        
+ *      ID_REQUEST_SCENES_FROM_SERVER:
+ *        The "scenes" and the "activeScene" are send to the client in a json with id "ID_SEND_SCENES_TO_CLIENT"
+ *
+ *      ID_SAVE_SCENE:
+ *        The scene with number "scene" is updated or a new scene is added if "scene" is equal to the number of scenes.
+ *        If the incomming JSON contains no "values", the current values of the channels are stored in the scene.
+ *        The scenes are stored to the "SETTINGS_FILE" in the flash.
+ *
+ *      ID_DELETE_SCENE:
+ *        The scene with number "scene" is deleted and the scenes are stored to the "SETTINGS_FILE" in the flash.
+ *
+ *      ID_RECALL_SCENE:
+ *        The channels fade to the scene with number "scene" within "fade" seconds. If "duration" is greater than 0,
+ *        the channels fade back to the schedule after "duration" seconds.
+ *
+ *      ID_RELEASE_SCENE:
+ *        The channels fade back to the schedule within "fade" seconds.
+ *
+ *      ID_REQUEST_PROFILES_FROM_SERVER:
+ *        The "profiles" with the "times" in s and the "values" in % of the active channels, the profile of each weekday
+ *        "week", the "dates" with their own profile, the acclimation and the "activeProfile" of "today" are send to the
+ *        client in a json with id "ID_SEND_PROFILES_TO_CLIENT"
+ *
+ *      ID_SAVE_PROFILE:
+ *        The profile with number "profile" is updated or a new profile is added if "profile" is equal to the number of
+ *        profiles. If the incomming JSON contains no "channels", the schedule of the channels is copied to the profile.
+ *        The profiles are stored to the "PROFILES_FILE" in the flash and the profile of the day is resolved again.
+ *
+ *      ID_DELETE_PROFILE:
+ *        The profile with number "profile" is deleted, the weekdays and dates using it fall back to the schedule.
+ *
+ *      ID_SAVE_CALENDAR:
+ *        The profile of each weekday "week", the "dates" with their own profile and the acclimation are updated,
+ *        stored to the "PROFILES_FILE" in the flash and the profile of the day is resolved again.
+ *
+ *      ID_REQUEST_LOG_FROM_SERVER:
+ *        The log records starting with sequence number "seq" are send to the client in a json with id "ID_SEND_LOG_TO_CLIENT"
+ *        as formatted "lines" together with the next "seq" and the number of "dropped" records. If the records have already
+ *        been overwritten, the oldest available record is send first.
+ *
+ *      ID_REQUEST_WATCHDOG_FROM_SERVER:
+ *        The reason of the last reset and the dump of the watchdog from the RTC memory are send to the client in a json
+ *        with id "ID_SEND_WATCHDOG_TO_CLIENT", see "addWatchdogDump".
+ *
+ *      ID_BATCH:
+ *        The commands in "ops" are json objects with one of the ids above. They are all checked first, if one of them is
+ *        invalid, none of them is applied. Otherwise they are applied in their order, the settings and profiles are stored
+ *        once and the PWM is updated once. The "status" of each command (BATCH_STATUS_*) with its "error" and whether the
+ *        batch was "applied" are send to the client in a json with id "ID_BATCH_RESULT". A single command is checked the
+ *        same way and ignored if it is invalid.
+ *
  *      ID_RESTART:
  *        The ESP8266 restarts. There might be a problem on the first restart, so the power must be disconnected.
  *        
  *      ID_FACTORY_SETTINGS:
  *        restores the Settings in "SETTINGS_FILE" to the settings after a new flash of the firmware
  */
-void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t lenght) {
+void handleWebSocketMessage(const uint32_t num, char *payload) {
+  wsMessages++;
+  unsigned long startMillis = millis();
+  // Parsing the incoming JSON
+  DynamicJsonBuffer jsonBuffer;
+  JsonObject& jsonIn = jsonBuffer.parseObject(payload);
+  if (!jsonIn.success()) {
+    DEBUG_WARNING("[webSocket_event] parsing of the incoming JSON failed");
+    wsInvalidMessages++;
+    return;
+  }
+
+  // check for ID
+  if (!jsonIn.containsKey("id")) {
+    DEBUG_WARNING("[webSocket_event] no id in the incomming json");
+    wsInvalidMessages++;
+    return;
+  }
+  uint8_t id = jsonIn["id"];
+  DEBUG_INFO("id of the msg: %d", id);
+
+  if(id == ID_BATCH) {
+    applyBatch(num, jsonIn, jsonBuffer);
+  }
+  else {
+    uint8_t numOfScenes_ = numOfScenes;
+    uint8_t numOfProfiles_ = numOfProfiles;
+    const char *error = validateCommand(num, jsonIn, numOfScenes_, numOfProfiles_);
+    if(error) {
+      DEBUG_WARNING("[webSocket_event] invalid command %d: %s", id, error);
+      wsInvalidMessages++;
+      return;
+    }
+    applyCommand(num, jsonIn, jsonBuffer);
+  }
+  flushCommands();
+  if(millis() - startMillis > wsMaxMessageMillis) wsMaxMessageMillis = millis() - startMillis;
+}
+
+
+/*
+ * Adds the websocket message "payload" of client "num" to "wsQueue", it is handled later by "handleServer" in the main loop
+ * "payload" is allocated on the heap and freed after it is handled. If the queue is full, the message is dropped.
+ * The callbacks of the server are never run while the main loop runs, so the queue needs no lock.
+ */
+void queueMessage(const uint32_t num, char *payload) {
+  if(wsQueueLength == WS_QUEUE_SIZE) {
+    DEBUG_WARNING("[queueMessage] queue full, message of client %u dropped", num);
+    wsDroppedMessages++;
+    free(payload);
+    return;
+  }
+  QueuedMessage &message = wsQueue[(wsQueueHead + wsQueueLength) % WS_QUEUE_SIZE];
+  message.client = num;
+  message.payload = payload;
+  wsQueueLength++;
+}
+
+
+/*
+ * Handles the events of the websocket, called by the TCP stack
+ * The parts of a text message are collected in a buffer of the client and the complete message is queued for the
+ * main loop, see "queueMessage". Fragmented messages and messages larger than "MAX_WS_MESSAGE_SIZE" are dropped.
+ */
+void webSocketEvent(AsyncWebSocket *socket, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
   switch (type) {
-    case WStype_DISCONNECTED:
-      DEBUG_INFO("[%u] Disconnected!", num);
+    case WS_EVT_DISCONNECT:
+      DEBUG_INFO("[%u] Disconnected!", client->id());
+      free(client->_tempObject);
+      client->_tempObject = NULL;
       break;
-      
-    case WStype_CONNECTED: {
-      IPAddress ip = webSocket.remoteIP(num);
-      DEBUG_INFO("[%u] Connected from %d.%d.%d.%d url: %s", num, ip[0], ip[1], ip[2], ip[3], payload);
+
+    case WS_EVT_CONNECT: {
+      IPAddress ip = client->remoteIP();
+      DEBUG_INFO("[%u] Connected from %d.%d.%d.%d", client->id(), ip[0], ip[1], ip[2], ip[3]);
       }
       break;
-      
-    case WStype_TEXT:
-      // Parsing the incoming JSON
-      DynamicJsonBuffer jsonBuffer;
-      JsonObject& jsonIn = jsonBuffer.parseObject(payload);
-      if (!jsonIn.success()) {
-        DEBUG_WARNING("[webSocket_event] parsing of the incoming JSON failed");
-        return;
-      }
 
-      // check for ID
-      if (!jsonIn.containsKey("id")) {
-        DEBUG_WARNING("[webSocket_event] no id in the incomming json");
+    case WS_EVT_DATA: {
+      AwsFrameInfo *info = (AwsFrameInfo*)arg;
+      if(!info->final || info->num != 0 || info->opcode != WS_TEXT || info->len > MAX_WS_MESSAGE_SIZE) {
+        if(info->index == 0) {
+          DEBUG_WARNING("[webSocketEvent] message of client %u not supported", client->id());
+          wsDroppedMessages++;
+        }
         return;
       }
-      uint8_t id = jsonIn["id"];
-      DEBUG_INFO("id of the msg: %d", id);
-      //jsonIn.prettyPrintTo(DEBUG_PORT);
-      DEBUG_INFO("");
-           
-      switch(id) {
-
-        case ID_REQUEST_MANUAL_FROM_SERVER: {
-          DEBUG_INFO("ID_REQUEST_INDEX_FROM_SERVER");
-
-          // create json
-          JsonObject& jsonOut = jsonBuffer.createObject();
-          // id
-          jsonOut["id"] = ID_SEND_MANUAL_TO_CLIENT;
-          // channels array
-          JsonArray& jsonChannels = jsonOut.createNestedArray(CHAR_CHANNELS);
-          for(uint8_t c=0; c<numOfChannels; c++) {
-            JsonObject& jsonChannelsChannel = jsonChannels.createNestedObject();
-            // channel name
-            jsonChannelsChannel[CHAR_CHANNEL_NAME] = jsonBuffer.strdup(channels[c].name);
-            // channel color
-            jsonChannelsChannel[CHAR_CHANNEL_COLOR] = jsonBuffer.strdup(channels[c].color);
-            // channel manual
-            jsonChannelsChannel[CHAR_CHANNEL_MANUAL] = channels[c].manual;
-            // channel moonlight
-            jsonChannelsChannel[CHAR_CHANNEL_MOONLIGHT] = channels[c].moonlight;
-            // channel pwm value
-            jsonChannelsChannel[CHAR_CHANNEL_VALUE] = channels[c].value;
-          }
-          
-          // send json
-          String jsonOutStr;
-          jsonOut.printTo(jsonOutStr);
-          webSocket.sendTXT(0,jsonOutStr);
-          break;
-        }
-
-        case ID_UPDATE_MANUAL: {
-          DEBUG_INFO("ID_UPDATE_MANUAL");
-          for(uint8_t c=0; c<numOfChannels; c++) {
-            if(!channels[c].moonlight) {
-              channels[c].manual = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_MANUAL];
-              channels[c].value = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_VALUE];
-            }
-          }
-          // forces PWM update
-          handlePWM(true);
-          break;             
+      char *payload = (char*)client->_tempObject;
+      if(info->index == 0) {
+        free(payload);
+        payload = (char*)malloc(info->len + 1);
+        client->_tempObject = payload;
+        if(!payload) {
+          DEBUG_WARNING("[webSocketEvent] no memory for the message of client %u", client->id());
+          wsDroppedMessages++;
         }
-        
-        case ID_REQUEST_SCHEDULE_FROM_SERVER: {
-          DEBUG_INFO("ID_REQUEST_SCHEDULE_FROM_SERVER");
-
-          // create json
-          JsonObject& jsonOut = jsonBuffer.createObject();
-          // id
-          jsonOut["id"] = ID_SEND_SCHEDULE_TO_CLIENT;
-          // time
-          jsonOut[CHAR_TIME] = getLocalSecondsOfTheDay();
-          // max num of entries
-          jsonOut[CHAR_MAX_NUM_OF_ENTRIES] = MAX_NUM_OF_ENTRIES;
-          // channels
-          JsonArray& jsonChannels = jsonOut.createNestedArray(CHAR_CHANNELS);
-          for(uint8_t c=0; c<numOfChannels; c++) {
-            JsonObject& jsonChannelsChannel = jsonChannels.createNestedObject();
-            // channel name
-            jsonChannelsChannel[CHAR_CHANNEL_NAME] = jsonBuffer.strdup(channels[c].name);
-            // channel color
-            jsonChannelsChannel[CHAR_CHANNEL_COLOR] = jsonBuffer.strdup(channels[c].color);
-            // channel moonlight
-            jsonChannelsChannel[CHAR_CHANNEL_MOONLIGHT] = channels[c].moonlight;
-            
-            // times array
-            JsonArray& jsonChannelsChannelT = jsonChannelsChannel.createNestedArray(CHAR_CHANNEL_TIMES);
-            // values array
-            JsonArray& jsonChannelsChannelV = jsonChannelsChannel.createNestedArray(CHAR_CHANNEL_VALUES);
-            for(uint8_t i=0; i<channels[c].numOfEntries; i++) {
-              jsonChannelsChannelT.add(channels[c].t[i]);
-              jsonChannelsChannelV.add(channels[c].v[i]);
-            }
-          }
+      }
+      if(!payload) return;
+      memcpy(payload + info->index, data, len);
+      if(info->index + len < info->len) return;
+      payload[info->len] = 0;
+      client->_tempObject = NULL;
+      queueMessage(client->id(), payload);
+      }
+      break;
 
-          // send json
-          String jsonOutStr;
-          jsonOut.printTo(jsonOutStr);
-          webSocket.sendTXT(0,jsonOutStr);
-          break;
-        }
+    default:
+      break;
+  }
+}
 
-        case ID_SAVE_SCHEDULE: {
-          DEBUG_INFO("ID_SAVE_SCHEDULE");
-          for(uint8_t c=0; c<numOfChannels; c++) {
-            if(!channels[c].moonlight) {
-              channels[c].numOfEntries = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES].size();
-              for(uint8_t i=0; i<channels[c].numOfEntries ;i++) {
-                channels[c].v[i] = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_VALUES][i];
-                channels[c].t[i] = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES][i];
-              }
-            }
-          }
-          // save Settings
-          saveSettings();
-          // forces PWM Update
-          handlePWM(true);
-          break;
-        }
-        
-        case ID_REQUEST_SETTINGS_FROM_SERVER: {
-          DEBUG_INFO("ID_REQUEST_SETTINGS_FROM_SERVER");
-
-          // create json
-          JsonObject& jsonOut = jsonBuffer.createObject();
-          // id
-          jsonOut["id"] = ID_SEND_SETTINGS_TO_CLIENT;
-          // number of channels
-          jsonOut[CHAR_NUM_OF_CHANNELS] = numOfChannels;
-          // maximum number of channels
-          jsonOut[CHAR_MAX_NUM_OF_CHANNELS] = MAX_NUM_OF_CHANNELS;
-          // timezone
-          jsonOut[CHAR_TIMEZONE] = timezone;
-          // time
-          jsonOut[CHAR_TIME] = epochTime();
-          // PWMFrequency
-          jsonOut[CHAR_PWM_FREQUENCY] = PWMFrequency;
-          // pwm generator
-          jsonOut[CHAR_PWM_GENERATOR] = PWMGenerator;
-          // current power
-          float p=0;
-          for(uint8_t c=0; c<numOfChannels; c++) {
-            p += channels[c].value / 100. * channels[c].power;
-          }
-          jsonOut[CHAR_CURRENT_POWER] = p;
-          // channels
-          JsonArray& jsonChannels = jsonOut.createNestedArray(CHAR_CHANNELS);
-          for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
-            JsonObject& jsonChannelsChannel = jsonChannels.createNestedObject();
-            // channel name
-            jsonChannelsChannel[CHAR_CHANNEL_NAME] = jsonBuffer.strdup(channels[c].name);
-            // channel color
-            jsonChannelsChannel[CHAR_CHANNEL_COLOR] = jsonBuffer.strdup(channels[c].color);
-            // channel moonlight
-            jsonChannelsChannel[CHAR_CHANNEL_MOONLIGHT] = channels[c].moonlight;
-            // channel max moonlight value
-            jsonChannelsChannel[CHAR_CHANNEL_MAX_MOONLIGHT_VALUE] = channels[c].maxMoonlightValue;
-            // channel power
-            jsonChannelsChannel[CHAR_CHANNEL_POWER] = channels[c].power;
-            // channel pin
-            jsonChannelsChannel[CHAR_CHANNEL_PIN] = channels[c].pin;
-          }
-          
-          // send json
-          String jsonOutStr;
-          jsonOut.printTo(jsonOutStr);
-          webSocket.sendTXT(0,jsonOutStr);
-          break;  
-        } 
-
-        case ID_SAVE_SETTINGS: {
-          DEBUG_INFO("ID_REQUEST_SAVE_SETTINGS");
-          
-          // number of channels
-          numOfChannels = jsonIn[CHAR_NUM_OF_CHANNELS];
-          // timezone
-          timezone = jsonIn[CHAR_TIMEZONE];
-          // PWMFrequency
-          PWMFrequency= jsonIn[CHAR_PWM_FREQUENCY];
-          setPWMFrequency(PWMFrequency);
-          // pwm generator
-          PWMGenerator = jsonIn[CHAR_PWM_GENERATOR];
-          
-          //channels
-          for(uint8_t c=0; c<numOfChannels; c++) {
-        
-            // channel number
-            channels[c].channelNumber = c;
-            // channel name
-            strcpy(channels[c].name, jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_NAME]); 
-            // channel color
-            strcpy(channels[c].color, jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_COLOR]); 
-            // channel moonlight
-            channels[c].moonlight = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_MOONLIGHT];
-            // channel max moonlight value
-            channels[c].maxMoonlightValue = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_MAX_MOONLIGHT_VALUE];
-            // channel pin
-            channels[c].pin = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_PIN];
-            // channel power
-            channels[c].power = jsonIn[CHAR_CHANNELS][c][CHAR_CHANNEL_POWER];
-          }
-          
-          // saves the new settings to EEPROM
-          saveSettings();
-
-          break;
-       }
-     
-        case ID_RESTART: {
-          DEBUG_INFO("restart in 5s");
-          delay(5000);
-          ESP.restart();
-          break;
-        }
 
-        case ID_FACTORY_SETTINGS: {
-          DEBUG_INFO("RESTORE_FACTORY_SETTINGS");
-          saveDefaultSettings();
-          loadSettings();
-          break;
-        }
-     }
+/*
+ * Handles "request" with "handler" in the main loop, for requests that take too long or change too much for the
+ * callbacks of the server. "handler" reads the arguments first and answers with "sendDeferred". Only one request is
+ * deferred at a time, others are answered with 503.
+ */
+bool deferRequest(AsyncWebServerRequest *request, void (*handler)(AsyncWebServerRequest *request)) {
+  if(deferredHandler) {
+    request->send(503, F("text/plain"), F("Busy, try again later"));
+    return false;
   }
+  deferredRequest = request;
+  deferredHandler = handler;
+  request->onDisconnect([request]() {
+    if(deferredRequest == request) deferredRequest = NULL;
+  });
+  return true;
+}
+
+
+/*
+ * Answers the deferred request, nothing is sent if the client is already gone
+ */
+void sendDeferred(const int code, const String& contentType, const String& content) {
+  if(deferredRequest) deferredRequest->send(code, contentType, content);
+  deferredRequest = NULL;
 }
 
 
@@ -334,28 +1240,56 @@ void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t lenght
 void startServer() {
   DEBUG_INFO("[startServer]");
   
-  // starts the SPIFFS fileystem
-  startSPIFFS();
+  // mounts the file system
+  startStorage();
   
-  server.onNotFound([] { server.send(404, F("text/plain"), F("Website not found")); });
-  server.serveStatic("/", SPIFFS, "/main.html");
-  server.serveStatic("/script.js", SPIFFS, "/script.js");
-  server.serveStatic("/style.css", SPIFFS, "/style.css");
-  server.serveStatic("/settings", SPIFFS, SETTINGS_FILE_NAME);
-  server.begin();
-
-  delay(50);
-
-  webSocket.begin();                          // start the websocket server
   webSocket.onEvent(webSocketEvent);          // if there's an incomming websocket message, go to function 'webSocketEvent'
+  server.addHandler(&webSocket);
+
+  server.onNotFound([](AsyncWebServerRequest *request) { request->send(404, F("text/plain"), F("Website not found")); });
+  server.on("/settings", HTTP_GET, handleSettingsFile);
+  server.on("/schedule.csv", HTTP_GET, handleScheduleExportCSV);
+  server.on("/schedule.json", HTTP_GET, handleScheduleExportJSON);
+  server.on("/schedule", HTTP_POST, handleScheduleImport, handleScheduleUpload);
+  server.on("/simulate", HTTP_GET, handleSimulation);
+  server.on("/benchmark", HTTP_GET, handleBenchmark);
+  server.on("/metrics", HTTP_GET, handleMetrics);
+  server.on("/idle", HTTP_GET, handleIdleRequest);
+  server.on("/update", HTTP_POST, handleUpdate, handleUpdateUpload);
+#ifndef STORAGE_IN_MEMORY
+  // only the files of the website are served, the settings, profiles and passwords in the same file system are not
+  // the files are streamed from the flash in chunks, so they need not fit into the memory
+  // the memory storage has no file system, so a build with it has no website
+  for(const char *file : WEBSITE_FILES) server.serveStatic(file, StorageBackend::fileSystem(), file);
+  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) { request->send(StorageBackend::fileSystem(), WEBSITE_FILES[0], F("text/html")); });
+#endif
+  server.begin();
 }
 
 
 /*
- * Listen if there is a event of the webserver or the websocket
+ * Handles one received websocket message and the deferred http request
+ * The network I/O is done by the TCP stack in the background, so the main loop never waits for a client.
  * Function is called in Main loop
  */
 void handleServer() {
-  server.handleClient();
-  webSocket.loop();
+  if(wsQueueLength > 0) {
+    QueuedMessage message = wsQueue[wsQueueHead];
+    wsQueueHead = (wsQueueHead + 1) % WS_QUEUE_SIZE;
+    wsQueueLength--;
+    handleWebSocketMessage(message.client, message.payload);
+    free(message.payload);
+  }
+  if(deferredHandler) {
+    if(deferredRequest) deferredHandler(deferredRequest);
+    deferredRequest = NULL;
+    deferredHandler = NULL;
+  }
+  // closes the oldest clients if there are too many
+  webSocket.cleanupClients();
+}
+
+
+bool serverIdle() {
+  return wsQueueLength == 0 && deferredHandler == NULL;
 }
@@ -17,10 +17,73 @@
 #define SERVER__H
 
 #include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+
+// constants for the Websocket interaction 
+static const uint8_t ID_REQUEST_MANUAL_FROM_SERVER = 0;
+static const uint8_t ID_SEND_MANUAL_TO_CLIENT = 1;
+static const uint8_t ID_UPDATE_MANUAL = 2;
+
+static const uint8_t ID_REQUEST_SCHEDULE_FROM_SERVER = 10;
+static const uint8_t ID_SEND_SCHEDULE_TO_CLIENT = 11;
+static const uint8_t ID_SAVE_SCHEDULE = 12;
+static const uint8_t ID_REQUEST_CURVE_FROM_SERVER = 13;
+static const uint8_t ID_SEND_CURVE_TO_CLIENT = 14;
+
+static const uint8_t ID_REQUEST_SETTINGS_FROM_SERVER = 20;
+static const uint8_t ID_SEND_SETTINGS_TO_CLIENT = 21;
+static const uint8_t ID_SAVE_SETTINGS = 22;
+
+static const uint8_t ID_REQUEST_SCENES_FROM_SERVER = 30;
+static const uint8_t ID_SEND_SCENES_TO_CLIENT = 31;
+static const uint8_t ID_SAVE_SCENE = 32;
+static const uint8_t ID_DELETE_SCENE = 33;
+static const uint8_t ID_RECALL_SCENE = 34;
+static const uint8_t ID_RELEASE_SCENE = 35;
+
+static const uint8_t ID_REQUEST_PROFILES_FROM_SERVER = 70;
+static const uint8_t ID_SEND_PROFILES_TO_CLIENT = 71;
+static const uint8_t ID_SAVE_PROFILE = 72;
+static const uint8_t ID_DELETE_PROFILE = 73;
+static const uint8_t ID_SAVE_CALENDAR = 74;
+
+static const uint8_t ID_REQUEST_LOG_FROM_SERVER = 60;
+static const uint8_t ID_SEND_LOG_TO_CLIENT = 61;
+static const uint8_t ID_REQUEST_WATCHDOG_FROM_SERVER = 62;
+static const uint8_t ID_SEND_WATCHDOG_TO_CLIENT = 63;
+
+static const uint8_t ID_BATCH = 40;
+static const uint8_t ID_BATCH_RESULT = 41;
+
+// files of the website in the file system, the first one is the start page
+static const char * const WEBSITE_FILES[] = {"/main.html", "/script.js", "/style.css"};
+
+static const uint8_t ID_RESTART = 50;
+static const uint8_t ID_FACTORY_SETTINGS = 51;
+
+// global variables
+extern AsyncWebServer server; // webserver object, also serves the websocket
+extern String *capturedReply; // if set, the replies are stored there instead of being sent, e.g. by the benchmark
 
 // handles the server and websocket in the main loop
 void handleServer();
 // starts the server and the websocket
 void startServer();
+// returns true if no websocket message and no http request is waiting for the main loop
+bool serverIdle();
+// applies the command "jsonIn" of client "num", the settings are not saved and the PWM is not updated
+void applyCommand(const uint32_t num, JsonObject& jsonIn, DynamicJsonBuffer& jsonBuffer);
+// sends "jsonOut" to client "num"
+void sendJson(const uint32_t num, JsonObject& jsonOut);
+// sends the binary message "data" with "len" bytes to client "num"
+void sendBinary(const uint32_t num, const uint8_t *data, const size_t len);
+// adds the command "payload" of client "num" to the queue of "handleServer", "payload" is freed after it is handled
+void queueMessage(const uint32_t num, char *payload);
+// handles "request" with "handler" in the main loop, "handler" answers with "sendDeferred"
+// returns false if another request is deferred, "request" is answered with 503 then
+bool deferRequest(AsyncWebServerRequest *request, void (*handler)(AsyncWebServerRequest *request));
+// answers the deferred request if the client is still connected
+void sendDeferred(const int code, const String& contentType, const String& content);
 
 #endif
@@ -18,17 +18,27 @@
 #include "server.h"
 #include "debug.h"
 #include "ntp.h"
+#include "effects.h"
+#include "scenes.h"
+#include "sync.h"
+#include "mqtt.h"
+#include "profiles.h"
+#include "storage.h"
+#include "ota.h"
 #include <ArduinoJson.h>
-#include <FS.h>
 
-bool SPIFFS_started = false;
+uint32_t revisionChannels = 0;
+uint32_t revisionSchedule = 0;
+uint32_t revisionSettings = 0;
+uint32_t revisionProfiles = 0;
 
 
 bool saveDefaultSettings() {
   DEBUG_INFO("[saveDefaultSettings]");
 
-  // starts the SPIFFS fileystem
-  startSPIFFS();
+  // there are no profiles and no passwords in the default settings
+  removeFile(PROFILES_FILE_NAME);
+  removeFile(SECRETS_FILE_NAME);
   
   // main json object
   DynamicJsonBuffer jsonBuffer(MAX_JSON_SIZE);
@@ -44,6 +54,30 @@ bool saveDefaultSettings() {
   json[CHAR_NTP_SERVER] = "pool.ntp.org";
   // pwm generator
   json[CHAR_PWM_GENERATOR] = PWM_GENERATOR_ESP8266;
+  // pwm inverted
+  json[CHAR_PWM_INVERTED] = false;
+  // pwm open drain
+  json[CHAR_PWM_OPEN_DRAIN] = false;
+  // max power, no limit
+  json[CHAR_MAX_POWER] = 0;
+  // power limit mode
+  json[CHAR_POWER_LIMIT_MODE] = POWER_LIMIT_PROPORTIONAL;
+  // effect
+  json[CHAR_EFFECT] = EFFECT_NONE;
+  // effect intensity
+  json[CHAR_EFFECT_INTENSITY] = 50;
+  // effect seed
+  json[CHAR_EFFECT_SEED] = 1;
+  // sync mode
+  json[CHAR_SYNC_MODE] = SYNC_OFF;
+  // mqtt broker, none
+  json[CHAR_MQTT_HOST] = "";
+  // mqtt port
+  json[CHAR_MQTT_PORT] = DEFAULT_MQTT_PORT;
+  // mqtt topic prefix
+  json[CHAR_MQTT_TOPIC] = DEFAULT_MQTT_TOPIC;
+  // mqtt user, no login
+  json[CHAR_MQTT_USER] = "";
   
   // channels
   JsonArray& jsonChannels = json.createNestedArray(CHAR_CHANNELS);
@@ -65,6 +99,12 @@ bool saveDefaultSettings() {
     jsonChannelsChannel[CHAR_CHANNEL_PIN] = 12;
     // channel power
     jsonChannelsChannel[CHAR_CHANNEL_POWER] = 10;
+    // channel priority
+    jsonChannelsChannel[CHAR_CHANNEL_PRIORITY] = 0;
+    // channel lightning
+    jsonChannelsChannel[CHAR_CHANNEL_LIGHTNING] = false;
+    // channel interpolation
+    jsonChannelsChannel[CHAR_CHANNEL_INTERPOLATION] = INTERPOLATION_LINEAR;
     // times array
     JsonArray& jsonChannelsChannelT = jsonChannelsChannel.createNestedArray(CHAR_CHANNEL_TIMES);
     // values array
@@ -84,14 +124,18 @@ bool saveDefaultSettings() {
     jsonChannelsChannelV.add(0);
   }
 
+  // scenes
+  json.createNestedArray(CHAR_SCENES);
+
   if(json.measureLength()+1 > MAX_JSON_SIZE) {
     DEBUG_WARNING("[saveDefaultSettings] json size too large");
     return false;
   }
 
-  File settings_file = SPIFFS.open(SETTINGS_FILE_NAME, "w");
-  json.printTo(settings_file);
-  settings_file.close(); 
+  String content;
+  json.printTo(content);
+  if(!writeFile(SETTINGS_FILE_NAME, content)) return false;
+  revisionSettings++;
 
   return true;
 }
@@ -99,8 +143,6 @@ bool saveDefaultSettings() {
 bool saveSettings() {
   DEBUG_INFO("[saveSettings]");
 
-  // starts the SPIFFS fileystem
-  startSPIFFS();
   
   // main json object
   DynamicJsonBuffer jsonBuffer(MAX_JSON_SIZE);;
@@ -110,10 +152,36 @@ bool saveSettings() {
   json[CHAR_NUM_OF_CHANNELS] = numOfChannels;
   // pwm PWMFrequency
   json[CHAR_PWM_FREQUENCY] = PWMFrequency;
+  // pwm generator
+  json[CHAR_PWM_GENERATOR] = PWMGenerator;
+  // pwm inverted
+  json[CHAR_PWM_INVERTED] = PWMInverted;
+  // pwm open drain
+  json[CHAR_PWM_OPEN_DRAIN] = PWMOpenDrain;
   // NTP server
   json[CHAR_NTP_SERVER] = jsonBuffer.strdup(NTPServer);
   // timezone
   json[CHAR_TIMEZONE] = timezone;
+  // max power
+  json[CHAR_MAX_POWER] = maxPower;
+  // power limit mode
+  json[CHAR_POWER_LIMIT_MODE] = powerLimitMode;
+  // effect
+  json[CHAR_EFFECT] = effect;
+  // effect intensity
+  json[CHAR_EFFECT_INTENSITY] = effectIntensity;
+  // effect seed
+  json[CHAR_EFFECT_SEED] = effectSeed;
+  // sync mode
+  json[CHAR_SYNC_MODE] = syncMode;
+  // mqtt broker
+  json[CHAR_MQTT_HOST] = jsonBuffer.strdup(mqttHost);
+  // mqtt port
+  json[CHAR_MQTT_PORT] = mqttPort;
+  // mqtt topic prefix
+  json[CHAR_MQTT_TOPIC] = jsonBuffer.strdup(mqttTopic);
+  // mqtt user, the password is stored with the other passwords
+  json[CHAR_MQTT_USER] = jsonBuffer.strdup(mqttUser);
   
   // channels
   JsonArray& jsonChannels = json.createNestedArray(CHAR_CHANNELS);
@@ -135,6 +203,12 @@ bool saveSettings() {
     jsonChannelsChannel[CHAR_CHANNEL_PIN] = channels[c].pin;
     // channel power
     jsonChannelsChannel[CHAR_CHANNEL_POWER] = channels[c].power;
+    // channel priority
+    jsonChannelsChannel[CHAR_CHANNEL_PRIORITY] = channels[c].priority;
+    // channel lightning
+    jsonChannelsChannel[CHAR_CHANNEL_LIGHTNING] = channels[c].lightning;
+    // channel interpolation
+    jsonChannelsChannel[CHAR_CHANNEL_INTERPOLATION] = channels[c].interpolation;
     // times array
     JsonArray& jsonChannelsChannelT = jsonChannelsChannel.createNestedArray(CHAR_CHANNEL_TIMES);
     // values array
@@ -144,44 +218,65 @@ bool saveSettings() {
       jsonChannelsChannelV.add(channels[c].v[i]);
     }
   }
+
+  // scenes
+  JsonArray& jsonScenes = json.createNestedArray(CHAR_SCENES);
+  for(uint8_t s=0; s<numOfScenes; s++) {
+    // scene json object
+    JsonObject& jsonScenesScene = jsonScenes.createNestedObject();
+
+    // scene name
+    jsonScenesScene[CHAR_SCENE_NAME] = jsonBuffer.strdup(scenes[s].name);
+    // scene scheduled
+    jsonScenesScene[CHAR_SCENE_SCHEDULED] = scenes[s].scheduled;
+    // scene start
+    jsonScenesScene[CHAR_SCENE_START] = scenes[s].start;
+    // scene duration
+    jsonScenesScene[CHAR_SCENE_DURATION] = scenes[s].duration;
+    // scene fade
+    jsonScenesScene[CHAR_SCENE_FADE] = scenes[s].fade;
+    // values array
+    JsonArray& jsonScenesSceneV = jsonScenesScene.createNestedArray(CHAR_SCENE_VALUES);
+    for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) jsonScenesSceneV.add(scenes[s].v[c]);
+  }
   
   if(json.measureLength()+1 > MAX_JSON_SIZE) {
     DEBUG_WARNING("[saveSettings] json size too large");
     return false;
   }
 
-  File settings_file = SPIFFS.open(SETTINGS_FILE_NAME, "w");
-  json.printTo(settings_file);
-  settings_file.close(); 
+  String content;
+  json.printTo(content);
+  if(!writeFile(SETTINGS_FILE_NAME, content)) return false;
+  revisionSettings++;
   return true;
 }
 
 bool loadSettings() {
   DEBUG_INFO("[loadSettings]");
 
-  // starts the SPIFFS fileystem
-  startSPIFFS();
+  // the revisions start at a random value after a restart, so the revisions a client got before never match
+  if(revisionSettings == 0) revisionChannels = revisionSchedule = revisionSettings = revisionProfiles = RANDOM_REG32 >> 1;
+  revisionChannels++;
+  revisionSchedule++;
+  revisionSettings++;
 
-  // try to open file
-  File settings_file = SPIFFS.open(SETTINGS_FILE_NAME, "r");
-  if (!settings_file) {
+  // try to read file
+  String content;
+  if (!readFile(SETTINGS_FILE_NAME, content)) {
     DEBUG_WARNING("[loadSettings] no config file found, create default file");
     return false;
   }
 
   // check filesize
-  size_t size = settings_file.size();
-  if (size > MAX_JSON_SIZE) {
+  if (content.length() > MAX_JSON_SIZE) {
     DEBUG_WARNING("[loadSettings] config file size is too large");
     return false;
   }
 
-  // read file
-  std::unique_ptr<char[]> buf(new char[size]);
-  settings_file.readBytes(buf.get(), size);
-
+  // the json is parsed in place, so "content" is a copy of the cached file
   DynamicJsonBuffer jsonBuffer(MAX_JSON_SIZE);
-  JsonObject& json = jsonBuffer.parseObject(buf.get());
+  JsonObject& json = jsonBuffer.parseObject(content.begin());
 
   // check json parsing
   if (!json.success()) {
@@ -195,10 +290,36 @@ bool loadSettings() {
   numOfChannels = json[CHAR_NUM_OF_CHANNELS];
   // pwm PWMFrequency
   PWMFrequency = json[CHAR_PWM_FREQUENCY];
+  // pwm generator
+  PWMGenerator = json[CHAR_PWM_GENERATOR];
+  // pwm inverted
+  PWMInverted = json[CHAR_PWM_INVERTED];
+  // pwm open drain
+  PWMOpenDrain = json[CHAR_PWM_OPEN_DRAIN];
   // name of the ntp server
   strcpy(NTPServer, json[CHAR_NTP_SERVER]);
   // timezone
   timezone = json[CHAR_TIMEZONE];
+  // max power
+  maxPower = json[CHAR_MAX_POWER];
+  // power limit mode
+  powerLimitMode = json[CHAR_POWER_LIMIT_MODE];
+  // effect
+  effect = json[CHAR_EFFECT];
+  // effect intensity
+  effectIntensity = json[CHAR_EFFECT_INTENSITY];
+  // effect seed
+  effectSeed = json[CHAR_EFFECT_SEED];
+  // sync mode
+  syncMode = json[CHAR_SYNC_MODE];
+  // mqtt broker, older settings files have none
+  strlcpy(mqttHost, json[CHAR_MQTT_HOST] | "", sizeof(mqttHost));
+  // mqtt port
+  mqttPort = json[CHAR_MQTT_PORT] | DEFAULT_MQTT_PORT;
+  // mqtt topic prefix
+  strlcpy(mqttTopic, json[CHAR_MQTT_TOPIC] | DEFAULT_MQTT_TOPIC, sizeof(mqttTopic));
+  // mqtt user, older settings files have none
+  strlcpy(mqttUser, json[CHAR_MQTT_USER] | "", sizeof(mqttUser));
 
   //channels
   for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) {
@@ -219,6 +340,12 @@ bool loadSettings() {
     channels[c].pin = json[CHAR_CHANNELS][c][CHAR_CHANNEL_PIN];
     // channel power
     channels[c].power = json[CHAR_CHANNELS][c][CHAR_CHANNEL_POWER];
+    // channel priority
+    channels[c].priority = json[CHAR_CHANNELS][c][CHAR_CHANNEL_PRIORITY];
+    // channel lightning
+    channels[c].lightning = json[CHAR_CHANNELS][c][CHAR_CHANNEL_LIGHTNING];
+    // channel interpolation
+    channels[c].interpolation = json[CHAR_CHANNELS][c][CHAR_CHANNEL_INTERPOLATION];
     // number of entries
     channels[c].numOfEntries = json[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES].size();
     // times and values
@@ -226,16 +353,83 @@ bool loadSettings() {
       channels[c].t[i] = json[CHAR_CHANNELS][c][CHAR_CHANNEL_TIMES][i]; 
       channels[c].v[i] = json[CHAR_CHANNELS][c][CHAR_CHANNEL_VALUES][i]; 
     }
+    // segments of the schedule
+    channels[c].prepareSchedule();
     
   }
+
+  // scenes
+  numOfScenes = json[CHAR_SCENES].size();
+  if(numOfScenes > MAX_NUM_OF_SCENES) numOfScenes = MAX_NUM_OF_SCENES;
+  for(uint8_t s=0; s<numOfScenes; s++) {
+    // scene name
+    strlcpy(scenes[s].name, json[CHAR_SCENES][s][CHAR_SCENE_NAME] | "", sizeof(scenes[s].name));
+    // scene scheduled
+    scenes[s].scheduled = json[CHAR_SCENES][s][CHAR_SCENE_SCHEDULED];
+    // scene start
+    scenes[s].start = json[CHAR_SCENES][s][CHAR_SCENE_START];
+    // scene duration
+    scenes[s].duration = json[CHAR_SCENES][s][CHAR_SCENE_DURATION];
+    // scene fade
+    scenes[s].fade = json[CHAR_SCENES][s][CHAR_SCENE_FADE];
+    // scene values
+    for(uint8_t c=0; c<MAX_NUM_OF_CHANNELS; c++) scenes[s].v[c] = json[CHAR_SCENES][s][CHAR_SCENE_VALUES][c];
+  }
+
+  // the passwords are stored in their own file
+  loadSecrets();
+
+  // the profiles are loaded and the segments are computed with the profile of the day
+  loadProfiles();
+  resolveProfiles();
+
+  // the requested power has to be summed up again for the new channels
+  resetPowerLimit();
   return true;
 }
 
-void startSPIFFS() {
-  if(!SPIFFS_started) {
-    DEBUG_INFO("start SPIFFS");
-    SPIFFS.begin();
-    SPIFFS_started = true;
-  }
+
+/*
+ * The passwords are stored in "SECRETS_FILE_NAME" instead of the settings file, because the settings file is sent
+ * to every client by /settings. The file is not served by the web server.
+ */
+bool saveSecrets() {
+  DEBUG_INFO("[saveSecrets]");
+  DynamicJsonBuffer jsonBuffer;
+  JsonObject& json = jsonBuffer.createObject();
+  // password of the updates over WiFi
+  json[CHAR_OTA_PASSWORD] = otaPassword;
+  // password at the mqtt broker
+  json[CHAR_MQTT_PASSWORD] = mqttPassword;
+
+  String content;
+  json.printTo(content);
+  return writeFile(SECRETS_FILE_NAME, content);
 }
 
+bool loadSecrets() {
+  DEBUG_INFO("[loadSecrets]");
+  otaPassword[0] = 0;
+  mqttPassword[0] = 0;
+
+  // try to read file
+  String content;
+  if (!readFile(SECRETS_FILE_NAME, content)) {
+    DEBUG_INFO("[loadSecrets] no secrets file found");
+    return false;
+  }
+
+  // the json is parsed in place, so "content" is a copy of the cached file
+  DynamicJsonBuffer jsonBuffer;
+  JsonObject& json = jsonBuffer.parseObject(content.begin());
+  if (!json.success()) {
+    DEBUG_WARNING("[loadSecrets] json parsing failed");
+    return false;
+  }
+
+  // password of the updates over WiFi
+  strlcpy(otaPassword, json[CHAR_OTA_PASSWORD] | "", sizeof(otaPassword));
+  // password at the mqtt broker
+  strlcpy(mqttPassword, json[CHAR_MQTT_PASSWORD] | "", sizeof(mqttPassword));
+  return true;
+}
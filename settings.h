@@ -23,6 +23,9 @@
 
 // for the settings file
 static const char SETTINGS_FILE_NAME[] = "/configFile.json";
+static const char PROFILES_FILE_NAME[] = "/profiles.json";
+static const char BENCHMARK_BACKUP_FILE_NAME[] = "/configFile.bak";
+static const char SECRETS_FILE_NAME[] = "/secrets.json"; // passwords, kept out of the settings that are sent to the clients
 static const uint16_t MAX_JSON_SIZE = 10000;
 
 // name definitions for the JSON Format
@@ -31,10 +34,101 @@ static const char CHAR_MAX_NUM_OF_CHANNELS[] = "maxNumOfChannels";
 static const char CHAR_MAX_NUM_OF_ENTRIES[] = "maxNumOfEntries";
 static const char CHAR_PWM_FREQUENCY[] = "PWMFrequency";
 static const char CHAR_PWM_GENERATOR[] = "PWMGenerator";
+static const char CHAR_PWM_INVERTED[] = "PWMInverted";
+static const char CHAR_PWM_OPEN_DRAIN[] = "PWMOpenDrain";
 static const char CHAR_NTP_SERVER[] = "NTPServer";
 static const char CHAR_TIMEZONE[] = "timezone";
 static const char CHAR_TIME[] = "time";
 static const char CHAR_CURRENT_POWER[] = "currentPower";
+static const char CHAR_MAX_POWER[] = "maxPower";
+static const char CHAR_POWER_LIMIT_MODE[] = "powerLimitMode";
+static const char CHAR_POWER_LIMIT_FACTOR[] = "powerLimitFactor";
+static const char CHAR_EFFECT[] = "effect";
+static const char CHAR_EFFECT_INTENSITY[] = "effectIntensity";
+static const char CHAR_EFFECT_SEED[] = "effectSeed";
+static const char CHAR_SYNC_MODE[] = "syncMode";
+static const char CHAR_SYNC_LOCKED[] = "syncLocked";
+static const char CHAR_SYNC_BEACONS[] = "syncBeacons";
+static const char CHAR_MQTT_HOST[] = "mqttHost";
+static const char CHAR_MQTT_PORT[] = "mqttPort";
+static const char CHAR_MQTT_TOPIC[] = "mqttTopic";
+static const char CHAR_MQTT_USER[] = "mqttUser";
+static const char CHAR_MQTT_PASSWORD[] = "mqttPassword";
+static const char CHAR_MQTT_PASSWORD_SET[] = "mqttPasswordSet";
+static const char CHAR_MQTT_CONNECTED[] = "mqttConnected";
+static const char CHAR_MQTT_OUTPUTS[] = "outputs";
+static const char CHAR_MQTT_RSSI[] = "rssi";
+static const char CHAR_PROFILES[] = "profiles";
+static const char CHAR_PROFILE[] = "profile";
+static const char CHAR_PROFILE_NAME[] = "name";
+static const char CHAR_ACTIVE_PROFILE[] = "activeProfile";
+static const char CHAR_WEEK_PROFILES[] = "week";
+static const char CHAR_DATE_OVERRIDES[] = "dates";
+static const char CHAR_DATE[] = "date";
+static const char CHAR_TODAY[] = "today";
+static const char CHAR_ACCLIMATION_START[] = "acclimationStart";
+static const char CHAR_ACCLIMATION_WEEKS[] = "acclimationWeeks";
+static const char CHAR_ACCLIMATION_PERCENT[] = "acclimationPercent";
+static const char CHAR_ACCLIMATION_FACTOR[] = "acclimationFactor";
+static const char CHAR_LOG_SEQ[] = "seq";
+static const char CHAR_LOG_LINES[] = "lines";
+static const char CHAR_LOG_DROPPED[] = "dropped";
+static const char CHAR_BATCH_OPS[] = "ops";
+static const char CHAR_BATCH_RESULTS[] = "results";
+static const char CHAR_BATCH_STATUS[] = "status";
+static const char CHAR_BATCH_ERROR[] = "error";
+static const char CHAR_BATCH_APPLIED[] = "applied";
+static const char CHAR_REVISION[] = "rev";
+static const char CHAR_UNCHANGED[] = "unchanged";
+static const char CHAR_BENCHMARK_ENTRIES[] = "entries";
+static const char CHAR_BENCHMARK_ITERATIONS[] = "iterations";
+static const char CHAR_BENCHMARK_CPU_MHZ[] = "cpuMHz";
+static const char CHAR_BENCHMARK_RESULTS[] = "results";
+static const char CHAR_BENCHMARK_NAME[] = "name";
+static const char CHAR_BENCHMARK_AVG[] = "avg";
+static const char CHAR_BENCHMARK_MIN[] = "min";
+static const char CHAR_BENCHMARK_MAX[] = "max";
+static const char CHAR_BENCHMARK_BYTES[] = "bytes";
+static const char CHAR_METRICS_UPTIME[] = "uptime";
+static const char CHAR_METRICS_FREE_HEAP[] = "freeHeap";
+static const char CHAR_METRICS_MESSAGES[] = "messages";
+static const char CHAR_METRICS_INVALID_MESSAGES[] = "invalidMessages";
+static const char CHAR_METRICS_DROPPED_MESSAGES[] = "droppedMessages";
+static const char CHAR_METRICS_MAX_MESSAGE_MILLIS[] = "maxMessageMillis";
+static const char CHAR_METRICS_PWM_UPDATES[] = "pwmUpdates";
+static const char CHAR_METRICS_PWM_MAX_LATENESS[] = "pwmMaxLateness";
+static const char CHAR_METRICS_PWM_MISSED_TICKS[] = "pwmMissedTicks";
+static const char CHAR_METRICS_PWM_CHECK_ERRORS[] = "pwmCheckErrors";
+static const char CHAR_METRICS_I2C_CLOCK[] = "i2cClock";
+static const char CHAR_METRICS_I2C_RECOVERIES[] = "i2cRecoveries";
+static const char CHAR_METRICS_CACHE_HITS[] = "cacheHits";
+static const char CHAR_METRICS_CACHE_MISSES[] = "cacheMisses";
+static const char CHAR_METRICS_MQTT_PUBLISHED[] = "mqttPublished";
+static const char CHAR_METRICS_MQTT_DROPPED[] = "mqttDropped";
+static const char CHAR_OTA_TARGET[] = "target";
+static const char CHAR_OTA_BYTES[] = "bytes";
+static const char CHAR_OTA_MILLIS[] = "millis";
+static const char CHAR_OTA_KBPS[] = "kBps";
+static const char CHAR_OTA_MAX_WRITE_MILLIS[] = "maxWriteMillis";
+static const char CHAR_OTA_PASSWORD[] = "otaPassword";
+static const char CHAR_OTA_CURRENT_PASSWORD[] = "otaCurrentPassword";
+static const char CHAR_OTA_PASSWORD_SET[] = "otaPasswordSet";
+static const char CHAR_WATCHDOG[] = "watchdog";
+static const char CHAR_WATCHDOG_RESET_REASON[] = "resetReason";
+static const char CHAR_WATCHDOG_RESTARTS[] = "restarts";
+static const char CHAR_WATCHDOG_STAGE[] = "stage";
+static const char CHAR_WATCHDOG_LAST_COMPLETED[] = "lastCompleted";
+static const char CHAR_WATCHDOG_STALLED[] = "stalled";
+static const char CHAR_WATCHDOG_MIN_FREE_HEAP[] = "minFreeHeap";
+static const char CHAR_WATCHDOG_DURATIONS[] = "durations";
+static const char CHAR_WATCHDOG_MAX_DURATIONS[] = "maxDurations";
+static const char CHAR_IDLE_SLEEP[] = "sleep";
+static const char CHAR_IDLE_SLEEP_MODE[] = "sleepMode";
+static const char CHAR_IDLE_MEASURED_MILLIS[] = "measuredMillis";
+static const char CHAR_IDLE_SLEPT_MILLIS[] = "sleptMillis";
+static const char CHAR_IDLE_AWAKE_PERCENT[] = "awakePercent";
+static const char CHAR_IDLE_SLEEPS[] = "sleeps";
+static const char CHAR_IDLE_INTERRUPTED[] = "interrupted";
 static const char CHAR_CHANNELS[] = "channels";
 static const char CHAR_CHANNEL_NAME[] = "name";
 static const char CHAR_CHANNEL_COLOR[] = "color";
@@ -43,32 +137,59 @@ static const char CHAR_CHANNEL_MOONLIGHT[] = "moonlight";
 static const char CHAR_CHANNEL_MAX_MOONLIGHT_VALUE[] = "MaxMoonlightValue";
 static const char CHAR_CHANNEL_PIN[] = "pin";
 static const char CHAR_CHANNEL_POWER[] = "power";
+static const char CHAR_CHANNEL_PRIORITY[] = "priority";
+static const char CHAR_CHANNEL_LIGHTNING[] = "lightning";
+static const char CHAR_CHANNEL_INTERPOLATION[] = "interpolation";
 static const char CHAR_CHANNEL_VALUE[] = "value";
+static const char CHAR_CHANNEL_OUTPUT[] = "output";
 static const char CHAR_CHANNEL_TIMES[] = "times";
 static const char CHAR_CHANNEL_VALUES[] = "values";
+static const char CHAR_SCENES[] = "scenes";
+static const char CHAR_SCENE[] = "scene";
+static const char CHAR_ACTIVE_SCENE[] = "activeScene";
+static const char CHAR_SCENE_NAME[] = "name";
+static const char CHAR_SCENE_VALUES[] = "values";
+static const char CHAR_SCENE_SCHEDULED[] = "scheduled";
+static const char CHAR_SCENE_START[] = "start";
+static const char CHAR_SCENE_DURATION[] = "duration";
+static const char CHAR_SCENE_FADE[] = "fade";
 
 // global variables
-extern bool SPIFFS_started; // true if the SPIFFS has started yet, false otherwise
+// revisions of the state, they are increased on every change, so a client can skip a request if it already has the data
+extern uint32_t revisionChannels; // names, colors, modes, values and outputs of the channels (manual page)
+extern uint32_t revisionSchedule; // entries and interpolation of the schedule (schedule page)
+extern uint32_t revisionSettings; // settings in "SETTINGS_FILE_NAME" (settings page and /settings)
+extern uint32_t revisionProfiles; // profiles, calendar and acclimation in "PROFILES_FILE_NAME"
 
 
 /* 
- * loads the settings from the file "SETTINGS_FILE_NAME" in the SPIFFS
+ * loads the settings from the file "SETTINGS_FILE_NAME" in the flash
  * returns true loading was successfull, false otherwise
  */
 bool loadSettings();
 
 /*
- * saves the settings to the file "CONFIG_FILE_NAME" in the SPIFFS 
+ * saves the settings to the file "CONFIG_FILE_NAME" in the flash 
  * returns true loading was successfull, false otherwise
  */
 bool saveSettings();
 
 /*
- * creates default settings and saves them to the file "CONFIG_FILE_NAME" in the SPIFFS 
+ * creates default settings and saves them to the file "CONFIG_FILE_NAME" in the flash 
  * returns true loading was successfull, false otherwise
  */
 bool saveDefaultSettings();
 
-// starts the SPIFFS filesystem if it hasn't started yet
-void startSPIFFS();
+/*
+ * loads the passwords from the file "SECRETS_FILE_NAME" in the flash, they are empty if there is no file
+ * returns true loading was successfull, false otherwise
+ */
+bool loadSecrets();
+
+/*
+ * saves the passwords to the file "SECRETS_FILE_NAME" in the flash
+ * returns true saving was successfull, false otherwise
+ */
+bool saveSecrets();
+
 #endif
@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "simulator.h"
+#include "server.h"
+#include "channel.h"
+#include "pwm.h"
+#include "ntp.h"
+#include "effects.h"
+#include "profiles.h"
+#include "debug.h"
+#include "settings.h"
+#include <ESPAsyncWebServer.h>
+
+// state of the running simulation, kept between the chunks of the response
+struct Simulation {
+  uint32_t start; // epoch time in s of the first step
+  uint32_t step; // time between two steps in s
+  uint32_t steps; // number of steps
+  uint32_t s; // next step
+  int32_t maxJump; // change of the duty cycle between two steps that is flagged as jump
+  uint16_t lastDuty[MAX_NUM_OF_CHANNELS]; // duty cycles of the last step
+  uint32_t day; // local day of the last step
+  uint32_t jumps; // number of jumps
+  uint32_t cycles; // cpu cycles needed by the steps
+  uint8_t savedEffect; // effect that is paused during the simulation
+  bool done; // the last line is sent
+};
+
+Simulation *simulation = NULL; // the running simulation, NULL if there is none
+
+// state of the channels that is changed by the simulated steps
+struct SavedChannels {
+  bool manual[MAX_NUM_OF_CHANNELS];
+  float value[MAX_NUM_OF_CHANNELS];
+  float output[MAX_NUM_OF_CHANNELS];
+  float powerLimitFactor;
+  float currentPower;
+};
+
+uint8_t *curve = NULL; // message with the rendered curve, NULL if it is not rendered yet
+size_t curveLength; // length of "curve" in bytes
+uint32_t revisionCurve = 0; // revision of "curve", sent to the client
+uint32_t curveSchedule, curveSettings, curveProfiles, curveDay; // revisions and local day "curve" was rendered with
+
+
+/*
+ * Saves the state of the channels to "saved" and switches them to automatic mode
+ */
+void saveChannels(SavedChannels &saved) {
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    saved.manual[c] = channels[c].manual;
+    saved.value[c] = channels[c].value;
+    saved.output[c] = channels[c].output;
+    channels[c].manual = false;
+  }
+  saved.powerLimitFactor = powerLimitFactor;
+  saved.currentPower = currentPower;
+}
+
+
+/*
+ * Restores the state of the channels from "saved" with the real clock
+ * the outputs keep the values of the last real PWM update, so the metrics and the effect do not see simulated values
+ */
+void restoreChannels(const SavedChannels &saved) {
+  simulatedEpochMillis = -1;
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    channels[c].manual = saved.manual[c];
+    channels[c].value = saved.value[c];
+    channels[c].output = saved.output[c];
+  }
+  powerLimitFactor = saved.powerLimitFactor;
+  currentPower = saved.currentPower;
+  resolveProfiles();
+  resetPowerLimit();
+}
+
+
+/*
+ * Computes the outputs of the channels at "simulatedEpochMillis" and writes them to the recording driver
+ * the same pipeline as "handlePWM", the segments must be resolved for the simulated day
+ */
+void simulateStep(const bool inverted) {
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    channels[c].updateValue();
+    addRequestedPower(channels[c]);
+  }
+  applyPowerLimit();
+  if(inverted) writeAllPWMOutputs<InvertedPWMDriver<RecordingPWMDriver>>();
+  else writeAllPWMOutputs<RecordingPWMDriver>();
+}
+
+
+/*
+ * Ends the simulation and restarts the paused effect
+ */
+void stopSimulation() {
+  if(simulation == NULL) return;
+  DEBUG_INFO("[handleSimulation] %u steps, %u jumps", simulation->s, simulation->jumps);
+  effect = simulation->savedEffect;
+  delete simulation;
+  simulation = NULL;
+  startEffects();
+}
+
+
+/*
+ * Computes the next steps of the simulation into "buffer" with "maxLen" bytes, called by the server for each chunk
+ * The state of the channels is saved and restored around each chunk, so the main loop keeps running the real clock
+ * between the chunks. Returns the number of bytes written, 0 after the last line.
+ */
+size_t fillSimulation(uint8_t *buffer, size_t maxLen, size_t index) {
+  if(simulation == NULL || simulation->done) {
+    stopSimulation();
+    return 0;
+  }
+  Simulation &sim = *simulation;
+  String chunk;
+  if(index == 0) {
+    chunk = F("epoch,local");
+    for(uint8_t c=0; c<numOfChannels; c++) chunk += ",duty" + String(c);
+    chunk += F(",jumps\n");
+  }
+
+  SavedChannels saved;
+  saveChannels(saved);
+
+  // a line has at most 24 characters for the time and 10 per channel for the duty cycle and the jump
+  const size_t maxLineLength = 24 + 10 * MAX_NUM_OF_CHANNELS;
+  char field[24];
+  while(sim.s < sim.steps && chunk.length() + maxLineLength < maxLen) {
+    simulatedEpochMillis = (int64_t(sim.start) + int64_t(sim.s) * sim.step) * 1000;
+
+    uint32_t startCycles = ESP.getCycleCount();
+    if(sim.s == 0 || getLocalDay() != sim.day) {
+      sim.day = getLocalDay();
+      resolveProfiles();
+    }
+    simulateStep(PWMInverted);
+    sim.cycles += ESP.getCycleCount() - startCycles;
+
+    uint32_t t = getLocalSecondsOfTheDay();
+    snprintf(field, sizeof(field), "%u,%02u:%02u:%02u", uint32_t(simulatedEpochMillis / 1000), t / 3600, t / 60 % 60, t % 60);
+    chunk += field;
+    String jumped;
+    for(uint8_t c=0; c<numOfChannels; c++) {
+      uint16_t duty = RecordingPWMDriver::duty[c];
+      chunk += ',';
+      chunk += duty;
+      if(sim.s > 0 && abs(int32_t(duty) - int32_t(sim.lastDuty[c])) > sim.maxJump) {
+        if(jumped.length() > 0) jumped += ' ';
+        jumped += c;
+        sim.jumps++;
+      }
+      sim.lastDuty[c] = duty;
+    }
+    chunk += ',';
+    chunk += jumped;
+    chunk += '\n';
+    sim.s++;
+  }
+  if(sim.s == sim.steps && chunk.length() + maxLineLength < maxLen) {
+    snprintf(field, sizeof(field), "%.2f", sim.steps > 0 ? sim.cycles / float(sim.steps) / ESP.getCpuFreqMHz() : 0);
+    chunk += "# " + String(sim.steps) + " steps, " + String(sim.jumps) + " jumps, " + field + " us per step\n";
+    sim.done = true;
+  }
+
+  restoreChannels(saved);
+
+  if(chunk.length() == 0) return RESPONSE_TRY_AGAIN;
+  memcpy(buffer, chunk.c_str(), chunk.length());
+  return chunk.length();
+}
+
+
+/*
+ * Runs the channels in automatic mode over simulated days, many times faster than real time
+ * The clock is replaced by the simulated time, so the schedule, the profiles of the weekdays and dates, the acclimation,
+ * the midnight wrap, the timezone and the power limit are computed by the same functions as in the main loop. The duty
+ * cycles are written to the recording driver, so the outputs of the device keep their value during the simulation.
+ * The steps are computed chunk by chunk while the response is sent, see "fillSimulation". Only one simulation runs at a
+ * time, the effect is paused until it ends.
+ *
+ * parameters of the http request:
+ *   start: epoch time in s of the first step, the current time if it is missing
+ *   days: number of simulated days (1..MAX_SIMULATION_DAYS)
+ *   step: time between two steps in s
+ *   jump: change of the duty cycle in % of the full scale between two steps that is flagged as jump
+ *
+ * Each line of the csv contains the epoch time, the local time, the duty cycle (0..65535) of each channel as it is
+ * written to the driver and the channels that jumped. The last line is a comment with the number of jumps and the
+ * time needed to compute one step.
+ */
+void handleSimulation(AsyncWebServerRequest *request) {
+  uint32_t start = request->hasArg("start") ? request->arg("start").toInt() : epochTime();
+  uint32_t days = request->hasArg("days") ? request->arg("days").toInt() : 1;
+  uint32_t step = request->hasArg("step") ? request->arg("step").toInt() : DEFAULT_SIMULATION_STEP;
+  float jump = request->hasArg("jump") ? request->arg("jump").toFloat() : DEFAULT_SIMULATION_JUMP;
+  if(days < 1 || days > MAX_SIMULATION_DAYS || step < 1 || uint64_t(days) * 24*60*60 / step > MAX_SIMULATION_STEPS) {
+    request->send(400, F("text/plain"), F("invalid days or step"));
+    return;
+  }
+  if(simulation) {
+    request->send(503, F("text/plain"), F("Busy, try again later"));
+    return;
+  }
+  DEBUG_INFO("[handleSimulation] start: %u, days: %u, step: %u s", start, days, step);
+
+  simulation = new Simulation();
+  simulation->start = start;
+  simulation->step = step;
+  simulation->steps = days * 24*60*60 / step;
+  simulation->maxJump = jump / 100 * 65535;
+  // the effect is stopped so its timer does not render the simulated outputs
+  simulation->savedEffect = effect;
+  effect = EFFECT_NONE;
+  startEffects();
+
+  Simulation *sim = simulation;
+  request->onDisconnect([sim]() {
+    if(simulation == sim) stopSimulation();
+  });
+  request->send(request->beginChunkedResponse(F("text/csv"), fillSimulation));
+}
+
+
+/*
+ * Renders the outputs of the channels in automatic mode over the current local day into "curve"
+ * The message starts with a header of CURVE_HEADER_SIZE bytes (id, number of channels, number of samples, time between
+ * two samples in s, 2 bytes padding, revision), followed by the duty cycles (0..65535) of the samples of each channel,
+ * all little endian. The duty cycles are not inverted, so they are the output of the channel and not the PWM signal.
+ */
+void renderCurve() {
+  uint32_t startCycles = ESP.getCycleCount();
+  free(curve);
+  curveLength = CURVE_HEADER_SIZE + numOfChannels * CURVE_SAMPLES * sizeof(uint16_t);
+  curve = (uint8_t*)malloc(curveLength);
+  if(curve == NULL) {
+    DEBUG_WARNING("[renderCurve] not enough memory");
+    return;
+  }
+  curveSchedule = revisionSchedule;
+  curveSettings = revisionSettings;
+  curveProfiles = revisionProfiles;
+  curveDay = getLocalDay();
+  if(revisionCurve == 0) revisionCurve = RANDOM_REG32 >> 1;
+  revisionCurve++;
+
+  // header
+  curve[0] = ID_SEND_CURVE_TO_CLIENT;
+  curve[1] = numOfChannels;
+  curve[2] = CURVE_SAMPLES & 0xFF;
+  curve[3] = CURVE_SAMPLES >> 8;
+  curve[4] = CURVE_STEP & 0xFF;
+  curve[5] = CURVE_STEP >> 8;
+  curve[6] = curve[7] = 0;
+  for(uint8_t i=0; i<4; i++) curve[8+i] = revisionCurve >> (8*i);
+
+  // the samples start at the local midnight of the current day
+  int64_t midnight = int64_t(curveDay) * 24*60*60 - 60*60*int32_t(timezone);
+  SavedChannels saved;
+  saveChannels(saved);
+  simulatedEpochMillis = midnight * 1000;
+  resolveProfiles();
+  for(uint16_t s=0; s<CURVE_SAMPLES; s++) {
+    simulatedEpochMillis = (midnight + s * CURVE_STEP) * 1000;
+    simulateStep(false);
+    for(uint8_t c=0; c<numOfChannels; c++) {
+      uint8_t *sample = curve + CURVE_HEADER_SIZE + (c * CURVE_SAMPLES + s) * sizeof(uint16_t);
+      sample[0] = RecordingPWMDriver::duty[c] & 0xFF;
+      sample[1] = RecordingPWMDriver::duty[c] >> 8;
+    }
+  }
+  restoreChannels(saved);
+  DEBUG_INFO("[renderCurve] revision: %u, %u us", revisionCurve, (ESP.getCycleCount() - startCycles) / ESP.getCpuFreqMHz());
+}
+
+
+/*
+ * Sends the curve of the current local day to client "num" as binary message, see "renderCurve"
+ * The curve is only rendered again if the schedule, the settings, the profiles or the day changed since it was rendered,
+ * so repeated requests cost nothing. If the client already has the revision ("rev" in "jsonIn"), a json with "unchanged"
+ * is sent instead.
+ */
+void sendCurve(const uint32_t num, JsonObject& jsonIn) {
+  if(curve == NULL || curveSchedule != revisionSchedule || curveSettings != revisionSettings ||
+     curveProfiles != revisionProfiles || curveDay != getLocalDay()) renderCurve();
+  if(curve == NULL) return;
+
+  // json if the client has the curve already
+  if(jsonIn.containsKey(CHAR_REVISION) && jsonIn[CHAR_REVISION].as<uint32_t>() == revisionCurve) {
+    DynamicJsonBuffer jsonBuffer;
+    JsonObject& jsonOut = jsonBuffer.createObject();
+    jsonOut["id"] = ID_SEND_CURVE_TO_CLIENT;
+    jsonOut[CHAR_REVISION] = revisionCurve;
+    jsonOut[CHAR_UNCHANGED] = true;
+    sendJson(num, jsonOut);
+    return;
+  }
+  sendBinary(num, curve, curveLength);
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef SIMULATOR__H
+#define SIMULATOR__H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <ArduinoJson.h>
+
+// constants
+static const uint16_t MAX_SIMULATION_DAYS = 31; // max number of simulated days
+static const uint32_t MAX_SIMULATION_STEPS = 100000; // max number of simulated steps (lines of the trace)
+static const uint32_t DEFAULT_SIMULATION_STEP = 60; // default time between two steps in s
+static const float DEFAULT_SIMULATION_JUMP = 5; // default change of the duty cycle in % per step that is flagged as jump
+static const uint16_t CURVE_SAMPLES = 288; // number of samples of the rendered curve of a day
+static const uint16_t CURVE_STEP = 24*60*60 / CURVE_SAMPLES; // time between two samples of the curve in s
+static const size_t CURVE_HEADER_SIZE = 12; // bytes before the samples in the message of the curve
+
+// runs the schedule of the channels over simulated days and sends the duty cycles as csv to the http client
+void handleSimulation(AsyncWebServerRequest *request);
+// sends the rendered outputs of the channels over the current day to client "num", rendered again only after a change
+void sendCurve(const uint32_t num, JsonObject& jsonIn);
+
+#endif
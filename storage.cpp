@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "storage.h"
+#include "settings.h"
+#include "debug.h"
+#include <Arduino.h>
+#include <FS.h>
+#include <LittleFS.h>
+
+// a small file kept in the RAM
+struct CachedFile {
+  String name; // name of the file, empty if the entry is unused
+  String content; // content of the file
+  uint32_t lastUse; // value of "cacheClock" at the last read or write
+};
+
+// global variables
+bool storageStarted = false; // true if the file system is mounted
+bool storageStopped = false; // true while the file system must not be mounted, see "stopStorage"
+CachedFile cache[MAX_NUM_OF_CACHED_FILES]; // read cache of small files like the settings
+uint32_t cacheClock = 0; // increased on every use of the cache, to find the least recently used file
+uint32_t storageCacheHits = 0; // number of reads answered by the cache
+uint32_t storageCacheMisses = 0; // number of reads from the backend
+#ifdef STORAGE_IN_MEMORY
+String MemoryStorage::names[MAX_NUM_OF_MEMORY_FILES]; // names of the files, empty if unused
+String MemoryStorage::contents[MAX_NUM_OF_MEMORY_FILES]; // contents of the files
+#endif
+
+
+/*
+ * Reads the whole file "name" of "fileSystem" into "content"
+ */
+bool readFromFileSystem(fs::FS &fileSystem, const char *name, String &content) {
+  File file = fileSystem.open(name, "r");
+  if(!file) return false;
+  content = "";
+  content.reserve(file.size());
+  char chunk[257];
+  while(file.available() > 0) {
+    size_t len = file.readBytes(chunk, sizeof(chunk) - 1);
+    if(len == 0) break;
+    chunk[len] = 0;
+    content += chunk;
+  }
+  file.close();
+  return true;
+}
+
+
+/*
+ * Mounts the LittleFS
+ * The flash of older firmware versions contains a SPIFFS image, which LittleFS can't mount. Then the settings and
+ * profiles are read from the SPIFFS, the flash is formatted as LittleFS and both files are written again. The files of
+ * the website must be uploaded again as LittleFS image.
+ */
+bool LittleFSStorage::begin() {
+  // without auto format, so an old SPIFFS image is not lost before it is migrated
+  LittleFS.setConfig(LittleFSConfig(false));
+  if(LittleFS.begin()) return true;
+
+  DEBUG_WARNING("[startStorage] no LittleFS found, migrating the SPIFFS");
+  String settings, profiles;
+  bool hasSettings = false;
+  bool hasProfiles = false;
+  if(SPIFFS.begin()) {
+    hasSettings = readFromFileSystem(SPIFFS, SETTINGS_FILE_NAME, settings);
+    hasProfiles = readFromFileSystem(SPIFFS, PROFILES_FILE_NAME, profiles);
+    SPIFFS.end();
+  }
+  if(!LittleFS.format() || !LittleFS.begin()) {
+    DEBUG_ERROR("[startStorage] formatting the LittleFS failed");
+    return false;
+  }
+  if(hasSettings) write(SETTINGS_FILE_NAME, settings);
+  if(hasProfiles) write(PROFILES_FILE_NAME, profiles);
+  DEBUG_INFO("[startStorage] migrated settings: %d, profiles: %d", hasSettings, hasProfiles);
+  return true;
+}
+
+void LittleFSStorage::end() {
+  LittleFS.end();
+}
+
+bool LittleFSStorage::read(const char *name, String &content) {
+  return readFromFileSystem(LittleFS, name, content);
+}
+
+bool LittleFSStorage::write(const char *name, const String &content) {
+  File file = LittleFS.open(name, "w");
+  if(!file) return false;
+  size_t len = file.print(content);
+  file.close();
+  return len == content.length();
+}
+
+bool LittleFSStorage::remove(const char *name) { return LittleFS.remove(name); }
+bool LittleFSStorage::rename(const char *from, const char *to) { return LittleFS.rename(from, to); }
+bool LittleFSStorage::exists(const char *name) { return LittleFS.exists(name); }
+fs::FS& LittleFSStorage::fileSystem() { return LittleFS; }
+
+
+#ifdef STORAGE_IN_MEMORY
+int8_t MemoryStorage::find(const char *name) {
+  for(uint8_t i=0; i<MAX_NUM_OF_MEMORY_FILES; i++) {
+    if(names[i] == name) return i;
+  }
+  return -1;
+}
+
+bool MemoryStorage::read(const char *name, String &content) {
+  int8_t i = find(name);
+  if(i < 0) return false;
+  content = contents[i];
+  return true;
+}
+
+bool MemoryStorage::write(const char *name, const String &content) {
+  int8_t i = find(name);
+  if(i < 0) i = find("");
+  if(i < 0) return false;
+  names[i] = name;
+  contents[i] = content;
+  return true;
+}
+
+bool MemoryStorage::remove(const char *name) {
+  int8_t i = find(name);
+  if(i < 0) return false;
+  names[i] = "";
+  contents[i] = "";
+  return true;
+}
+
+bool MemoryStorage::rename(const char *from, const char *to) {
+  int8_t i = find(from);
+  if(i < 0) return false;
+  remove(to);
+  names[i] = to;
+  return true;
+}
+#endif
+
+
+/*
+ * Returns the index of "name" in the cache, -1 if it is not cached
+ */
+int8_t findCachedFile(const char *name) {
+  for(uint8_t i=0; i<MAX_NUM_OF_CACHED_FILES; i++) {
+    if(cache[i].name.length() > 0 && cache[i].name == name) return i;
+  }
+  return -1;
+}
+
+
+/*
+ * Removes "name" from the cache
+ */
+void uncacheFile(const char *name) {
+  int8_t i = findCachedFile(name);
+  if(i < 0) return;
+  cache[i].name = "";
+  cache[i].content = "";
+}
+
+
+/*
+ * Keeps "content" of the file "name" in the cache
+ * The least recently used files are removed until the cache has less than "STORAGE_CACHE_SIZE" bytes.
+ */
+void cacheFile(const char *name, const String &content) {
+  uncacheFile(name);
+  if(content.length() > STORAGE_CACHE_SIZE) return;
+  while(true) {
+    size_t size = content.length();
+    int8_t unused = -1;
+    int8_t oldest = -1;
+    for(uint8_t i=0; i<MAX_NUM_OF_CACHED_FILES; i++) {
+      if(cache[i].name.length() == 0) {
+        unused = i;
+        continue;
+      }
+      size += cache[i].content.length();
+      if(oldest < 0 || cache[i].lastUse < cache[oldest].lastUse) oldest = i;
+    }
+    if(unused >= 0 && size <= STORAGE_CACHE_SIZE) {
+      cache[unused].name = name;
+      cache[unused].content = content;
+      cache[unused].lastUse = ++cacheClock;
+      return;
+    }
+    cache[oldest].name = "";
+    cache[oldest].content = "";
+  }
+}
+
+
+void startStorage() {
+  if(!storageStarted && !storageStopped) {
+    DEBUG_INFO("start storage");
+    storageStarted = StorageBackend::begin();
+  }
+}
+
+/*
+ * Unmounts the file system, the files are only read from the cache and can't be written until "resumeStorage"
+ */
+void stopStorage() {
+  if(storageStarted) StorageBackend::end();
+  storageStarted = false;
+  storageStopped = true;
+}
+
+
+/*
+ * Mounts the file system again after "stopStorage", the cache is emptied because the files may have been replaced
+ */
+void resumeStorage() {
+  for(uint8_t i=0; i<MAX_NUM_OF_CACHED_FILES; i++) {
+    cache[i].name = "";
+    cache[i].content = "";
+  }
+  storageStopped = false;
+  startStorage();
+}
+
+bool readFile(const char *name, String &content) {
+  int8_t i = findCachedFile(name);
+  if(i >= 0) {
+    storageCacheHits++;
+    cache[i].lastUse = ++cacheClock;
+    content = cache[i].content;
+    return true;
+  }
+  storageCacheMisses++;
+  startStorage();
+  if(!StorageBackend::read(name, content)) return false;
+  cacheFile(name, content);
+  return true;
+}
+
+bool writeFile(const char *name, const String &content) {
+  startStorage();
+  uncacheFile(name);
+  if(!StorageBackend::write(name, content)) {
+    DEBUG_ERROR("[writeFile] writing %s failed", name);
+    return false;
+  }
+  cacheFile(name, content);
+  return true;
+}
+
+bool removeFile(const char *name) {
+  startStorage();
+  uncacheFile(name);
+  return StorageBackend::remove(name);
+}
+
+bool renameFile(const char *from, const char *to) {
+  startStorage();
+  uncacheFile(from);
+  uncacheFile(to);
+  return StorageBackend::rename(from, to);
+}
+
+bool fileExists(const char *name) {
+  if(findCachedFile(name) >= 0) return true;
+  startStorage();
+  return StorageBackend::exists(name);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef STORAGE__H
+#define STORAGE__H
+
+#include <Arduino.h>
+#include <FS.h>
+
+// constants
+static const uint8_t MAX_NUM_OF_CACHED_FILES = 2; // max number of files in the read cache
+static const size_t STORAGE_CACHE_SIZE = 8192; // max number of bytes in the read cache, larger files are never cached
+static const uint8_t MAX_NUM_OF_MEMORY_FILES = 8; // max number of files of the memory storage
+
+/*
+ * Storage backends
+ * A backend is a class with static functions only, like the PWM drivers, so the backend is chosen at compile time.
+ * Every backend provides
+ *   begin(): mounts the file system, returns false if it is not usable
+ *   end(): unmounts the file system
+ *   read(name, content): reads the whole file "name" into "content", returns false if there is no such file
+ *   write(name, content): replaces the file "name" with "content"
+ *   remove(name), rename(from, to), exists(name)
+ * The settings and profiles only use the functions below, which add a read cache for small files in the RAM.
+ */
+
+// LittleFS on the flash, an old SPIFFS image is migrated by "begin"
+struct LittleFSStorage {
+  static bool begin();
+  static void end();
+  static bool read(const char *name, String &content);
+  static bool write(const char *name, const String &content);
+  static bool remove(const char *name);
+  static bool rename(const char *from, const char *to);
+  static bool exists(const char *name);
+  // the file system for the static files of the website
+  static fs::FS& fileSystem();
+};
+
+// files in the RAM, e.g. for a build on the host without flash to test and benchmark the file handling
+// the content is lost on a restart and the website can't be served from it
+struct MemoryStorage {
+  static String names[MAX_NUM_OF_MEMORY_FILES]; // names of the files, empty if unused
+  static String contents[MAX_NUM_OF_MEMORY_FILES]; // contents of the files
+  static int8_t find(const char *name);
+  static bool begin() { return true; }
+  static void end() {}
+  static bool read(const char *name, String &content);
+  static bool write(const char *name, const String &content);
+  static bool remove(const char *name);
+  static bool rename(const char *from, const char *to);
+  static bool exists(const char *name) { return find(name) >= 0; }
+};
+
+// the backend of the firmware, a build with STORAGE_IN_MEMORY keeps all files in the RAM
+#ifdef STORAGE_IN_MEMORY
+  typedef MemoryStorage StorageBackend;
+#else
+  typedef LittleFSStorage StorageBackend;
+#endif
+
+// global variables
+extern uint32_t storageCacheHits; // number of reads answered by the cache
+extern uint32_t storageCacheMisses; // number of reads from the backend
+
+// mounts the file system if it isn't mounted yet and not stopped
+void startStorage();
+// unmounts the file system, e.g. while a new image is written to its flash, until "resumeStorage" is called
+void stopStorage();
+// empties the cache and mounts the file system again after "stopStorage"
+void resumeStorage();
+// reads the file "name" into "content" from the cache or the backend, returns false if there is no such file
+bool readFile(const char *name, String &content);
+// writes "content" to the file "name" and keeps it in the cache if it is small enough
+bool writeFile(const char *name, const String &content);
+// removes the file "name"
+bool removeFile(const char *name);
+// renames the file "from" to "to"
+bool renameFile(const char *from, const char *to);
+// returns true if the file "name" exists
+bool fileExists(const char *name);
+
+#endif
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "sync.h"
+#include "channel.h"
+#include "scenes.h"
+#include "debug.h"
+#include "ntp.h"
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+
+/*
+ * Global variables
+ */
+uint8_t syncMode; // current sync mode
+uint32_t syncBeacons; // number of beacons sent by the leader or received by the follower
+WiFiUDP syncUDP; // UDP object sending or receiving the beacons
+unsigned long millisAtLastBeacon; // millis uptime of the device at the last sent or received beacon
+uint16_t beaconSequence; // sequence number of the last sent beacon
+
+// state of the leader
+uint8_t manualChanges; // counts the changes of the manual channels
+uint8_t sentManualMask; // manual channels of the last beacon
+uint16_t sentValues[MAX_NUM_OF_CHANNELS]; // values of the manual channels of the last beacon
+uint8_t sentSceneChanges; // "sceneChanges" of the last beacon
+
+// state of the follower
+bool beaconReceived = false; // true if a beacon has been received since the sync was started
+uint8_t receivedManualChanges; // "manualChanges" of the last received beacon
+uint8_t receivedSceneChanges; // "sceneChanges" of the last received beacon
+uint8_t filteredBeacons; // number of beacons in the current filter window
+int64_t maxClockOffset; // max clock offset in the current filter window
+
+
+/*
+ * Beacon format, all numbers are little endian
+ *  0  'R', 'L'
+ *  2  version
+ *  3  flags, bit 0: a channel of the leader is fading
+ *  4  sequence number (uint16)
+ *  6  epoch time of the leader in ms (uint64)
+ *  14 "manualChanges" of the leader
+ *  15 "sceneChanges" of the leader
+ *  16 "activeScene" of the leader (int8)
+ *  17 "sceneFadeMillis" of the leader (uint32)
+ *  21 "sceneHoldSeconds" of the leader (uint32)
+ *  25 number of channels
+ *  26 manual channels, bit c is set if channel c is in manual mode
+ *  27 value of each channel in 1/100 % (uint16)
+ */
+static void writeLE(uint8_t *buf, uint64_t v, const uint8_t len) {
+  for(uint8_t i=0; i<len; i++) {
+    buf[i] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+static uint64_t readLE(const uint8_t *buf, const uint8_t len) {
+  uint64_t v = 0;
+  for(uint8_t i=len; i>0; i--) v = (v << 8) | buf[i-1];
+  return v;
+}
+
+
+/*
+ * Sends a beacon with the time and the state of the leader
+ * "manualChanges" is incremented if a manual channel has changed since the last beacon.
+ * Channels that are fading to a scene are not treated as changed, the followers make the same fade themselves
+ */
+void sendBeacon() {
+  uint8_t buf[SYNC_BEACON_MAX_SIZE];
+  bool fading = false;
+  uint8_t manualMask = 0;
+  uint16_t values[MAX_NUM_OF_CHANNELS];
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    if(channels[c].fadeStepsLeft > 0) fading = true;
+    if(channels[c].manual) manualMask |= 1 << c;
+    values[c] = channels[c].value * 100;
+  }
+  if(!fading) {
+    bool changed = manualMask != sentManualMask;
+    for(uint8_t c=0; c<numOfChannels; c++) {
+      if((manualMask & (1 << c)) && values[c] != sentValues[c]) changed = true;
+      sentValues[c] = values[c];
+    }
+    sentManualMask = manualMask;
+    if(changed) manualChanges++;
+  }
+
+  buf[0] = 'R';
+  buf[1] = 'L';
+  buf[2] = SYNC_BEACON_VERSION;
+  buf[3] = fading ? 1 : 0;
+  writeLE(buf+4, ++beaconSequence, 2);
+  buf[14] = manualChanges;
+  buf[15] = sentSceneChanges = sceneChanges;
+  buf[16] = uint8_t(activeScene);
+  writeLE(buf+17, sceneFadeMillis, 4);
+  writeLE(buf+21, sceneHoldSeconds, 4);
+  buf[25] = numOfChannels;
+  buf[26] = sentManualMask;
+  for(uint8_t c=0; c<numOfChannels; c++) writeLE(buf+SYNC_BEACON_HEADER_SIZE+2*c, sentValues[c], 2);
+  // the time is written last, so it is as close as possible to the sending
+  writeLE(buf+6, epochMillis(), 8);
+
+  syncUDP.beginPacketMulticast(IPAddress(SYNC_MULTICAST_IP[0], SYNC_MULTICAST_IP[1], SYNC_MULTICAST_IP[2], SYNC_MULTICAST_IP[3]), SYNC_PORT, WiFi.localIP());
+  syncUDP.write(buf, SYNC_BEACON_HEADER_SIZE + 2*numOfChannels);
+  syncUDP.endPacket();
+  syncBeacons++;
+}
+
+
+/*
+ * Follows the clock of the leader
+ * The beacons are delayed by the network and the main loop, so the offset between the clock of the
+ * leader and millis() is measured too small. The largest offset of "SYNC_FILTER_LENGTH" beacons is the one
+ * with the smallest delay and the clock is slewed towards it, so the clock does not jump.
+ */
+void followClock(const uint64_t leaderMillis, const unsigned long receivedMillis) {
+  int64_t offset = int64_t(leaderMillis) - int64_t(receivedMillis);
+  if(filteredBeacons == 0 || offset > maxClockOffset) maxClockOffset = offset;
+  if(++filteredBeacons < SYNC_FILTER_LENGTH && syncedClock) return;
+  filteredBeacons = 0;
+
+  int64_t error = maxClockOffset - syncedClockOffset;
+  if(!syncedClock || error > 1000 || error < -1000) {
+    // first lock or the clock jumped (e.g. millis() overflow or new NTP time of the leader)
+    syncedClockOffset = maxClockOffset;
+    DEBUG_INFO("[followClock] clock locked to the leader");
+  }
+  else syncedClockOffset += error / 2;
+  syncedClock = true;
+}
+
+
+/*
+ * Follows the state of the leader
+ * manual channels are mirrored if they have changed on the leader,
+ * recalls and releases of scenes are made with the same fade time
+ */
+void followState(const uint8_t *buf, const size_t len) {
+  uint8_t n = buf[25];
+  if(len < size_t(SYNC_BEACON_HEADER_SIZE + 2*n)) return;
+  bool leaderFading = buf[3] & 1;
+  uint8_t leaderManualChanges = buf[14];
+  uint8_t leaderSceneChanges = buf[15];
+  int8_t leaderScene = int8_t(buf[16]);
+
+  if(!beaconReceived || leaderSceneChanges != receivedSceneChanges) {
+    uint32_t fadeMillis = readLE(buf+17, 4);
+    if(leaderScene != NO_SCENE) recallScene(leaderScene, fadeMillis, readLE(buf+21, 4));
+    else if(beaconReceived) releaseScene(fadeMillis);
+  }
+  else if(!leaderFading && leaderManualChanges != receivedManualChanges) {
+    cancelScene();
+    for(uint8_t c=0; c<n && c<numOfChannels; c++) {
+      if(channels[c].moonlight) continue;
+      channels[c].manual = buf[26] & (1 << c);
+      if(channels[c].manual) channels[c].value = readLE(buf+SYNC_BEACON_HEADER_SIZE+2*c, 2) / 100.;
+    }
+    handlePWM(true);
+  }
+  receivedSceneChanges = leaderSceneChanges;
+  receivedManualChanges = leaderManualChanges;
+  beaconReceived = true;
+}
+
+
+/*
+ * Receives the beacons of the leader
+ */
+void receiveBeacons() {
+  uint8_t buf[SYNC_BEACON_MAX_SIZE];
+  while(syncUDP.parsePacket() > 0) {
+    unsigned long receivedMillis = millis();
+    int len = syncUDP.read(buf, sizeof(buf));
+    if(len < SYNC_BEACON_HEADER_SIZE || buf[0] != 'R' || buf[1] != 'L' || buf[2] != SYNC_BEACON_VERSION) {
+      DEBUG_WARNING("[receiveBeacons] invalid beacon");
+      continue;
+    }
+    followClock(readLE(buf+6, 8), receivedMillis);
+    followState(buf, len);
+    millisAtLastBeacon = receivedMillis;
+    syncBeacons++;
+  }
+  if(syncedClock && millis() - millisAtLastBeacon > SYNC_TIMEOUT) {
+    DEBUG_WARNING("[receiveBeacons] no beacon from the leader, the own clock is used");
+    syncedClock = false;
+    filteredBeacons = 0;
+  }
+}
+
+
+/*
+ * starts the sync according to "syncMode"
+ * the leader sends the beacons to the multicast group "SYNC_MULTICAST_IP",
+ * the follower joins the multicast group
+ */
+void startSync() {
+  syncUDP.stop();
+  syncedClock = false;
+  beaconReceived = false;
+  filteredBeacons = 0;
+  syncBeacons = 0;
+  IPAddress multicastIP(SYNC_MULTICAST_IP[0], SYNC_MULTICAST_IP[1], SYNC_MULTICAST_IP[2], SYNC_MULTICAST_IP[3]);
+  switch(syncMode) {
+    case SYNC_LEADER:
+      DEBUG_INFO("[startSync] leader");
+      syncUDP.begin(SYNC_PORT);
+      break;
+    case SYNC_FOLLOWER:
+      DEBUG_INFO("[startSync] follower");
+      syncUDP.beginMulticast(WiFi.localIP(), multicastIP, SYNC_PORT);
+      break;
+  }
+}
+
+
+/*
+ * handles the sync in the main loop
+ * the leader sends a beacon every "MILLIS_BETWEEN_SYNC_BEACONS" and immediately
+ * after a scene has been recalled or released, so the followers start their fade at the same time
+ * the follower receives the beacons
+ */
+void handleSync() {
+  switch(syncMode) {
+    case SYNC_LEADER:
+      if(millis() - millisAtLastBeacon >= MILLIS_BETWEEN_SYNC_BEACONS || sceneChanges != sentSceneChanges) {
+        millisAtLastBeacon = millis();
+        sendBeacon();
+      }
+      break;
+    case SYNC_FOLLOWER:
+      receiveBeacons();
+      break;
+  }
+}
+
+
+uint32_t millisUntilSync() {
+  switch(syncMode) {
+    case SYNC_LEADER: {
+      unsigned long passed = millis() - millisAtLastBeacon;
+      if(sceneChanges != sentSceneChanges) return 0;
+      return passed >= MILLIS_BETWEEN_SYNC_BEACONS ? 0 : MILLIS_BETWEEN_SYNC_BEACONS - passed;
+    }
+    case SYNC_FOLLOWER:
+      // the offset of the clock is computed from the arrival of the beacons
+      return 0;
+  }
+  return UINT32_MAX;
+}
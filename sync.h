@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef SYNC__H
+#define SYNC__H
+
+#include <Arduino.h>
+
+// constants
+static const uint8_t SYNC_OFF = 0; // Macros for the sync mode: the device runs on its own
+static const uint8_t SYNC_LEADER = 1; // the device sends its time and state as beacon to the followers
+static const uint8_t SYNC_FOLLOWER = 2; // the device follows the time and state of the leader
+static const uint8_t SYNC_MULTICAST_IP[] = {239, 255, 42, 42}; // multicast group of the beacons
+static const uint16_t SYNC_PORT = 4210; // UDP port of the beacons
+static const unsigned long MILLIS_BETWEEN_SYNC_BEACONS = 1000; // time between two beacons of the leader in ms
+static const unsigned long SYNC_TIMEOUT = 10000; // time in ms without beacons until a follower uses its own clock again
+static const uint8_t SYNC_FILTER_LENGTH = 8; // number of beacons the clock offset of a follower is filtered over
+static const uint8_t SYNC_BEACON_VERSION = 1; // version of the beacon format
+static const uint8_t SYNC_BEACON_HEADER_SIZE = 27; // size of the beacon without the channel values
+static const uint8_t SYNC_BEACON_MAX_SIZE = SYNC_BEACON_HEADER_SIZE + 2*8; // size of the beacon with 8 channels
+
+// global variables
+extern uint8_t syncMode; // current sync mode
+extern uint32_t syncBeacons; // number of beacons sent by the leader or received by the follower
+
+// starts the sync according to "syncMode"
+void startSync();
+// handles the sync in the main loop
+void handleSync();
+// returns the time in ms until "handleSync" has work to do, 0 for a follower that has to receive the beacons on time
+uint32_t millisUntilSync();
+
+#endif
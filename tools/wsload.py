@@ -0,0 +1,290 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2018 Michael Dahsler
+# Published under the MIT Licence, see licence.txt
+#
+# Load generator for the websocket of a ReefLight device.
+#
+# Opens several websocket clients at the same time and sends a mix of manual updates (like dragging a slider on the
+# manual page), schedule requests and settings saves at the given rates. Afterwards it prints the latency percentiles
+# of the requests, the requests that got no answer and the metrics of the device from /metrics, e.g. how late the PWM
+# updates were during the load.
+#
+# Only the python standard library is needed:
+#   python3 tools/wsload.py 192.168.1.50 --clients 5 --manual-rate 20 --schedule-rate 1 --duration 30
+#
+# The manual values of the device are restored at the end. Settings saves write to the flash of the device, so they
+# are disabled by default.
+
+import argparse
+import base64
+import json
+import os
+import socket
+import struct
+import threading
+import time
+import urllib.request
+
+# ids of the websocket messages, see server.h
+ID_REQUEST_MANUAL_FROM_SERVER = 0
+ID_SEND_MANUAL_TO_CLIENT = 1
+ID_UPDATE_MANUAL = 2
+ID_REQUEST_SCHEDULE_FROM_SERVER = 10
+ID_SEND_SCHEDULE_TO_CLIENT = 11
+ID_REQUEST_SETTINGS_FROM_SERVER = 20
+ID_SEND_SETTINGS_TO_CLIENT = 21
+ID_SAVE_SETTINGS = 22
+
+
+class WebSocketClient:
+    """Minimal websocket client for text messages"""
+
+    def __init__(self, host, port, timeout, path="/ws"):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        key = base64.b64encode(os.urandom(16)).decode()
+        request = ("GET %s HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                   "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n" % (path, host, port, key))
+        self.sock.sendall(request.encode())
+        response = b""
+        while b"\r\n\r\n" not in response:
+            data = self.sock.recv(1024)
+            if not data:
+                raise ConnectionError("handshake failed")
+            response += data
+        if b" 101 " not in response.split(b"\r\n")[0]:
+            raise ConnectionError("handshake failed: %r" % response.split(b"\r\n")[0])
+        self.buffer = response.split(b"\r\n\r\n", 1)[1]
+        self.lock = threading.Lock()
+
+    def send(self, text):
+        self._send_frame(0x1, text.encode())
+
+    def _send_frame(self, opcode, payload):
+        header = bytes([0x80 | opcode])
+        if len(payload) < 126:
+            header += bytes([0x80 | len(payload)])
+        elif len(payload) < 65536:
+            header += bytes([0x80 | 126]) + struct.pack(">H", len(payload))
+        else:
+            header += bytes([0x80 | 127]) + struct.pack(">Q", len(payload))
+        mask = os.urandom(4)
+        masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+        with self.lock:
+            self.sock.sendall(header + mask + masked)
+
+    def _read(self, n):
+        while len(self.buffer) < n:
+            data = self.sock.recv(4096)
+            if not data:
+                raise ConnectionError("connection closed")
+            self.buffer += data
+        data, self.buffer = self.buffer[:n], self.buffer[n:]
+        return data
+
+    def receive(self):
+        """returns the next text message, None if the connection is closed"""
+        message = b""
+        while True:
+            first, second = self._read(2)
+            length = second & 0x7F
+            if length == 126:
+                length = struct.unpack(">H", self._read(2))[0]
+            elif length == 127:
+                length = struct.unpack(">Q", self._read(8))[0]
+            payload = self._read(length)
+            opcode = first & 0x0F
+            if opcode == 0x8:
+                return None
+            if opcode == 0x9:
+                self._send_frame(0xA, payload)
+                continue
+            if opcode in (0x0, 0x1, 0x2):
+                message += payload
+                if first & 0x80:
+                    return message.decode(errors="replace")
+
+    def close(self):
+        try:
+            self._send_frame(0x8, b"")
+        except OSError:
+            pass
+        self.sock.close()
+
+
+class LoadClient(threading.Thread):
+    """Sends the message mix on one websocket connection and measures the latency of the requests"""
+
+    def __init__(self, args, number, manual, settings, stop):
+        super().__init__(daemon=True)
+        self.args = args
+        self.number = number
+        self.manual = json.loads(json.dumps(manual))
+        self.settings = settings
+        self.stop = stop
+        self.sent = {"manual": 0, "schedule": 0, "settings": 0}
+        self.latencies = []
+        self.lost = 0
+        self.errors = []
+        self.pending = []  # send times of the schedule requests, the answers come in order
+        self.pending_lock = threading.Lock()
+
+    def reader(self, ws):
+        while True:
+            try:
+                message = ws.receive()
+            except (OSError, ConnectionError):
+                return
+            if message is None:
+                return
+            try:
+                msg_id = json.loads(message).get("id")
+            except ValueError:
+                continue
+            if msg_id == ID_SEND_SCHEDULE_TO_CLIENT:
+                with self.pending_lock:
+                    if self.pending:
+                        self.latencies.append(time.monotonic() - self.pending.pop(0))
+
+    def run(self):
+        try:
+            ws = WebSocketClient(self.args.host, self.args.port, self.args.timeout)
+        except (OSError, ConnectionError) as e:
+            self.errors.append("client %d: %s" % (self.number, e))
+            return
+        threading.Thread(target=self.reader, args=(ws,), daemon=True).start()
+
+        rates = [("manual", self.args.manual_rate), ("schedule", self.args.schedule_rate),
+                 ("settings", self.args.settings_rate)]
+        start = time.monotonic()
+        next_time = {kind: start + (self.number * 0.013 if rate > 0 else float("inf")) for kind, rate in rates}
+        step = 0
+        try:
+            while not self.stop.is_set():
+                kind = min(next_time, key=next_time.get)
+                delay = next_time[kind] - time.monotonic()
+                if delay > 0:
+                    if self.stop.wait(delay):
+                        break
+                now = time.monotonic()
+                if kind == "manual":
+                    # a slider that is dragged back and forth
+                    step += 1
+                    c = self.number % len(self.manual["channels"])
+                    self.manual["id"] = ID_UPDATE_MANUAL
+                    self.manual["channels"][c]["manual"] = True
+                    self.manual["channels"][c]["value"] = abs((step * 2) % 200 - 100)
+                    ws.send(json.dumps(self.manual))
+                elif kind == "schedule":
+                    with self.pending_lock:
+                        self.pending.append(now)
+                    ws.send(json.dumps({"id": ID_REQUEST_SCHEDULE_FROM_SERVER}))
+                else:
+                    ws.send(json.dumps(dict(self.settings, id=ID_SAVE_SETTINGS)))
+                self.sent[kind] += 1
+                next_time[kind] += 1.0 / dict(rates)[kind]
+        except (OSError, ConnectionError) as e:
+            self.errors.append("client %d: %s" % (self.number, e))
+
+        # waits for the last answers
+        deadline = time.monotonic() + self.args.timeout
+        while time.monotonic() < deadline:
+            with self.pending_lock:
+                if not self.pending:
+                    break
+            time.sleep(0.05)
+        with self.pending_lock:
+            self.lost = len(self.pending)
+        ws.close()
+
+
+def request_once(host, port, timeout, request_id, reply_id):
+    ws = WebSocketClient(host, port, timeout)
+    try:
+        ws.send(json.dumps({"id": request_id}))
+        while True:
+            msg = json.loads(ws.receive())
+            if msg.get("id") == reply_id:
+                return msg
+    finally:
+        ws.close()
+
+
+def metrics(host, http_port, timeout, reset=False):
+    url = "http://%s:%d/metrics%s" % (host, http_port, "?reset=1" if reset else "")
+    with urllib.request.urlopen(url, timeout=timeout) as response:
+        return json.loads(response.read().decode())
+
+
+def percentile(values, p):
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="websocket load generator for ReefLight devices")
+    parser.add_argument("host", help="ip address or name of the device")
+    parser.add_argument("--port", type=int, default=80, help="port of the websocket")
+    parser.add_argument("--http-port", type=int, default=80, help="port of the webserver")
+    parser.add_argument("--clients", type=int, default=5, help="number of websocket clients at the same time")
+    parser.add_argument("--duration", type=float, default=30, help="duration of the test in s")
+    parser.add_argument("--manual-rate", type=float, default=20, help="manual updates per s and client")
+    parser.add_argument("--schedule-rate", type=float, default=1, help="schedule requests per s and client")
+    parser.add_argument("--settings-rate", type=float, default=0, help="settings saves per s and client (writes the flash)")
+    parser.add_argument("--timeout", type=float, default=5, help="timeout of the answers in s")
+    parser.add_argument("--json", action="store_true", help="prints the results as json")
+    args = parser.parse_args()
+
+    manual = request_once(args.host, args.port, args.timeout, ID_REQUEST_MANUAL_FROM_SERVER, ID_SEND_MANUAL_TO_CLIENT)
+    settings = request_once(args.host, args.port, args.timeout, ID_REQUEST_SETTINGS_FROM_SERVER, ID_SEND_SETTINGS_TO_CLIENT)
+    if not manual.get("channels"):
+        args.manual_rate = 0
+    metrics(args.host, args.http_port, args.timeout, reset=True)
+
+    stop = threading.Event()
+    clients = [LoadClient(args, n, manual, settings, stop) for n in range(args.clients)]
+    for client in clients:
+        client.start()
+    time.sleep(args.duration)
+    stop.set()
+    for client in clients:
+        client.join()
+
+    device = metrics(args.host, args.http_port, args.timeout)
+
+    # restores the manual values
+    ws = WebSocketClient(args.host, args.port, args.timeout)
+    ws.send(json.dumps(dict(manual, id=ID_UPDATE_MANUAL)))
+    ws.close()
+
+    latencies = [l * 1000 for client in clients for l in client.latencies]
+    sent = {kind: sum(client.sent[kind] for client in clients) for kind in ("manual", "schedule", "settings")}
+    results = {
+        "clients": args.clients,
+        "duration": args.duration,
+        "sent": sent,
+        "received": device.get("messages"),
+        "dropped": sum(sent.values()) - device.get("messages", 0),
+        "lost": sum(client.lost for client in clients),
+        "latency": {"p50": percentile(latencies, 50), "p90": percentile(latencies, 90),
+                    "p99": percentile(latencies, 99), "max": max(latencies) if latencies else float("nan")},
+        "device": device,
+        "errors": [e for client in clients for e in client.errors],
+    }
+    if args.json:
+        print(json.dumps(results, indent=2))
+        return
+    print("sent: %d manual updates, %d schedule requests, %d settings saves" % (sent["manual"], sent["schedule"], sent["settings"]))
+    print("received by the device: %s, dropped: %d, invalid: %s" % (results["received"], results["dropped"], device.get("invalidMessages")))
+    print("schedule requests without answer: %d" % results["lost"])
+    print("schedule latency [ms]: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f" % tuple(results["latency"][k] for k in ("p50", "p90", "p99", "max")))
+    print("longest message on the device: %s ms" % device.get("maxMessageMillis"))
+    print("PWM updates: %s, max lateness: %s ms, missed ticks: %s" % (device.get("pwmUpdates"), device.get("pwmMaxLateness"), device.get("pwmMissedTicks")))
+    for e in results["errors"]:
+        print("error: " + e)
+
+
+if __name__ == "__main__":
+    main()
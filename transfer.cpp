@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "transfer.h"
+#include "server.h"
+#include "settings.h"
+#include "channel.h"
+#include "profiles.h"
+#include "debug.h"
+#include <ESPAsyncWebServer.h>
+#include <new>
+#include <ArduinoJson.h>
+
+// constants
+static const uint8_t FORMAT_UNKNOWN = 0; // the format is detected by the first character of the upload
+static const uint8_t FORMAT_CSV = 1;
+static const uint8_t FORMAT_JSON = 2;
+static const uint8_t KEY_NONE = 0; // json keys that are parsed
+static const uint8_t KEY_CHANNELS = 1;
+static const uint8_t KEY_ENTRIES = 2;
+static const uint8_t KEY_OTHER = 3;
+static const uint8_t LEN_IMPORT_TOKEN = 47; // max length of a csv line, a json string or a number
+static const uint16_t MAX_NUM_OF_IMPORT_SAMPLES = 1024; // max number of entries of all channels of an upload before the decimation
+static const float DEFAULT_IMPORT_TOLERANCE = 0.5; // max error in % of a decimated channel if the upload sets none
+static const unsigned long IMPORT_TIMEOUT = 10000; // time in ms without a chunk after which an import no longer blocks others
+
+// global variables
+AsyncWebServerRequest *importRequest = NULL; // request of the running import, other uploads are refused meanwhile
+unsigned long millisAtImportChunk = 0; // millis uptime of the last chunk of "importRequest"
+
+// entry of an upload, the channel is stored in the top byte of the time, so sorting by "tc" groups the channels by time
+struct ImportSample {
+  uint32_t tc; // channel << 24 | time in s
+  float v; // value in %
+};
+
+static int compareSamples(const void *a, const void *b) {
+  uint32_t ta = ((const ImportSample *) a)->tc;
+  uint32_t tb = ((const ImportSample *) b)->tc;
+  return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+/*
+ * Parses an uploaded schedule chunk by chunk, so the upload is never kept in memory
+ * Only the entries of the uploaded channels are kept, up to "MAX_NUM_OF_IMPORT_SAMPLES" of all channels together.
+ * "decimate" reduces them to at most "MAX_NUM_OF_ENTRIES" per channel, so dense curves, e.g. logged every few
+ * minutes, can be imported.
+ *
+ * csv: one "channel,time,value" line per entry, the time in s or as hh:mm[:ss] and the value in %.
+ *      Empty lines, lines starting with '#' and a header line are skipped.
+ * json: {"channels":[{"entries":[[time,value],...]},...]} with the time in s and the value in %,
+ *      all other keys are skipped, so an export can be imported again.
+ */
+class ScheduleParser {
+
+  public:
+    const char *error = NULL; // reason why the upload can not be imported, NULL if it is valid
+    uint16_t line = 1; // current line of the upload
+    bool imported[MAX_NUM_OF_CHANNELS] = {}; // true if the upload contains the channel
+    uint16_t numOfSamples = 0; // number of entries of all channels in the upload
+    float tolerance = DEFAULT_IMPORT_TOLERANCE; // max error in % of the decimated channels
+    bool decimateAll = false; // if false, only channels with more than "MAX_NUM_OF_ENTRIES" entries are decimated
+    float maxError = 0; // max error in % of all channels after the decimation
+    uint8_t numOfEntries[MAX_NUM_OF_CHANNELS] = {}; // number of entries of each channel after the decimation
+    uint32_t t[MAX_NUM_OF_CHANNELS][MAX_NUM_OF_ENTRIES]; // times of the entries in s
+    float v[MAX_NUM_OF_CHANNELS][MAX_NUM_OF_ENTRIES]; // values of the entries in %
+
+    // parses the next "len" bytes of the upload
+    void parse(const uint8_t *buf, const size_t len);
+    // parses the rest of the upload after the last chunk
+    void finish();
+    // reduces the entries of each channel to the fewest that stay within "tolerance"
+    void decimate();
+
+  private:
+    uint8_t format = FORMAT_UNKNOWN;
+    char token[LEN_IMPORT_TOKEN + 1]; // current csv line, json string or json number
+    uint8_t tokenLen = 0;
+    // json state
+    uint8_t depth = 0; // depth of the nested objects and arrays
+    uint8_t channelsDepth = 0; // depth of the "channels" array, 0 outside of it
+    uint8_t entriesDepth = 0; // depth of the "entries" array, 0 outside of it
+    uint8_t key = KEY_NONE; // key of the next value
+    int16_t channel = -1; // current channel, -1 before the first channel object
+    bool inString = false;
+    bool inNumber = false;
+    bool escape = false;
+    uint8_t numOfValues = 0; // number of values of the current entry
+    float values[2]; // time and value of the current entry
+    ImportSample samples[MAX_NUM_OF_IMPORT_SAMPLES]; // entries of all channels
+    uint16_t numOfChannelSamples[MAX_NUM_OF_CHANNELS] = {}; // number of entries of each channel in the upload
+    Channel preview; // computes the curve of the kept entries during the decimation
+
+    void parseCSV(const char c);
+    void parseCSVLine();
+    void parseJSON(const char c);
+    void addJSONValue(const float x);
+    void addEntry(const uint8_t c, const float time, const float value);
+    void setError(const char *reason);
+    void decimateChannel(const uint8_t c, const uint16_t first, const uint16_t last);
+};
+
+
+void ScheduleParser::setError(const char *reason) {
+  if(error == NULL) error = reason;
+}
+
+
+void ScheduleParser::addEntry(const uint8_t c, const float time, const float value) {
+  if(c >= numOfChannels) return setError("channel is not active");
+  if(time < 0 || time >= 24*60*60) return setError("time out of range");
+  if(value < 0 || value > 100) return setError("value out of range");
+  // the schedule of channels in moonlight mode is not used
+  if(channels[c].moonlight) return;
+  imported[c] = true;
+  if(numOfSamples >= MAX_NUM_OF_IMPORT_SAMPLES) return setError("too many entries");
+  samples[numOfSamples].tc = uint32_t(c) << 24 | uint32_t(time);
+  samples[numOfSamples].v = value;
+  numOfSamples++;
+  numOfChannelSamples[c]++;
+}
+
+
+void ScheduleParser::parse(const uint8_t *buf, const size_t len) {
+  for(size_t i=0; i<len && error == NULL; i++) {
+    char c = buf[i];
+    if(format == FORMAT_UNKNOWN) {
+      if(isspace(c)) continue;
+      format = c == '{' ? FORMAT_JSON : FORMAT_CSV;
+    }
+    if(format == FORMAT_JSON) parseJSON(c);
+    else parseCSV(c);
+    if(c == '\n' && error == NULL) line++;
+  }
+}
+
+
+void ScheduleParser::finish() {
+  if(format == FORMAT_CSV && tokenLen > 0) parseCSVLine();
+  if(format == FORMAT_JSON && depth != 0) setError("incomplete json");
+  bool empty = true;
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    if(imported[c] && numOfChannelSamples[c] == 0) setError("channel without entries");
+    if(imported[c]) empty = false;
+  }
+  if(empty) setError("no entries");
+}
+
+
+/*
+ * Sorts the entries by channel and time and decimates each channel, see "decimateChannel"
+ * Called in the main loop, the decimation of 1000 entries takes a few ms.
+ */
+void ScheduleParser::decimate() {
+  qsort(samples, numOfSamples, sizeof(ImportSample), compareSamples);
+  maxError = 0;
+  uint16_t first = 0;
+  while(first < numOfSamples) {
+    uint8_t c = samples[first].tc >> 24;
+    uint16_t last = first;
+    while(last < numOfSamples && samples[last].tc >> 24 == c) last++;
+    decimateChannel(c, first, last);
+    first = last;
+  }
+}
+
+
+/*
+ * Reduces the entries "first" to "last" of channel "c" to the fewest that stay within "tolerance" (Ramer-Douglas-Peucker)
+ * Starting with the first entry, the entry with the largest difference to the curve through the kept entries is kept,
+ * until the difference of all entries is within "tolerance" or "MAX_NUM_OF_ENTRIES" entries are kept. The curve is
+ * computed by "Channel::computeSegments" with the interpolation of the channel, so the error is the one of the schedule
+ * that is really generated, also for smoothstep and cubic channels, including the wrap at midnight.
+ * If the channel fits and "decimateAll" is not set, all entries are kept.
+ */
+void ScheduleParser::decimateChannel(const uint8_t c, const uint16_t first, const uint16_t last) {
+  float maxDiff = decimateAll || last - first > MAX_NUM_OF_ENTRIES ? tolerance : -1;
+  uint16_t kept[MAX_NUM_OF_ENTRIES] = {first}; // kept entries in ascending order
+  uint8_t numOfKept = 1;
+  float error;
+  preview.interpolation = channels[c].interpolation;
+  while(true) {
+    for(uint8_t k=0; k<numOfKept; k++) {
+      t[c][k] = samples[kept[k]].tc & 0xFFFFFF;
+      v[c][k] = samples[kept[k]].v;
+    }
+    preview.computeSegments(t[c], v[c], numOfKept, 1);
+
+    // entry with the largest difference, -1 if all entries are kept
+    error = -1;
+    uint16_t worst = 0;
+    uint8_t worstPos = 0;
+    uint8_t k = 0; // number of kept entries before "j"
+    for(uint16_t j=first; j<last; j++) {
+      if(k < numOfKept && kept[k] == j) {
+        k++;
+        continue;
+      }
+      float diff = fabsf(samples[j].v - preview.getScheduleValue(samples[j].tc & 0xFFFFFF));
+      if(diff > error) {
+        error = diff;
+        worst = j;
+        worstPos = k;
+      }
+    }
+    if(error <= maxDiff || numOfKept == MAX_NUM_OF_ENTRIES) break;
+    memmove(kept + worstPos + 1, kept + worstPos, (numOfKept - worstPos) * sizeof(uint16_t));
+    kept[worstPos] = worst;
+    numOfKept++;
+  }
+
+  numOfEntries[c] = numOfKept;
+  if(error > maxError) maxError = error;
+  DEBUG_INFO("[decimateChannel] channel %u: %u of %u entries, max error %.2f %%", c, numOfKept, last - first, error > 0 ? error : 0);
+}
+
+
+void ScheduleParser::parseCSV(const char c) {
+  if(c == '\r') return;
+  if(c == '\n') {
+    parseCSVLine();
+    tokenLen = 0;
+    return;
+  }
+  if(tokenLen >= LEN_IMPORT_TOKEN) return setError("line too long");
+  token[tokenLen++] = c;
+}
+
+
+void ScheduleParser::parseCSVLine() {
+  token[tokenLen] = 0;
+  char *s = token;
+  while(isspace(*s)) s++;
+  if(*s == 0 || *s == '#') return;
+  // the header line
+  if(!isdigit(*s)) {
+    if(line == 1) return;
+    return setError("invalid line");
+  }
+
+  // channel
+  char *end;
+  long c = strtol(s, &end, 10);
+  if(*end != ',' && *end != ';') return setError("invalid line");
+  // time in s or hh:mm[:ss]
+  s = end + 1;
+  float time = strtol(s, &end, 10);
+  for(uint8_t i=0; i<2 && *end == ':'; i++) {
+    time = time * 60 + strtol(end + 1, &end, 10);
+    if(i == 0 && *end != ':') time *= 60;
+  }
+  if(end == s || (*end != ',' && *end != ';')) return setError("invalid time");
+  // value
+  s = end + 1;
+  float value = strtod(s, &end);
+  while(isspace(*end)) end++;
+  if(end == s || *end != 0) return setError("invalid value");
+
+  // checked before it is narrowed to the channel number of "addEntry"
+  if(c < 0 || c >= numOfChannels) return setError("channel is not active");
+  addEntry(c, time, value);
+}
+
+
+void ScheduleParser::parseJSON(const char c) {
+  if(inString) {
+    if(escape) escape = false;
+    else if(c == '\\') escape = true;
+    else if(c == '"') {
+      inString = false;
+      token[tokenLen] = 0;
+    }
+    else if(tokenLen < LEN_IMPORT_TOKEN) token[tokenLen++] = c;
+    return;
+  }
+  if(isdigit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+    if(!inNumber) tokenLen = 0;
+    inNumber = true;
+    if(tokenLen < LEN_IMPORT_TOKEN) token[tokenLen++] = c;
+    return;
+  }
+  if(inNumber) {
+    inNumber = false;
+    token[tokenLen] = 0;
+    addJSONValue(atof(token));
+  }
+
+  switch(c) {
+    case '"':
+      inString = true;
+      tokenLen = 0;
+      break;
+    case ':':
+      if(strcmp(token, "channels") == 0) key = KEY_CHANNELS;
+      else if(strcmp(token, "entries") == 0) key = KEY_ENTRIES;
+      else key = KEY_OTHER;
+      break;
+    case '[':
+      depth++;
+      if(key == KEY_CHANNELS && depth == 2) channelsDepth = depth;
+      else if(key == KEY_ENTRIES && channelsDepth > 0 && depth == channelsDepth + 2) {
+        entriesDepth = depth;
+        if(channel < 0 || channel >= numOfChannels) return setError("channel is not active");
+        imported[channel] = !channels[channel].moonlight;
+        numOfEntries[channel] = 0;
+      }
+      else if(entriesDepth > 0 && depth == entriesDepth + 1) numOfValues = 0;
+      key = KEY_NONE;
+      break;
+    case '{':
+      depth++;
+      // the channel saturates, so too many channel objects are rejected and do not wrap around
+      if(channelsDepth > 0 && depth == channelsDepth + 1 && channel < MAX_NUM_OF_CHANNELS) channel++;
+      key = KEY_NONE;
+      break;
+    case ']':
+      if(entriesDepth > 0 && depth == entriesDepth + 1) {
+        if(numOfValues != 2) return setError("entry without time and value");
+        addEntry(channel, values[0], values[1]);
+      }
+      if(depth == entriesDepth) entriesDepth = 0;
+      if(depth == channelsDepth) channelsDepth = 0;
+      depth--;
+      break;
+    case '}':
+      depth--;
+      break;
+    case ',':
+      key = KEY_NONE;
+      break;
+  }
+}
+
+
+void ScheduleParser::addJSONValue(const float x) {
+  if(entriesDepth == 0 || depth != entriesDepth + 1) return;
+  if(numOfValues >= 2) return setError("entry with more than time and value");
+  values[numOfValues++] = x;
+}
+
+
+
+
+void handleScheduleExportCSV(AsyncWebServerRequest *request) {
+  DEBUG_INFO("[handleScheduleExportCSV]");
+  String chunk = F("channel,time,value\n");
+  char line[32];
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    for(uint8_t i=0; i<channels[c].numOfEntries; i++) {
+      uint32_t t = channels[c].t[i];
+      snprintf(line, sizeof(line), "%u,%02u:%02u:%02u,%.2f\n", c, t / 3600, t / 60 % 60, t % 60, channels[c].v[i]);
+      chunk += line;
+    }
+  }
+  request->send(200, F("text/csv"), chunk);
+}
+
+
+void handleScheduleExportJSON(AsyncWebServerRequest *request) {
+  DEBUG_INFO("[handleScheduleExportJSON]");
+  String chunk = F("{\"channels\":[");
+  char entry[32];
+  for(uint8_t c=0; c<numOfChannels; c++) {
+    if(c > 0) chunk += ',';
+    // the name is escaped by ArduinoJson, it may contain quotes
+    chunk += F("{\"name\":");
+    JsonVariant(channels[c].name).printTo(chunk);
+    chunk += F(",\"entries\":[");
+    for(uint8_t i=0; i<channels[c].numOfEntries; i++) {
+      snprintf(entry, sizeof(entry), "%s[%u,%.2f]", i > 0 ? "," : "", channels[c].t[i], channels[c].v[i]);
+      chunk += entry;
+    }
+    chunk += F("]}");
+  }
+  chunk += F("]}\n");
+  request->send(200, F("application/json"), chunk);
+}
+
+
+/*
+ * Returns true while "importRequest" imports a schedule, an import without a chunk for "IMPORT_TIMEOUT" is given up,
+ * e.g. if the client is gone
+ */
+static bool importRunning() {
+  return importRequest != NULL && millis() - millisAtImportChunk < IMPORT_TIMEOUT;
+}
+
+
+/*
+ * Parses a chunk of the uploaded schedule, called by the TCP stack
+ * The parser belongs to the request ("_tempObject"). The server frees it with free() together with the request, also
+ * if the client is gone or the request is refused, so it is allocated with malloc.
+ * The parser needs about 10 kB, so only one schedule is imported at a time, the uploads of other clients are not
+ * parsed and answered with 503 by "handleScheduleImport".
+ */
+void handleScheduleUpload(AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final) {
+  if(index == 0) {
+    DEBUG_INFO("[handleScheduleUpload] %s", filename.c_str());
+    free(request->_tempObject);
+    request->_tempObject = NULL;
+    if(importRunning() && importRequest != request) {
+      DEBUG_WARNING("[handleScheduleUpload] another import is running");
+      return;
+    }
+    importRequest = request;
+    millisAtImportChunk = millis();
+    void *memory = malloc(sizeof(ScheduleParser));
+    if(memory == NULL) {
+      DEBUG_WARNING("[handleScheduleUpload] not enough memory");
+      return;
+    }
+    ScheduleParser *parser = new(memory) ScheduleParser();
+    request->_tempObject = parser;
+    if(request->hasArg("tolerance")) {
+      float tolerance = request->arg("tolerance").toFloat();
+      parser->tolerance = tolerance > 0 ? tolerance : 0;
+      parser->decimateAll = true;
+    }
+  }
+  ScheduleParser *parser = (ScheduleParser*)request->_tempObject;
+  if(parser == NULL || request != importRequest) return;
+  millisAtImportChunk = millis();
+  parser->parse(data, len);
+  if(final) parser->finish();
+}
+
+
+/*
+ * Applies the uploaded schedule in the main loop, see "handleScheduleImport"
+ */
+void applyScheduleImport(AsyncWebServerRequest *request) {
+  importRequest = NULL;
+  ScheduleParser *scheduleParser = (ScheduleParser*)request->_tempObject;
+  if(scheduleParser == NULL) {
+    sendDeferred(400, F("text/plain"), F("no schedule uploaded or not enough memory"));
+    return;
+  }
+  if(scheduleParser->error) {
+    DEBUG_WARNING("[handleScheduleImport] line %u: %s", scheduleParser->line, scheduleParser->error);
+    sendDeferred(400, F("text/plain"), "line " + String(scheduleParser->line) + ": " + scheduleParser->error);
+  }
+  else {
+    scheduleParser->decimate();
+    uint16_t count = 0;
+    for(uint8_t c=0; c<numOfChannels; c++) {
+      if(!scheduleParser->imported[c]) continue;
+      channels[c].numOfEntries = scheduleParser->numOfEntries[c];
+      for(uint8_t i=0; i<channels[c].numOfEntries; i++) {
+        channels[c].t[i] = scheduleParser->t[c][i];
+        channels[c].v[i] = scheduleParser->v[c][i];
+      }
+      channels[c].prepareSchedule();
+      count += channels[c].numOfEntries;
+    }
+    DEBUG_INFO("[handleScheduleImport] %u of %u entries imported", count, scheduleParser->numOfSamples);
+    revisionSchedule++;
+    resolveProfiles();
+    saveSettings();
+    handlePWM(true);
+    sendDeferred(200, F("text/plain"), String(count) + " of " + String(scheduleParser->numOfSamples) + " entries imported, max error " + String(scheduleParser->maxError, 2) + " %");
+  }
+  // the parser is freed with the request
+}
+
+
+void handleScheduleImport(AsyncWebServerRequest *request) {
+  if(request != importRequest && importRunning()) {
+    request->send(503, F("text/plain"), F("Busy, try again later"));
+    return;
+  }
+  // the settings are saved and the PWM is updated, which is too slow for the callback of the server
+  if(!deferRequest(request, applyScheduleImport) && request == importRequest) importRequest = NULL;
+}
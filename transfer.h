@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef TRANSFER__H
+#define TRANSFER__H
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// sends the schedule of the active channels as csv with one "channel,time,value" line per entry
+void handleScheduleExportCSV(AsyncWebServerRequest *request);
+// sends the schedule of the active channels as json {"channels":[{"name":..., "entries":[[time,value],...]},...]}
+void handleScheduleExportJSON(AsyncWebServerRequest *request);
+// parses a chunk of an uploaded schedule in csv or json
+void handleScheduleUpload(AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t *data, size_t len, bool final);
+// applies the uploaded schedule in the main loop and sends the result to the http client
+void handleScheduleImport(AsyncWebServerRequest *request);
+
+#endif
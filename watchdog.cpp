@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#include "watchdog.h"
+#include "settings.h"
+#include "debug.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Ticker.h>
+#include <user_interface.h>
+
+// constants
+static const uint16_t STAGE_BUDGET_MS[NUM_OF_STAGES] = {1000, 1000, 1000, 10000, 5000, 1000, 1000, 1000, 2000, 1000}; // max duration of each stage in ms
+static const char *const STAGE_NAMES[NUM_OF_STAGES] = {"profiles", "scenes", "pwm", "server", "ntp", "sync", "effects", "log", "idle", "mqtt"};
+
+// global variables
+WatchdogDump dump; // dump of this run
+WatchdogDump lastDump; // dump of the last run, valid if its "magic" is WATCHDOG_MAGIC
+String lastResetReason; // reason of the last reset, e.g. "Software Watchdog"
+Ticker watchdogTicker; // timer checking the running stage
+uint32_t stageStartMillis; // start of the running stage in ms, for the budget
+uint32_t stageStartMicros; // start of the running stage in us, for the duration
+
+
+/*
+ * Returns the name of "stage" for the json
+ */
+const char *stageName(const uint32_t stage) {
+  return stage < NUM_OF_STAGES ? STAGE_NAMES[stage] : "none";
+}
+
+
+/*
+ * Checks the running stage and writes a snapshot of the dump to the RTC memory, called by the timer
+ * The timer runs whenever the main loop yields, e.g. while a stage waits in "delay". A stage that runs longer than its
+ * budget restarts the ESP8266, the stage is recorded as "stalled". A stage that never yields is reset by the hardware
+ * watchdog of the ESP8266 instead, its "stage" is still in the RTC memory.
+ */
+void checkWatchdog() {
+  uint32_t heap = ESP.getFreeHeap();
+  dump.freeHeap = heap;
+  if(heap < dump.minFreeHeap) dump.minFreeHeap = heap;
+  dump.uptime = millis();
+  if(dump.stage < NUM_OF_STAGES && millis() - stageStartMillis > STAGE_BUDGET_MS[dump.stage]) {
+    dump.stalled = dump.stage;
+    dump.restarts++;
+    ESP.rtcUserMemoryWrite(WATCHDOG_RTC_OFFSET, (uint32_t*)&dump, sizeof(dump));
+    // the timer can't wait for the main loop, so the restart is requested from the SDK directly
+    system_restart();
+    return;
+  }
+  ESP.rtcUserMemoryWrite(WATCHDOG_RTC_OFFSET, (uint32_t*)&dump, sizeof(dump));
+}
+
+
+void startWatchdog() {
+  lastResetReason = ESP.getResetReason();
+  // the RTC memory is random after a power on
+  ESP.rtcUserMemoryRead(WATCHDOG_RTC_OFFSET, (uint32_t*)&lastDump, sizeof(lastDump));
+  if(ESP.getResetInfoPtr()->reason == REASON_DEFAULT_RST) lastDump.magic = 0;
+  if(lastDump.magic == WATCHDOG_MAGIC) {
+    DEBUG_WARNING("[startWatchdog] reset: %s, stage: %s, last completed: %s, stalled: %s", lastResetReason.c_str(),
+                  stageName(lastDump.stage), stageName(lastDump.lastCompleted), stageName(lastDump.stalled));
+  }
+
+  memset(&dump, 0, sizeof(dump));
+  dump.magic = WATCHDOG_MAGIC;
+  dump.stage = dump.lastCompleted = dump.stalled = STAGE_NONE;
+  dump.minFreeHeap = ESP.getFreeHeap();
+  dump.restarts = lastDump.magic == WATCHDOG_MAGIC ? lastDump.restarts : 0;
+  ESP.rtcUserMemoryWrite(WATCHDOG_RTC_OFFSET, (uint32_t*)&dump, sizeof(dump));
+  watchdogTicker.attach_ms(WATCHDOG_INTERVAL_MS, checkWatchdog);
+}
+
+
+void startStage(const uint8_t stage) {
+  dump.stage = stage;
+  stageStartMillis = millis();
+  stageStartMicros = micros();
+  // only the two words that identify the stage, so a stage costs a few us
+  ESP.rtcUserMemoryWrite(WATCHDOG_RTC_OFFSET + 1, &dump.stage, 2 * sizeof(uint32_t));
+}
+
+
+void endStage() {
+  if(dump.stage >= NUM_OF_STAGES) return;
+  uint32_t duration = micros() - stageStartMicros;
+  dump.durations[dump.stage] = duration;
+  if(duration > dump.maxDurations[dump.stage]) dump.maxDurations[dump.stage] = duration;
+  dump.lastCompleted = dump.stage;
+  dump.stage = STAGE_NONE;
+}
+
+
+void feedWatchdog() {
+  stageStartMillis = millis();
+}
+
+
+void addWatchdogDump(JsonObject& json) {
+  // reason of the last reset
+  json[CHAR_WATCHDOG_RESET_REASON] = lastResetReason;
+  // restarts by the watchdog since the power on, including the last one
+  json[CHAR_WATCHDOG_RESTARTS] = dump.restarts;
+  if(lastDump.magic != WATCHDOG_MAGIC) return;
+  // stage that was running at the reset, the last completed one and the one that exceeded its budget
+  json[CHAR_WATCHDOG_STAGE] = stageName(lastDump.stage);
+  json[CHAR_WATCHDOG_LAST_COMPLETED] = stageName(lastDump.lastCompleted);
+  json[CHAR_WATCHDOG_STALLED] = stageName(lastDump.stalled);
+  // snapshot before the reset
+  json[CHAR_METRICS_UPTIME] = lastDump.uptime;
+  json[CHAR_METRICS_FREE_HEAP] = lastDump.freeHeap;
+  json[CHAR_WATCHDOG_MIN_FREE_HEAP] = lastDump.minFreeHeap;
+  // last and max duration of each stage in us
+  JsonObject& jsonDurations = json.createNestedObject(CHAR_WATCHDOG_DURATIONS);
+  JsonObject& jsonMaxDurations = json.createNestedObject(CHAR_WATCHDOG_MAX_DURATIONS);
+  for(uint8_t s=0; s<NUM_OF_STAGES; s++) {
+    jsonDurations[STAGE_NAMES[s]] = lastDump.durations[s];
+    jsonMaxDurations[STAGE_NAMES[s]] = lastDump.maxDurations[s];
+  }
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2018 Michael Dahsler
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation 
+ * files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, 
+ * modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software 
+ * is furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE 
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+ * IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE. 
+ */
+
+#ifndef WATCHDOG__H
+#define WATCHDOG__H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// stages of the main loop
+static const uint8_t STAGE_PROFILES = 0;
+static const uint8_t STAGE_SCENES = 1;
+static const uint8_t STAGE_PWM = 2;
+static const uint8_t STAGE_SERVER = 3;
+static const uint8_t STAGE_NTP = 4;
+static const uint8_t STAGE_SYNC = 5;
+static const uint8_t STAGE_EFFECTS = 6;
+static const uint8_t STAGE_LOG = 7;
+static const uint8_t STAGE_IDLE = 8;
+static const uint8_t STAGE_MQTT = 9;
+static const uint8_t NUM_OF_STAGES = 10;
+static const uint8_t STAGE_NONE = 0xFF; // no stage is running, e.g. in the setup
+
+// constants
+static const uint32_t WATCHDOG_INTERVAL_MS = 100; // time between two checks of the running stage and snapshots of the dump
+static const uint32_t WATCHDOG_RTC_OFFSET = 64; // first block (4 bytes) of the dump in the RTC user memory, the first blocks are used by the OTA update
+static const uint32_t WATCHDOG_MAGIC = 0x52574454; // marks a valid dump in the RTC memory
+
+/*
+ * Dump of the watchdog in the RTC memory, it survives a restart but not a power loss
+ * "stage" and "lastCompleted" are written at the start of every stage, so they are valid even if the hardware
+ * watchdog resets the ESP8266 in a stage that never yields. The rest is a snapshot written every "WATCHDOG_INTERVAL_MS".
+ */
+struct WatchdogDump {
+  uint32_t magic; // WATCHDOG_MAGIC if the dump is valid
+  uint32_t stage; // stage that is running, STAGE_NONE between the loops
+  uint32_t lastCompleted; // last stage that has completed
+  uint32_t durations[NUM_OF_STAGES]; // duration of the last run of each stage in us
+  uint32_t maxDurations[NUM_OF_STAGES]; // max duration of each stage since the start in us
+  uint32_t freeHeap; // free heap in bytes at the last snapshot
+  uint32_t minFreeHeap; // min free heap in bytes since the start
+  uint32_t uptime; // time since the start in ms at the last snapshot
+  uint32_t stalled; // stage that exceeded its budget and caused the restart, STAGE_NONE otherwise
+  uint32_t restarts; // number of restarts by the watchdog since the power on
+};
+
+// reads the dump of the last run and starts the checks of the stages
+void startWatchdog();
+// marks the start of "stage" in the main loop
+void startStage(const uint8_t stage);
+// marks the end of the running stage and records its duration
+void endStage();
+// restarts the budget of the running stage, for long work that is known to make progress
+void feedWatchdog();
+// adds the dump of the last run and the reset reason to "json"
+void addWatchdogDump(JsonObject& json);
+
+#endif